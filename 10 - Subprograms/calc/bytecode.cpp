@@ -0,0 +1,489 @@
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include "bytecode.h"
+
+// convert opcodes to strings
+const char* OPSTR[] = {
+    "HALT",
+    "PUSH_I",
+    "PUSH_R",
+    "POP",
+    "LOAD",
+    "STORE",
+    "LOAD_G",
+    "STORE_G",
+    "LOAD_UP",
+    "STORE_UP",
+    "ADD_I",
+    "ADD_R",
+    "SUB_I",
+    "SUB_R",
+    "MUL_I",
+    "MUL_R",
+    "DIV_I",
+    "DIV_R",
+    "POW_I",
+    "POW_R",
+    "NEG_I",
+    "NEG_R",
+    "I2R",
+    "R2I",
+    "EQ_I",
+    "EQ_R",
+    "NE_I",
+    "NE_R",
+    "JMP",
+    "JZ",
+    "CALL",
+    "TAILCALL",
+    "RET",
+    "PRINT_I",
+    "PRINT_R"
+};
+
+
+// the number of operands of each instruction
+static int operands(int op)
+{
+    switch(op) {
+        case OP_PUSH_I:
+        case OP_PUSH_R:
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_LOAD_G:
+        case OP_STORE_G:
+        case OP_JMP:
+        case OP_JZ:
+        case OP_TAILCALL:
+            return 1;
+        case OP_LOAD_UP:
+        case OP_STORE_UP:
+        case OP_CALL:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+
+// the change in stack depth caused by each instruction (except the calls)
+static int stack_effect(int op)
+{
+    switch(op) {
+        case OP_PUSH_I:
+        case OP_PUSH_R:
+        case OP_LOAD:
+        case OP_LOAD_G:
+        case OP_LOAD_UP:
+            return 1;
+        case OP_POP:
+        case OP_STORE:
+        case OP_STORE_G:
+        case OP_STORE_UP:
+        case OP_ADD_I:
+        case OP_ADD_R:
+        case OP_SUB_I:
+        case OP_SUB_R:
+        case OP_MUL_I:
+        case OP_MUL_R:
+        case OP_DIV_I:
+        case OP_DIV_R:
+        case OP_POW_I:
+        case OP_POW_R:
+        case OP_EQ_I:
+        case OP_EQ_R:
+        case OP_NE_I:
+        case OP_NE_R:
+        case OP_JZ:
+        case OP_RET:
+        case OP_PRINT_I:
+        case OP_PRINT_R:
+            return -1;
+        default:
+            return 0;
+    }
+}
+
+
+//////////////////////////////////////////
+// Bytecode Implementation
+//////////////////////////////////////////
+
+// print a readable listing of the program
+void Bytecode::disassemble(std::ostream &os) const
+{
+    for(int f=0; f<(int) functions.size(); f++) {
+        const FunctionCode &fun = functions[f];
+        int end = f+1 < (int) functions.size() ? functions[f+1].entry : code.size();
+
+        os << "function " << f << " " << fun.name
+           << " (params: " << fun.nparams
+           << ", slots: " << fun.nslots
+           << ", stack: " << fun.max_stack << ")" << std::endl;
+
+        for(int pc = fun.entry; pc < end; pc += 1 + operands(code[pc])) {
+            os << std::setw(6) << pc << "  " << OPSTR[code[pc]];
+            for(int i=1; i<=operands(code[pc]); i++) {
+                os << " " << code[pc+i];
+            }
+            if(code[pc] == OP_PUSH_R) {
+                os << "  (" << reals[code[pc+1]] << ")";
+            }
+            os << std::endl;
+        }
+    }
+}
+
+
+//////////////////////////////////////////
+// BytecodeCompiler Implementation
+//////////////////////////////////////////
+
+// compile a type checked program
+Bytecode *BytecodeCompiler::compile(ParseTree *program)
+{
+    std::vector<Scope*> scopes;
+    _bc = new Bytecode();
+    _pending.clear();
+
+    // the top level program is function 0
+    FunctionCode main;
+    main.name = "<main>";
+    _bc->functions.push_back(main);
+    _pending.push_back(Pending{0, nullptr, nullptr});
+
+    // Compile the functions one after another. Their scopes stay alive
+    // until the end because nested functions refer to them.
+    for(int i=0; i<(int) _pending.size(); i++) {
+        Pending p = _pending[i];
+        _scope = new Scope();
+        _scope->parent = p.scope;
+        _scope->depth = p.scope ? p.scope->depth + 1 : 0;
+        _scope->fid = p.fid;
+        scopes.push_back(_scope);
+
+        if(p.fun) {
+            compile_function(p.fid, p.fun->body(), p.fun->return_type());
+        } else {
+            compile_function(p.fid, (Program*) program, VOID);
+        }
+    }
+
+    for(auto itr = scopes.begin(); itr != scopes.end(); itr++) {
+        delete *itr;
+    }
+
+    return _bc;
+}
+
+
+// compile a function body in a new scope
+void BytecodeCompiler::compile_function(int fid, Program *body, ResultType return_type)
+{
+    FunctionCode &fun = _bc->functions[fid];
+    fun.entry = here();
+    fun.nslots = 0;
+    fun.nparams = 0;
+    _depth = 0;
+    _max_depth = 0;
+
+    // parameters come first in the frame
+    if(fid != 0) {
+        FunctionDef *def = _pending[fid].fun;
+        ArgList *params = def->parameters();
+        for(auto itr = params->begin(); itr != params->end(); itr++) {
+            VarDecl *decl = (VarDecl*) *itr;
+            declare(decl->child()->token().lexeme, decl->child()->type(), _bc->functions[fid].nslots++);
+        }
+        _bc->functions[fid].nparams = _bc->functions[fid].nslots;
+    }
+
+    // the body's last statement is the return value
+    compile_block(body, return_type != VOID);
+    if(fid == 0) {
+        emit(OP_HALT);
+    } else {
+        if(return_type == VOID) {
+            emit(OP_PUSH_I, 0);
+        } else {
+            ParseTree *last = body->size() ? body->child(body->size()-1) : nullptr;
+            convert(last ? last->type() : VOID, return_type);
+        }
+        emit(OP_RET);
+    }
+
+    _bc->functions[fid].max_stack = _max_depth;
+}
+
+
+// compile a block, declaring its functions first
+void BytecodeCompiler::compile_block(Program *block, bool want_value)
+{
+    // functions may be called before their definition runs
+    for(int i=0; i<block->size(); i++) {
+        FunctionDef *fun = dynamic_cast<FunctionDef*>(block->child(i));
+        if(not fun) continue;
+
+        int fid = _bc->functions.size();
+        FunctionCode code;
+        code.name = fun->name();
+        _bc->functions.push_back(code);
+        _pending.push_back(Pending{fid, fun, _scope});
+        declare(fun->name(), FUNCTION_TYPE, fid);
+    }
+
+    for(int i=0; i<block->size(); i++) {
+        compile(block->child(i), want_value and i == block->size()-1);
+    }
+
+    if(want_value and block->size() == 0) {
+        emit(OP_PUSH_I, 0);
+    }
+}
+
+
+// compile a statement or expression, leaving a value only if wanted
+void BytecodeCompiler::compile(ParseTree *tree, bool want_value)
+{
+    if(Print *print = dynamic_cast<Print*>(tree)) {
+        compile_expr(print->child());
+        emit(print->child()->type() == INTEGER ? OP_PRINT_I : OP_PRINT_R);
+    } else if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        // slots are zeroed when the frame is created
+        FunctionCode &fun = _bc->functions[_scope->fid];
+        declare(decl->child()->token().lexeme, decl->child()->type(), fun.nslots++);
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        std::string name = assign->left()->token().lexeme;
+        compile_as(assign->right(), lookup(name).type);
+        compile_store(name);
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        int top = here();
+        compile_as(loop->left(), INTEGER);
+        emit(OP_JZ, 0);
+        int exit = here() - 1;
+        compile_block((Program*) loop->right(), false);
+        emit(OP_JMP, top);
+        _bc->code[exit] = here();
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        compile_as(branch->left(), INTEGER);
+        emit(OP_JZ, 0);
+        int exit = here() - 1;
+        compile_block((Program*) branch->right(), false);
+        _bc->code[exit] = here();
+    } else if(dynamic_cast<FunctionDef*>(tree)) {
+        // compiled on its own after the enclosing function
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        compile_block(block, want_value);
+        return;
+    } else {
+        // an expression statement
+        compile_expr(tree);
+        if(not want_value) {
+            emit(OP_POP);
+        }
+        return;
+    }
+
+    // statements have no value
+    if(want_value) {
+        emit(OP_PUSH_I, 0);
+    }
+}
+
+
+// compile an expression, leaving a value of its type on the stack
+void BytecodeCompiler::compile_expr(ParseTree *tree)
+{
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        Result val = num->value();
+        if(val.type() == INTEGER) {
+            emit(OP_PUSH_I, val.i());
+        } else {
+            _bc->reals.push_back(val.r());
+            emit(OP_PUSH_R, _bc->reals.size() - 1);
+        }
+    } else if(dynamic_cast<Var*>(tree)) {
+        compile_load(tree->token().lexeme);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        compile_expr(neg->child());
+        emit(neg->child()->type() == INTEGER ? OP_NEG_I : OP_NEG_R);
+    } else if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        compile_compare((BinaryOp*) tree);
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        compile_call(call);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        compile_arith(op);
+    } else {
+        throw std::runtime_error("Cannot compile " + tree->token().lexeme);
+    }
+}
+
+
+// compile an expression converted to the given type
+void BytecodeCompiler::compile_as(ParseTree *tree, ResultType type)
+{
+    compile_expr(tree);
+    convert(tree->type(), type);
+}
+
+
+// arithmetic is done in the type of the result
+void BytecodeCompiler::compile_arith(BinaryOp *op)
+{
+    ResultType t = op->type();
+    compile_as(op->left(), t);
+    compile_as(op->right(), t);
+
+    bool r = t == REAL;
+    if(dynamic_cast<Add*>(op)) {
+        emit(r ? OP_ADD_R : OP_ADD_I);
+    } else if(dynamic_cast<Sub*>(op)) {
+        emit(r ? OP_SUB_R : OP_SUB_I);
+    } else if(dynamic_cast<Mul*>(op)) {
+        emit(r ? OP_MUL_R : OP_MUL_I);
+    } else if(dynamic_cast<Div*>(op)) {
+        emit(r ? OP_DIV_R : OP_DIV_I);
+    } else if(dynamic_cast<Pow*>(op)) {
+        emit(r ? OP_POW_R : OP_POW_I);
+    }
+}
+
+
+// comparisons are done on integers unless either side is real
+void BytecodeCompiler::compile_compare(BinaryOp *op)
+{
+    bool r = op->left()->type() == REAL or op->right()->type() == REAL;
+    ResultType t = r ? REAL : INTEGER;
+    compile_as(op->left(), t);
+    compile_as(op->right(), t);
+
+    if(dynamic_cast<Equal*>(op)) {
+        emit(r ? OP_EQ_R : OP_EQ_I);
+    } else {
+        emit(r ? OP_NE_R : OP_NE_I);
+    }
+}
+
+
+// arguments are converted to their parameter types
+void BytecodeCompiler::compile_call(FunctionCall *call)
+{
+    Symbol fun = lookup(call->left()->token().lexeme);
+    FunctionDef *def = _pending[fun.slot].fun;
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = def->parameters();
+
+    for(int i=0; i<args->size(); i++) {
+        compile_as(args->child(i), ((VarDecl*) params->child(i))->child()->type());
+    }
+
+    // A tail call of the running function reuses its frame. Otherwise
+    // the static link is found by walking out to the declaring function.
+    if(call->tail() and fun.slot == _scope->fid) {
+        emit(OP_TAILCALL, fun.slot);
+    } else {
+        emit(OP_CALL, fun.slot, _scope->depth - fun.depth);
+    }
+    _depth -= args->size();
+}
+
+
+void BytecodeCompiler::compile_load(const std::string &name)
+{
+    Symbol sym = lookup(name);
+
+    if(sym.type == FUNCTION_TYPE) {
+        // function values are only ever discarded
+        emit(OP_PUSH_I, 0);
+    } else if(sym.depth == 0) {
+        emit(OP_LOAD_G, sym.slot);
+    } else if(sym.depth == _scope->depth) {
+        emit(OP_LOAD, sym.slot);
+    } else {
+        emit(OP_LOAD_UP, _scope->depth - sym.depth, sym.slot);
+    }
+}
+
+
+void BytecodeCompiler::compile_store(const std::string &name)
+{
+    Symbol sym = lookup(name);
+
+    if(sym.depth == 0) {
+        emit(OP_STORE_G, sym.slot);
+    } else if(sym.depth == _scope->depth) {
+        emit(OP_STORE, sym.slot);
+    } else {
+        emit(OP_STORE_UP, _scope->depth - sym.depth, sym.slot);
+    }
+}
+
+
+// name resolution
+BytecodeCompiler::Symbol BytecodeCompiler::lookup(const std::string &name)
+{
+    for(Scope *scope = _scope; scope; scope = scope->parent) {
+        auto itr = scope->names.find(name);
+        if(itr != scope->names.end()) {
+            return itr->second;
+        }
+    }
+
+    throw std::runtime_error(name + " not defined.");
+}
+
+
+void BytecodeCompiler::declare(const std::string &name, ResultType type, int slot)
+{
+    Symbol sym;
+    sym.type = type;
+    sym.depth = _scope->depth;
+    sym.slot = slot;
+    _scope->names[name] = sym;
+}
+
+
+// emit instructions, tracking the operand stack depth
+void BytecodeCompiler::emit(int op)
+{
+    _bc->code.push_back(op);
+
+    // calls push their result, the caller accounts for the arguments
+    _depth += op == OP_CALL or op == OP_TAILCALL ? 1 : stack_effect(op);
+    if(_depth > _max_depth) {
+        _max_depth = _depth;
+    }
+}
+
+
+void BytecodeCompiler::emit(int op, int a)
+{
+    emit(op);
+    _bc->code.push_back(a);
+}
+
+
+void BytecodeCompiler::emit(int op, int a, int b)
+{
+    emit(op);
+    _bc->code.push_back(a);
+    _bc->code.push_back(b);
+}
+
+
+void BytecodeCompiler::convert(ResultType from, ResultType to)
+{
+    if(from == INTEGER and to == REAL) {
+        emit(OP_I2R);
+    } else if(from == REAL and to == INTEGER) {
+        emit(OP_R2I);
+    }
+}
+
+
+// the position of the next instruction
+int BytecodeCompiler::here() const
+{
+    return _bc->code.size();
+}
@@ -0,0 +1,165 @@
+// This file contains the stack bytecode for calc programs and the
+// compiler which translates type checked parse trees into it.
+#ifndef BYTECODE_H
+#define BYTECODE_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "op.h"
+
+
+//////////////////////////////////////////
+// Instruction Set
+//////////////////////////////////////////
+
+// Instructions are stored as ints, with their operands following them
+// in the code. The _I and _R suffixes give the type of the operands.
+enum Opcode
+{
+    OP_HALT=0,
+    OP_PUSH_I,      // value         push an integer literal
+    OP_PUSH_R,      // index         push a real from the constant pool
+    OP_POP,         //               discard the top of the stack
+    OP_LOAD,        // slot          push a local variable
+    OP_STORE,       // slot          pop into a local variable
+    OP_LOAD_G,      // slot          push a global variable
+    OP_STORE_G,     // slot          pop into a global variable
+    OP_LOAD_UP,     // hops slot     push a variable of an enclosing function
+    OP_STORE_UP,    // hops slot     pop into a variable of an enclosing function
+    OP_ADD_I,
+    OP_ADD_R,
+    OP_SUB_I,
+    OP_SUB_R,
+    OP_MUL_I,
+    OP_MUL_R,
+    OP_DIV_I,
+    OP_DIV_R,
+    OP_POW_I,
+    OP_POW_R,
+    OP_NEG_I,
+    OP_NEG_R,
+    OP_I2R,         //               widen the top of the stack to a real
+    OP_R2I,         //               truncate the top of the stack to an integer
+    OP_EQ_I,
+    OP_EQ_R,
+    OP_NE_I,
+    OP_NE_R,
+    OP_JMP,         // target        jump to an absolute code position
+    OP_JZ,          // target        pop an integer, jump if it is zero
+    OP_CALL,        // fid hops      call a function, hops gives its static link
+    OP_TAILCALL,    // fid           call the running function again in its own frame
+    OP_RET,         //               return the top of the stack
+    OP_PRINT_I,
+    OP_PRINT_R,
+    OP_COUNT
+};
+
+// convert opcodes to strings
+extern const char* OPSTR[];
+
+
+// A compiled function. Parameters occupy the first slots of its frame.
+struct FunctionCode
+{
+    std::string name;
+    int entry;          // position of the first instruction
+    int nparams;        // number of parameters
+    int nslots;         // parameters and locals
+    int max_stack;      // deepest the operand stack gets
+};
+
+
+// A compiled program. Function 0 is the top level program, whose
+// frame holds the global variables.
+struct Bytecode
+{
+    std::vector<int> code;
+    std::vector<double> reals;
+    std::vector<FunctionCode> functions;
+
+    // print a readable listing of the program
+    void disassemble(std::ostream &os) const;
+};
+
+
+//////////////////////////////////////////
+// The Compiler
+//////////////////////////////////////////
+class BytecodeCompiler
+{
+public:
+    // compile a type checked program
+    virtual Bytecode *compile(ParseTree *program);
+
+protected:
+    // What a name refers to
+    struct Symbol
+    {
+        ResultType type;
+        int depth;          // nesting depth of the declaring function
+        int slot;           // variable slot or function id
+    };
+
+    // The names declared by one function
+    struct Scope
+    {
+        std::map<std::string, Symbol> names;
+        Scope *parent;
+        int depth;
+        int fid;
+    };
+
+    // compile a function body in a new scope
+    virtual void compile_function(int fid, Program *body, ResultType return_type);
+
+    // compile a block, declaring its functions first
+    virtual void compile_block(Program *block, bool want_value);
+
+    // compile a statement or expression, leaving a value only if wanted
+    virtual void compile(ParseTree *tree, bool want_value);
+
+    // compile an expression, leaving a value of its type on the stack
+    virtual void compile_expr(ParseTree *tree);
+
+    // compile an expression converted to the given type
+    virtual void compile_as(ParseTree *tree, ResultType type);
+
+    // node specific compilers
+    virtual void compile_arith(BinaryOp *op);
+    virtual void compile_compare(BinaryOp *op);
+    virtual void compile_call(FunctionCall *call);
+    virtual void compile_load(const std::string &name);
+    virtual void compile_store(const std::string &name);
+
+    // name resolution
+    virtual Symbol lookup(const std::string &name);
+    virtual void declare(const std::string &name, ResultType type, int slot);
+
+    // emit instructions, tracking the operand stack depth
+    virtual void emit(int op);
+    virtual void emit(int op, int a);
+    virtual void emit(int op, int a, int b);
+    virtual void convert(ResultType from, ResultType to);
+
+    // the position of the next instruction
+    virtual int here() const;
+
+private:
+    Bytecode *_bc;
+    Scope *_scope;
+
+    // deferred function bodies
+    struct Pending
+    {
+        int fid;
+        FunctionDef *fun;
+        Scope *scope;
+    };
+    std::vector<Pending> _pending;
+
+    // state of the function being compiled
+    int _depth;
+    int _max_depth;
+};
+#endif
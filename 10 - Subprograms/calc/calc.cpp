@@ -3,23 +3,204 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <cstdlib>
+#include <stdexcept>
 #include "lexer.h"
 #include "parser.h"
 #include "op.h"
+#include "typecheck.h"
+#include "optimize.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "regcode.h"
+#include "regvm.h"
+#include "jit.h"
+#include "tier.h"
+#include "memo.h"
+#include "stackeval.h"
+#include "emit.h"
+#include "ssa.h"
 
 // Functions for the two modes of operation
 static void calc_file(const char *fname);
 static void calc_repl();
 
+// Check and optimize a freshly parsed program. A whole program may lose
+// the code it never uses, a line of the REPL may not.
+static ParseTree *prepare(ParseTree *program, TypeChecker &checker, bool whole);
+
+// Write a prepared program as C++, and build it if asked
+static void compile_cpp(ParseTree *program);
+
+// Command line options
+static bool show_stats = false;
+static bool show_tree = false;
+static bool use_vm = false;
+static bool use_rvm = false;
+static bool use_jit = false;
+static bool tiered = false;
+static bool use_memo = false;
+static bool show_bytecode = false;
+static bool explicit_stack = false;
+static long long max_depth = 1000000;
+static bool emit_cpp = false;
+static bool use_ssa = false;
+static bool show_ir = false;
+static std::string build_output;
+
 
 int main(int argc, char **argv) {
+    // handle the options
+    int i;
+    for(i=1; i<argc and argv[i][0] == '-'; i++) {
+        std::string opt = argv[i];
+        if(opt == "--stats") {
+            show_stats = true;
+        } else if(opt == "--tree") {
+            show_tree = true;
+        } else if(opt == "--vm") {
+            use_vm = true;
+        } else if(opt == "--rvm") {
+            use_rvm = true;
+        } else if(opt == "--tiered") {
+            tiered = true;
+        } else if(opt == "--jit") {
+            use_jit = true;
+        } else if(opt == "--memo") {
+            use_memo = true;
+        } else if(opt == "--bytecode") {
+            show_bytecode = true;
+        } else if(opt == "--explicit-stack") {
+            explicit_stack = true;
+        } else if(opt.compare(0, 12, "--max-depth=") == 0) {
+            max_depth = atoll(opt.c_str() + 12);
+        } else if(opt == "--ssa") {
+            use_ssa = true;
+        } else if(opt == "--ir") {
+            show_ir = true;
+        } else if(opt == "--emit-cpp") {
+            emit_cpp = true;
+        } else if(opt.compare(0, 8, "--build=") == 0) {
+            build_output = opt.substr(8);
+        } else {
+            i = argc + 1;
+        }
+    }
+
+    // a listing needs something to list
+    if(show_bytecode and not use_rvm) {
+        use_vm = true;
+    }
+    if(show_ir) {
+        use_ssa = true;
+    }
+
     //run the appropriate mode
-    if(argc == 1) {
+    if(i == argc) {
         calc_repl();
-    } else if(argc == 2) {
-        calc_file(argv[1]);
+    } else if(i == argc - 1) {
+        calc_file(argv[i]);
     } else {
-        std::cerr << "Usage: " << argv[0] << " [filename]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--stats] [--tree] [--vm] [--rvm] [--jit] [--tiered] [--memo] [--bytecode] [--explicit-stack] [--max-depth=N] [--ssa] [--ir] [--emit-cpp] [--build=OUT] [filename]" << std::endl;
+    }
+}
+
+
+static ParseTree *prepare(ParseTree *program, TypeChecker &checker, bool whole)
+{
+    // check the types before anything runs
+    checker.check(program);
+
+    // tail calls run in constant space, whatever else is done
+    TailCalls tails;
+    tails.run(program);
+    if(show_stats) {
+        std::cerr << "Tail calls: " << tails.count() << std::endl;
+    }
+
+    // pure functions remember their results
+    if(use_memo) {
+        Memoizer memoizer;
+        memoizer.run(program);
+        if(show_stats) {
+            std::cerr << "Memoized functions: " << memoizer.count() << std::endl;
+            for(auto itr = memoizer.report().begin(); itr != memoizer.report().end(); itr++) {
+                std::cerr << "    " << *itr << std::endl;
+            }
+        }
+    }
+
+    // tiered execution optimizes hot functions as it goes
+    if(tiered) {
+        return program;
+    }
+
+    // run the optimization passes
+    Inliner inliner;
+    program = inliner.run(program);
+    ConstantFolder folder;
+    program = folder.run(program);
+    DeadCodeEliminator dce;
+    if(whole) {
+        program = dce.run(program);
+    }
+    LoopInvariantMotion licm;
+    program = licm.run(program);
+    CommonSubexpressions cse;
+    program = cse.run(program);
+    Specializer specializer;
+    program = specializer.run(program);
+    Superinstructions fuser;
+    program = fuser.run(program);
+
+    if(show_stats) {
+        std::cerr << "Inlined calls: " << inliner.count() << std::endl;
+        for(auto itr = inliner.report().begin(); itr != inliner.report().end(); itr++) {
+            std::cerr << "    " << *itr << std::endl;
+        }
+        std::cerr << "Constant folding: " << folder.count() << " nodes" << std::endl;
+        std::cerr << "Dead code: " << dce.functions() << " functions, " << dce.stores()
+                  << " stores, " << dce.decls() << " declarations, " << dce.branches()
+                  << " branches, " << dce.bytes() << " bytes" << std::endl;
+        std::cerr << "Loop invariants: " << licm.count() << std::endl;
+        std::cerr << "Common subexpressions: " << cse.count() << std::endl;
+        std::cerr << "Specialized: " << specializer.count() << " nodes" << std::endl;
+        std::cerr << "Reduced powers: " << specializer.reduced() << std::endl;
+        std::cerr << "Superinstructions: " << fuser.increments() << " increments, "
+                  << fuser.compounds() << " compound assignments, "
+                  << fuser.compare_loops() << " loops" << std::endl;
+    }
+
+    return program;
+}
+
+
+static void compile_cpp(ParseTree *program)
+{
+    CppEmitter emitter;
+    if(emit_cpp) {
+        emitter.emit(program, std::cout);
+    }
+    if(build_output.empty()) {
+        return;
+    }
+
+    // the source goes next to the output, named after it
+    std::string source = build_output;
+    if(source.size() > 3 and source.compare(source.size() - 3, 3, ".so") == 0) {
+        source.resize(source.size() - 3);
+    }
+    source += ".cpp";
+    std::ofstream os(source);
+    if(!os) {
+        std::cerr << "Could not write " << source << std::endl;
+        return;
+    }
+    emitter.emit(program, os);
+    os.close();
+
+    if(build_cpp(source, build_output) != 0) {
+        std::cerr << "Could not build " << build_output << std::endl;
     }
 }
 
@@ -28,6 +209,7 @@ static void calc_file(const char *fname)
 {
     // Create the global scope
     RefEnv global;
+    TypeChecker checker;
 
     // attempt to open the file
     std::ifstream file;
@@ -44,14 +226,118 @@ static void calc_file(const char *fname)
         Parser parser{lex};
         ParseTree *program = parser.parse();
 
+        program = prepare(program, checker, true);
+        if(show_tree) {
+            program->print(0);
+        }
+
+        // compile the program instead of running it
+        if(emit_cpp or not build_output.empty()) {
+            compile_cpp(program);
+            file.close();
+            return;
+        }
+
         // run the program
-        program->eval(global);
+        if(use_ssa) {
+            SsaBuilder builder;
+            SsaProgram *ir = builder.build(program);
+            int lowered = ir->size();
+            SsaPassManager passes;
+            passes.add(new CopyPropagation);
+            passes.add(new ConstantPropagation);
+            passes.add(new CopyPropagation);
+            passes.add(new ValueNumbering);
+            passes.add(new DeadCodeElimination);
+            passes.run(ir);
+            if(show_ir) {
+                ir->print(std::cout);
+            }
+            SsaInterpreter interpreter;
+            interpreter.run(ir, global);
+            if(show_stats) {
+                std::cerr << "SSA instructions: " << lowered << " lowered, "
+                          << ir->size() << " optimized" << std::endl;
+                passes.report(std::cerr);
+            }
+            delete ir;
+        } else if(use_rvm) {
+            RegisterCompiler compiler;
+            RegisterCode *rc = compiler.compile(program);
+            if(show_bytecode) {
+                rc->disassemble(std::cout);
+            }
+            RegisterVM vm;
+            vm.run(*rc);
+            if(show_stats) {
+                std::cerr << "Instructions executed: " << vm.count() << std::endl;
+            }
+            delete rc;
+        } else if(use_vm) {
+            BytecodeCompiler compiler;
+            Bytecode *bc = compiler.compile(program);
+            if(show_bytecode) {
+                bc->disassemble(std::cout);
+            }
+            VM vm;
+            vm.run(*bc);
+            if(show_stats) {
+                std::cerr << "Instructions executed: " << vm.count() << std::endl;
+            }
+            delete bc;
+        } else {
+            Jit jit;
+            jit.enable(use_jit);
+            TierManager tiers;
+            if(tiered) {
+                tiers.watch(program);
+            }
+            if(explicit_stack) {
+                StackEvaluator evaluator(max_depth);
+                evaluator.run(program, global);
+                if(show_stats) {
+                    std::cerr << "Deepest call: " << evaluator.deepest() << std::endl;
+                }
+            } else {
+                program->eval(global);
+            }
+            if(show_stats) {
+                std::cerr << "Fused executions: " << Increment::hits << " increments, "
+                          << CompoundAssign::hits << " compound assignments, "
+                          << CompareLoop::hits << " loop tests" << std::endl;
+                std::cerr << "Call site cache: " << FunctionCall::cache_hits << " hits, "
+                          << FunctionCall::cache_misses << " misses" << std::endl;
+                std::cerr << "Frames: " << FrameStack::frames << " pushed, "
+                          << RefEnv::allocations << " table allocations" << std::endl;
+                std::cerr << "Type feedback: " << TypeFeedback::guesses << " guesses, "
+                          << TypeFeedback::deopts << " deoptimizations" << std::endl;
+            }
+            if(show_stats and use_memo) {
+                std::cerr << "Memo tables: " << Memo::hits << " hits, " << Memo::misses
+                          << " misses, " << Memo::evictions << " evictions" << std::endl;
+            }
+            if(show_stats and use_jit) {
+                std::cerr << "Native functions: " << jit.compiled() << std::endl;
+                std::cerr << "Native calls: " << jit.calls() << std::endl;
+                std::cerr << "Native loops: " << jit.loops() << std::endl;
+            }
+            if(show_stats and tiered) {
+                std::cerr << "Optimized functions: " << tiers.promoted() << std::endl;
+                std::cerr << "Slot resolved accesses: " << tiers.resolved() << std::endl;
+            }
+        }
 
         file.close();
     } catch(ParseError e) {
         std::cerr << e.what() << std::endl;
         file.close();
-    } 
+    } catch(TypeError e) {
+        std::cerr << e.what() << std::endl;
+        file.close();
+    } catch(std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        file.close();
+    }
 
 }
 
@@ -66,6 +352,7 @@ static void calc_repl()
     std::string line;
     bool print_tree;
     RefEnv global;
+    TypeChecker checker;
 
     std::cout << "Print parse tree (y/n)? ";
     std::getline(std::cin, line);
@@ -92,10 +379,23 @@ static void calc_repl()
             if(print_tree) {
                 program->print(0);
             }
-            program->eval(global);
+            program = prepare(program, checker, false);
+            if(show_tree) {
+                program->print(0);
+            }
+            if(explicit_stack) {
+                StackEvaluator evaluator(max_depth);
+                evaluator.run(program, global);
+            } else {
+                program->eval(global);
+            }
             delete program;
         } catch(ParseError e) {
             std::cerr << e.what() << std::endl;
+        } catch(TypeError e) {
+            std::cerr << e.what() << std::endl;
+        } catch(std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
         }
     
         // attempt to parse and run the stream
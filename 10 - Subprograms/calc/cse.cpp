@@ -0,0 +1,178 @@
+// Common subexpression elimination for calc parse trees.
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Candidate Expressions
+//////////////////////////////////////////
+
+// one appearance of an expression
+struct Occurrence
+{
+    ParseTree *parent;
+    ParseTree *node;
+    int stmt;
+};
+
+
+// all appearances of an expression while its variables are unchanged
+struct Candidate
+{
+    std::vector<Occurrence> occ;
+    std::set<std::string> deps;
+    int saving;
+};
+
+
+// collect the candidate expressions of a statement
+static void collect(ParseTree *parent, ParseTree *tree, int stmt,
+                    std::map<std::string, Candidate> &live)
+{
+    if(not tree or dynamic_cast<VarDecl*>(tree)) return;
+
+    if(is_movable(tree)) {
+        Candidate &cand = live[tree_key(tree)];
+        if(cand.occ.empty()) {
+            vars_read(tree, cand.deps);
+        }
+        cand.occ.push_back(Occurrence{parent, tree, stmt});
+    }
+
+    // visit the children
+    if(Assign *op = dynamic_cast<Assign*>(tree)) {
+        collect(tree, op->right(), stmt, live);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        collect(tree, op->child(), stmt, live);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        collect(tree, op->left(), stmt, live);
+        collect(tree, op->right(), stmt, live);
+    }
+}
+
+
+// retire the candidates which depend on the killed names
+static void close(std::map<std::string, Candidate> &live, const std::set<std::string> &killed,
+                  bool kill_all, Candidate &best)
+{
+    for(auto itr = live.begin(); itr != live.end(); ) {
+        bool dead = kill_all;
+        for(auto name = killed.begin(); not dead and name != killed.end(); name++) {
+            dead = itr->second.deps.count(*name) > 0;
+        }
+
+        if(not dead) {
+            itr++;
+            continue;
+        }
+
+        // A temporary costs one assignment plus a read per use
+        Candidate &cand = itr->second;
+        int k = cand.occ.size();
+        if(k > 1) {
+            cand.saving = (k-1) * tree_cost(cand.occ[0].node) - (k+1) * VAR_COST;
+            if(cand.saving > best.saving) {
+                best = cand;
+            }
+        }
+        itr = live.erase(itr);
+    }
+}
+
+
+//////////////////////////////////////////
+// CommonSubexpressions Implementation
+//////////////////////////////////////////
+
+ParseTree *CommonSubexpressions::run(ParseTree *tree)
+{
+    if(Program *program = dynamic_cast<Program*>(tree)) {
+        run_block(program, program);
+    }
+    return tree;
+}
+
+
+ParseTree *CommonSubexpressions::rewrite(ParseTree *tree)
+{
+    // the pass works on whole blocks in run_block
+    return tree;
+}
+
+
+// eliminate subexpressions in a block, declaring temporaries in scope
+void CommonSubexpressions::run_block(Program *block, Program *scope)
+{
+    while(eliminate_one(block, scope)) {
+        _count++;
+    }
+
+    // handle the nested blocks
+    std::vector<ParseTree*> stmts(block->begin(), block->end());
+    for(auto itr = stmts.begin(); itr != stmts.end(); itr++) {
+        if(dynamic_cast<While*>(*itr) or dynamic_cast<Branch*>(*itr)) {
+            run_block((Program*) ((BinaryOp*) *itr)->right(), scope);
+        } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(*itr)) {
+            run_block(fun->body(), fun->body());
+        }
+    }
+}
+
+
+// find and replace the most profitable repeated subexpression
+bool CommonSubexpressions::eliminate_one(Program *block, Program *scope)
+{
+    std::map<std::string, Candidate> live;
+    std::set<std::string> none;
+    Candidate best;
+    best.saving = 0;
+
+    for(int i=0; i<block->size(); i++) {
+        ParseTree *stmt = block->child(i);
+        std::set<std::string> killed;
+
+        if(dynamic_cast<FunctionDef*>(stmt)) {
+            continue;
+        } else if(has_call(stmt)) {
+            // calls may write any global
+            close(live, none, true, best);
+            continue;
+        } else if(dynamic_cast<While*>(stmt) or dynamic_cast<Branch*>(stmt)) {
+            // nested blocks are handled on their own
+            vars_written(stmt, killed);
+            close(live, killed, false, best);
+            continue;
+        }
+
+        // expressions are available until the statement's assignment
+        collect(block, stmt, i, live);
+        vars_written(stmt, killed);
+        close(live, killed, false, best);
+    }
+    close(live, none, true, best);
+
+    if(best.saving <= 0) return false;
+
+    // compute the first occurrence into the temporary
+    Occurrence &first = best.occ[0];
+    ResultType type = first.node->type();
+    LexerToken tok = first.node->token();
+    std::string name = temp_name("cse");
+
+    replace_child(first.parent, first.node, make_var(tok, name, type));
+    block->insert(first.stmt, make_assign(tok, name, type, first.node));
+
+    // the rest read the temporary
+    for(auto itr = best.occ.begin() + 1; itr != best.occ.end(); itr++) {
+        replace_child(itr->parent, itr->node, make_var(tok, name, type));
+        delete itr->node;
+    }
+
+    // declare the temporary at the top of the scope
+    scope->insert(0, make_decl(tok, name, type));
+
+    return true;
+}
@@ -0,0 +1,305 @@
+// Dead code and dead function elimination for whole calc programs.
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Program Facts
+//////////////////////////////////////////
+
+// collect every function definition, however deeply nested
+static void find_defs(ParseTree *tree, std::map<std::string, std::vector<FunctionDef*> > &defs)
+{
+    if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        defs[fun->name()].push_back(fun);
+        find_defs(fun->body(), defs);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        find_defs(op->right(), defs);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            find_defs(*itr, defs);
+        }
+    }
+}
+
+
+// collect the names called by a tree, outside the functions it defines
+static void find_calls(ParseTree *tree, std::vector<std::string> &names)
+{
+    if(not tree or dynamic_cast<FunctionDef*>(tree)) {
+        return;
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        names.push_back(call->left()->token().lexeme);
+        find_calls(call->right(), names);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        find_calls(op->child(), names);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        find_calls(op->left(), names);
+        find_calls(op->right(), names);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            find_calls(*itr, names);
+        }
+    }
+}
+
+
+// Collect the variables read, and those read or assigned, by a tree and
+// the live functions it defines. Declaring a variable is not a use.
+static void find_uses(ParseTree *tree, const std::set<std::string> &live,
+                      std::set<std::string> &read, std::set<std::string> &used)
+{
+    if(not tree or dynamic_cast<VarDecl*>(tree)) {
+        return;
+    } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        if(live.count(fun->name())) {
+            find_uses(fun->body(), live, read, used);
+        }
+    } else if(dynamic_cast<Var*>(tree)) {
+        read.insert(tree->token().lexeme);
+        used.insert(tree->token().lexeme);
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        used.insert(assign->left()->token().lexeme);
+        find_uses(assign->right(), live, read, used);
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        find_uses(call->right(), live, read, used);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        find_uses(op->child(), live, read, used);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        find_uses(op->left(), live, read, used);
+        find_uses(op->right(), live, read, used);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            find_uses(*itr, live, read, used);
+        }
+    }
+}
+
+
+// the literal value of a condition, false if it is not a literal
+static bool literal_test(ParseTree *tree, bool &value)
+{
+    Number *num = dynamic_cast<Number*>(tree);
+    if(not num) {
+        return false;
+    }
+    Result val = num->value();
+    value = NUM_RESULT(val) != 0;
+    return true;
+}
+
+
+// The approximate memory held by a tree: its nodes, their token text and
+// their lists of children.
+static long long tree_bytes(ParseTree *tree)
+{
+    if(not tree) {
+        return 0;
+    }
+
+    long long bytes = tree->token().lexeme.capacity();
+    if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        bytes += sizeof(FunctionDef) + fun->name().capacity();
+        bytes += tree_bytes(fun->parameters()) + tree_bytes(fun->body());
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        bytes += sizeof(FunctionCall) + tree_bytes(call->left()) + tree_bytes(call->right());
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        bytes += dynamic_cast<Assign*>(tree) ? sizeof(Assign) : dynamic_cast<While*>(tree) ? sizeof(While) : sizeof(BinaryOp);
+        bytes += tree_bytes(op->left()) + tree_bytes(op->right());
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        bytes += dynamic_cast<VarDecl*>(tree) ? sizeof(VarDecl) : sizeof(UnaryOp);
+        bytes += tree_bytes(op->child());
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        bytes += sizeof(Program) + op->size() * sizeof(ParseTree*);
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            bytes += tree_bytes(*itr);
+        }
+    } else if(dynamic_cast<Var*>(tree)) {
+        bytes += sizeof(Var);
+    } else {
+        bytes += sizeof(Number);
+    }
+    return bytes;
+}
+
+
+//////////////////////////////////////////
+// DeadCodeEliminator Implementation
+//////////////////////////////////////////
+
+DeadCodeEliminator::DeadCodeEliminator()
+{
+    _functions = 0;
+    _stores = 0;
+    _decls = 0;
+    _branches = 0;
+    _bytes = 0;
+}
+
+
+// Removing a statement may leave others dead, the functions it called or
+// the variables it read, so the pass repeats until nothing changes.
+ParseTree *DeadCodeEliminator::run(ParseTree *tree)
+{
+    Program *program = dynamic_cast<Program*>(tree);
+    if(not program) {
+        return tree;
+    }
+
+    bool changed = true;
+    while(changed) {
+        find_live(program);
+        _read.clear();
+        _used.clear();
+        find_uses(program, _live, _read, _used);
+        changed = run_block(program, false);
+    }
+    return tree;
+}
+
+
+// the number of each kind of statement removed
+int DeadCodeEliminator::functions() const
+{
+    return _functions;
+}
+
+
+int DeadCodeEliminator::stores() const
+{
+    return _stores;
+}
+
+
+int DeadCodeEliminator::decls() const
+{
+    return _decls;
+}
+
+
+int DeadCodeEliminator::branches() const
+{
+    return _branches;
+}
+
+
+// the approximate size of the removed trees
+long long DeadCodeEliminator::bytes() const
+{
+    return _bytes;
+}
+
+
+ParseTree *DeadCodeEliminator::rewrite(ParseTree *tree)
+{
+    return tree;
+}
+
+
+// remove the dead statements of a block, and the blocks inside it
+bool DeadCodeEliminator::run_block(Program *block, bool value)
+{
+    bool changed = false;
+    for(int i=0; i<block->size(); i++) {
+        ParseTree *stmt = block->child(i);
+        bool last = value and i == block->size() - 1;
+        bool test = false;
+
+        // the blocks inside
+        if(FunctionDef *fun = dynamic_cast<FunctionDef*>(stmt)) {
+            if(_live.count(fun->name())) {
+                changed = run_block(fun->body(), true) or changed;
+                continue;
+            }
+        } else if(While *loop = dynamic_cast<While*>(stmt)) {
+            if(not literal_test(loop->left(), test) or test) {
+                changed = run_block((Program*) loop->right(), false) or changed;
+                continue;
+            }
+        } else if(Branch *branch = dynamic_cast<Branch*>(stmt)) {
+            if(not literal_test(branch->left(), test)) {
+                changed = run_block((Program*) branch->right(), false) or changed;
+                continue;
+            }
+        }
+        if(last) {
+            continue;
+        }
+
+        // the statements which go
+        if(dynamic_cast<FunctionDef*>(stmt)) {
+            _functions++;
+        } else if(dynamic_cast<While*>(stmt)) {
+            _branches++;
+        } else if(Branch *branch = dynamic_cast<Branch*>(stmt)) {
+            // a branch always taken is its body
+            _branches++;
+            if(test) {
+                Program *body = (Program*) branch->right();
+                for(int j=body->size()-1; j>=0; j--) {
+                    block->insert(i+1, body->remove(j));
+                }
+            }
+        } else if(Assign *assign = dynamic_cast<Assign*>(stmt)) {
+            if(_read.count(assign->left()->token().lexeme) or not is_pure(assign->right())) {
+                continue;
+            }
+            _stores++;
+        } else if(VarDecl *decl = dynamic_cast<VarDecl*>(stmt)) {
+            if(_used.count(decl->child()->token().lexeme)) {
+                continue;
+            }
+            _decls++;
+        } else {
+            continue;
+        }
+
+        discard(block->remove(i));
+        _count++;
+        changed = true;
+        i--;
+    }
+    return changed;
+}
+
+
+// the names of the functions reachable from the top level
+void DeadCodeEliminator::find_live(Program *program)
+{
+    std::map<std::string, std::vector<FunctionDef*> > defs;
+    find_defs(program, defs);
+
+    // Names may be reused in different scopes, so a call keeps every
+    // function with its name.
+    std::vector<std::string> work;
+    find_calls(program, work);
+    _live.clear();
+    while(not work.empty()) {
+        std::string name = work.back();
+        work.pop_back();
+        if(not _live.insert(name).second) {
+            continue;
+        }
+        std::vector<FunctionDef*> &funs = defs[name];
+        for(auto itr = funs.begin(); itr != funs.end(); itr++) {
+            find_calls((*itr)->body(), work);
+        }
+    }
+}
+
+
+// delete a removed statement, counting its size
+void DeadCodeEliminator::discard(ParseTree *tree)
+{
+    _bytes += tree_bytes(tree);
+
+    // a function does not own its body, which tiered execution replaces
+    if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        delete fun->parameters();
+        delete fun->body();
+    }
+    delete tree;
+}
@@ -0,0 +1,55 @@
+// A microbenchmark for the register VM's instruction dispatch. The loop
+// is made of cheap instructions so that the time is mostly dispatch.
+// Build it with and without NO_THREADED_CODE to compare the two.
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include "regcode.h"
+#include "regvm.h"
+
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 20000000;
+
+    // assemble the loop by hand
+    RegisterCode rc;
+    rc.reals.push_back(0.0);
+    rc.reals.push_back(0.5);
+    int setup[] = {
+        RG_LOADK_I, 0, 0,           // i = 0
+        RG_LOADK_I, 1, n,           // n
+        RG_LOADK_I, 2, 1,           // one
+        RG_LOADK_I, 3, 0,           // a = 0
+        RG_LOADK_R, 4, 0,           // x = 0.0
+        RG_LOADK_R, 5, 1            // step = 0.5
+    };
+    int loop[] = {
+        RG_ADD_I, 3, 3, 0,          // a = a + i
+        RG_SUB_I, 3, 3, 2,          // a = a - one
+        RG_ADD_R, 4, 4, 5,          // x = x + step
+        RG_MUL_R, 6, 4, 5,          // t = x * step
+        RG_MOVE, 7, 3,              // u = a
+        RG_ADD_I, 0, 0, 2,          // i = i + one
+        RG_JNE_I, 0, 1, -1          // loop while i != n
+    };
+    rc.code.assign(setup, setup + sizeof(setup)/sizeof(int));
+    int top = rc.code.size();
+    rc.code.insert(rc.code.end(), loop, loop + sizeof(loop)/sizeof(int));
+    rc.code.back() = top;
+    rc.code.push_back(RG_HALT);
+    rc.functions.push_back(RegisterFunction{"<main>", 0, 0, 8, 8});
+
+    // time the run
+    RegisterVM vm;
+    auto start = std::chrono::steady_clock::now();
+    vm.run(rc);
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::cout << "dispatch: " << RegisterVM::dispatch() << std::endl;
+    std::cout << "instructions: " << vm.count() << std::endl;
+    std::cout << "seconds: " << seconds << std::endl;
+    std::cout << "ns per instruction: " << seconds * 1e9 / vm.count() << std::endl;
+
+    return 0;
+}
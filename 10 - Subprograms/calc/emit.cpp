@@ -0,0 +1,602 @@
+#include <sstream>
+#include <iomanip>
+#include <climits>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "emit.h"
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Runtime Support
+//////////////////////////////////////////
+
+// The start of every emitted program. Integer arithmetic wraps like the
+// interpreter's, and its errors end the program with the same messages.
+static const char *PRELUDE =
+    "#include <iostream>\n"
+    "#include <functional>\n"
+    "#include <stdexcept>\n"
+    "#include <climits>\n"
+    "#include <cmath>\n"
+    "\n"
+    "static inline int calc_add(int l, int r) { return (int) ((unsigned) l + (unsigned) r); }\n"
+    "static inline int calc_sub(int l, int r) { return (int) ((unsigned) l - (unsigned) r); }\n"
+    "static inline int calc_mul(int l, int r) { return (int) ((unsigned) l * (unsigned) r); }\n"
+    "static inline int calc_neg(int x) { return (int) (0u - (unsigned) x); }\n"
+    "\n"
+    "static inline int calc_div(int l, int r)\n"
+    "{\n"
+    "    if(r == 0) throw std::runtime_error(\"Integer division by zero.\");\n"
+    "    if(r == -1) return calc_neg(l);\n"
+    "    return l / r;\n"
+    "}\n"
+    "\n"
+    "static int calc_pow(int base, int exp)\n"
+    "{\n"
+    "    if(exp < 0) {\n"
+    "        if(base == 0) throw std::runtime_error(\"Integer overflow.\");\n"
+    "        return base == 1 ? 1 : base == -1 ? (exp % 2 ? -1 : 1) : 0;\n"
+    "    }\n"
+    "    long long r = 1;\n"
+    "    long long b = base;\n"
+    "    while(exp) {\n"
+    "        if(exp & 1) {\n"
+    "            r *= b;\n"
+    "            if(r > INT_MAX or r < INT_MIN) throw std::runtime_error(\"Integer overflow.\");\n"
+    "        }\n"
+    "        exp >>= 1;\n"
+    "        if(exp) {\n"
+    "            b *= b;\n"
+    "            if(b > INT_MAX) throw std::runtime_error(\"Integer overflow.\");\n"
+    "        }\n"
+    "    }\n"
+    "    return r;\n"
+    "}\n"
+    "\n"
+    "static inline double calc_square(double x) { return x * x; }\n"
+    "static inline double calc_sqrt(double x) { return x > 0 ? sqrt(x) : pow(x, 0.5); }\n"
+    "\n";
+
+
+//////////////////////////////////////////
+// CppEmitter Implementation
+//////////////////////////////////////////
+
+// write a program as a C++ translation unit
+void CppEmitter::emit(ParseTree *program, std::ostream &os)
+{
+    _os = &os;
+    _indent = 0;
+    _temps = 0;
+    _scopes.clear();
+
+    // the functions of each scope are known before any call is emitted
+    std::vector<ParseTree*> globals;
+    find_decls(program, globals);
+    scope(globals);
+    std::vector<FunctionDef*> top;
+
+    os << "// generated by calc --emit-cpp" << std::endl;
+    os << PRELUDE;
+
+    // globals, then the top level functions, declared first so that any
+    // may call any other
+    for(auto itr = globals.begin(); itr != globals.end(); itr++) {
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*itr)) {
+            line() << "static " << type_name(decl->child()->type()) << " "
+                   << var_name(decl->child()->token().lexeme) << " = 0;" << std::endl;
+        } else {
+            top.push_back((FunctionDef*) *itr);
+        }
+    }
+    os << std::endl;
+    for(auto itr = top.begin(); itr != top.end(); itr++) {
+        line() << "static " << signature(*itr) << ";" << std::endl;
+    }
+    for(auto itr = top.begin(); itr != top.end(); itr++) {
+        os << std::endl << std::endl;
+        function(*itr);
+    }
+
+    // the top level statements
+    os << std::endl << std::endl;
+    line() << "static void calc_program()" << std::endl;
+    line() << "{" << std::endl;
+    _indent++;
+    block((Program*) program, nullptr, false);
+    _indent--;
+    line() << "}" << std::endl;
+
+    os << std::endl << std::endl;
+    line() << "extern \"C\" int calc_main()" << std::endl;
+    line() << "{" << std::endl;
+    line() << "    try {" << std::endl;
+    line() << "        calc_program();" << std::endl;
+    line() << "    } catch(std::runtime_error &e) {" << std::endl;
+    line() << "        std::cerr << e.what() << std::endl;" << std::endl;
+    line() << "        return 1;" << std::endl;
+    line() << "    }" << std::endl;
+    line() << "    return 0;" << std::endl;
+    line() << "}" << std::endl;
+    os << std::endl << std::endl;
+    line() << "#ifndef CALC_NO_MAIN" << std::endl;
+    line() << "int main()" << std::endl;
+    line() << "{" << std::endl;
+    line() << "    return calc_main();" << std::endl;
+    line() << "}" << std::endl;
+    line() << "#endif" << std::endl;
+    _scopes.pop_back();
+}
+
+
+// Calls are the only scopes, so a scope's declarations may be nested in
+// any of its loops and branches.
+void CppEmitter::find_decls(ParseTree *tree, std::vector<ParseTree*> &decls)
+{
+    if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        decls.push_back(tree);
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        find_decls(loop->right(), decls);
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        find_decls(branch->right(), decls);
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            find_decls(*itr, decls);
+        }
+    }
+}
+
+
+// a top level function
+void CppEmitter::function(FunctionDef *fun)
+{
+    line() << "static " << signature(fun) << std::endl;
+    line() << "{" << std::endl;
+    _indent++;
+    body(fun);
+    _indent--;
+    line() << "}" << std::endl;
+}
+
+
+// A nested function can see the variables of the calls it is nested in,
+// so it shares their frames by reference.
+void CppEmitter::lambda(FunctionDef *fun)
+{
+    ArgList *params = fun->parameters();
+    line() << fun_name(fun->name()) << " = [&](";
+    for(int i=0; i<params->size(); i++) {
+        VarDecl *param = (VarDecl*) params->child(i);
+        *_os << (i ? ", " : "") << type_name(param->child()->type()) << " "
+             << var_name(param->child()->token().lexeme);
+    }
+    *_os << ") -> " << type_name(fun->return_type()) << std::endl;
+    line() << "{" << std::endl;
+    _indent++;
+    body(fun);
+    _indent--;
+    line() << "};" << std::endl;
+}
+
+
+void CppEmitter::body(FunctionDef *fun)
+{
+    std::vector<ParseTree*> decls;
+    find_decls(fun->body(), decls);
+    scope(decls);
+    locals(decls);
+
+    // tail calls start the body again
+    bool tail = false;
+    std::vector<ParseTree*> pending(1, fun->body());
+    while(not pending.empty() and not tail) {
+        ParseTree *tree = pending.back();
+        pending.pop_back();
+        if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+            tail = call->tail();
+        } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+            pending.push_back(op->left());
+            pending.push_back(op->right());
+        } else if(Program *block = dynamic_cast<Program*>(tree)) {
+            pending.insert(pending.end(), block->begin(), block->end());
+        }
+    }
+    if(tail) {
+        _indent--;
+        line() << "restart:" << std::endl;
+        _indent++;
+    }
+
+    block(fun->body(), fun, fun->return_type() != VOID);
+
+    // a body which ends in a statement has no value to return
+    Program *stmts = fun->body();
+    ParseTree *last = stmts->size() ? stmts->child(stmts->size() - 1) : nullptr;
+    if(fun->return_type() != VOID and (not last or dynamic_cast<VarDecl*>(last)
+       or dynamic_cast<FunctionDef*>(last) or dynamic_cast<Assign*>(last)
+       or dynamic_cast<Print*>(last) or dynamic_cast<While*>(last)
+       or dynamic_cast<Branch*>(last))) {
+        line() << "return 0;" << std::endl;
+    }
+    _scopes.pop_back();
+}
+
+
+// enter a scope, whose functions calls find before those outside it
+void CppEmitter::scope(const std::vector<ParseTree*> &decls)
+{
+    _scopes.push_back(std::map<std::string, FunctionDef*>());
+    for(auto itr = decls.begin(); itr != decls.end(); itr++) {
+        if(FunctionDef *fun = dynamic_cast<FunctionDef*>(*itr)) {
+            _scopes.back()[fun->name()] = fun;
+        }
+    }
+}
+
+
+// A scope's variables start at zero. Nested functions are bound where
+// their definitions run.
+void CppEmitter::locals(const std::vector<ParseTree*> &decls)
+{
+    for(auto itr = decls.begin(); itr != decls.end(); itr++) {
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*itr)) {
+            line() << type_name(decl->child()->type()) << " "
+                   << var_name(decl->child()->token().lexeme) << " = 0;" << std::endl;
+        } else {
+            FunctionDef *fun = (FunctionDef*) *itr;
+            ArgList *params = fun->parameters();
+            line() << "std::function<" << type_name(fun->return_type()) << "(";
+            for(int i=0; i<params->size(); i++) {
+                *_os << (i ? ", " : "") << type_name(((VarDecl*) params->child(i))->child()->type());
+            }
+            *_os << ")> " << fun_name(fun->name()) << ";" << std::endl;
+        }
+    }
+}
+
+
+// statements, the last statement of a function body returns its value
+void CppEmitter::block(Program *block, FunctionDef *fun, bool returns)
+{
+    int n = block->size();
+    for(int i=0; i<n; i++) {
+        stmt(block->child(i), fun, returns and i == n-1);
+    }
+}
+
+
+void CppEmitter::stmt(ParseTree *tree, FunctionDef *fun, bool last)
+{
+    FunctionCall *tail = dynamic_cast<FunctionCall*>(tree);
+    if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        tail = dynamic_cast<FunctionCall*>(assign->right());
+    }
+    if(tail and tail->tail() and fun) {
+        tail_call(tail, fun);
+    } else if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        line() << var_name(decl->child()->token().lexeme) << " = 0;" << std::endl;
+    } else if(FunctionDef *nested = dynamic_cast<FunctionDef*>(tree)) {
+        // top level functions are defined on their own
+        if(fun) lambda(nested);
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        std::string value = expr_as(assign->right(), assign->left()->type());
+        line() << var_name(assign->left()->token().lexeme) << " = " << value << ";" << std::endl;
+    } else if(Print *print = dynamic_cast<Print*>(tree)) {
+        std::string value = expr(print->child());
+        line() << "std::cout << " << value << " << std::endl;" << std::endl;
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        // a condition with calls computes its temporaries every time around
+        if(has_call(loop->left())) {
+            line() << "while(true) {" << std::endl;
+            _indent++;
+            std::string test = condition(loop->left());
+            line() << "if(not " << test << ") break;" << std::endl;
+        } else {
+            line() << "while(" << condition(loop->left()) << ") {" << std::endl;
+            _indent++;
+        }
+        block((Program*) loop->right(), fun, false);
+        _indent--;
+        line() << "}" << std::endl;
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        std::string test = condition(branch->left());
+        line() << "if(" << test << ") {" << std::endl;
+        _indent++;
+        block((Program*) branch->right(), fun, false);
+        _indent--;
+        line() << "}" << std::endl;
+    } else if(last) {
+        std::string value = expr_as(tree, fun->return_type());
+        line() << "return " << value << ";" << std::endl;
+    } else {
+        std::string value = expr(tree);
+        line() << value << ";" << std::endl;
+    }
+}
+
+
+// bind the arguments to the parameters, all at once, and start again
+void CppEmitter::tail_call(FunctionCall *call, FunctionDef *fun)
+{
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = fun->parameters();
+    line() << "{" << std::endl;
+    _indent++;
+    for(int i=0; i<args->size(); i++) {
+        ResultType type = ((VarDecl*) params->child(i))->child()->type();
+        std::string value = expr_as(args->child(i), type);
+        line() << type_name(type) << " arg" << i << " = " << value << ";" << std::endl;
+    }
+    for(int i=0; i<args->size(); i++) {
+        line() << var_name(((VarDecl*) params->child(i))->child()->token().lexeme)
+               << " = arg" << i << ";" << std::endl;
+    }
+    line() << "goto restart;" << std::endl;
+    _indent--;
+    line() << "}" << std::endl;
+}
+
+
+// Expressions, as C++ expressions of the tree's type. C++ leaves the
+// order of operands and arguments unspecified, so where a call could
+// change what another operand reads, the operands before it are
+// computed into temporaries first.
+std::string CppEmitter::expr(ParseTree *tree)
+{
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        return literal(num);
+    } else if(dynamic_cast<Var*>(tree)) {
+        return var_name(tree->token().lexeme);
+    } else if(FunctionCall *fcall = dynamic_cast<FunctionCall*>(tree)) {
+        return call(fcall);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        if(tree->type() == INTEGER) {
+            return "calc_neg(" + expr(neg->child()) + ")";
+        }
+        return "(-" + expr(neg->child()) + ")";
+    }
+
+    BinaryOp *op = dynamic_cast<BinaryOp*>(tree);
+    if(not op) {
+        throw std::runtime_error("Cannot emit " + tree->token().lexeme);
+    }
+
+    // comparisons are numeric, whatever the operand types
+    if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        return "(int) " + condition(tree);
+    }
+
+    // Integers use the wrapping helpers. A real operation has at least
+    // one real operand, which C++ widens the other to.
+    bool integer = tree->type() == INTEGER;
+    std::string l = operand(op, op->left());
+    std::string r = expr(op->right());
+    if(dynamic_cast<Add*>(tree)) {
+        return integer ? "calc_add(" + l + ", " + r + ")" : "(" + l + " + " + r + ")";
+    } else if(dynamic_cast<Sub*>(tree)) {
+        return integer ? "calc_sub(" + l + ", " + r + ")" : "(" + l + " - " + r + ")";
+    } else if(dynamic_cast<Mul*>(tree)) {
+        return integer ? "calc_mul(" + l + ", " + r + ")" : "(" + l + " * " + r + ")";
+    } else if(dynamic_cast<Div*>(tree)) {
+        return integer ? "calc_div(" + l + ", " + r + ")" : "(" + l + " / " + r + ")";
+    }
+
+    // powers with the literal exponents the Specializer reduces
+    Number *exp = dynamic_cast<Number*>(op->right());
+    double e = exp ? NUM_RESULT(exp->value()) : 0;
+    if(integer and exp and (e == 2 or e == 3)) {
+        return "calc_pow(" + l + ", " + (e == 2 ? "2" : "3") + ")";
+    } else if(integer) {
+        return "calc_pow(" + l + ", " + r + ")";
+    } else if(exp and e == 2) {
+        return "calc_square(" + l + ")";
+    } else if(exp and e == 0.5) {
+        return "calc_sqrt(" + l + ")";
+    }
+    return "pow(" + l + ", " + r + ")";
+}
+
+
+// an expression converted to a type, as assignment converts it
+std::string CppEmitter::expr_as(ParseTree *tree, ResultType type)
+{
+    if(tree->type() == type) {
+        return expr(tree);
+    }
+    return "(" + type_name(type) + ") " + expr(tree);
+}
+
+
+// a test which is true when the value is not zero
+std::string CppEmitter::condition(ParseTree *tree)
+{
+    if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        BinaryOp *op = (BinaryOp*) tree;
+        const char *cmp = dynamic_cast<Equal*>(tree) ? " == " : " != ";
+        std::string l = operand(op, op->left());
+        return "(" + l + cmp + expr(op->right()) + ")";
+    }
+    return "(" + expr(tree) + " != 0)";
+}
+
+
+// Reals are written with every digit, so they read back exactly
+std::string CppEmitter::literal(Number *num)
+{
+    Result val = num->value();
+    std::ostringstream os;
+    if(val.type() == INTEGER) {
+        if(val.i() == INT_MIN) {
+            return "INT_MIN";
+        }
+        os << val.i();
+        return val.i() < 0 ? "(" + os.str() + ")" : os.str();
+    }
+
+    double r = val.r();
+    if(std::isnan(r)) {
+        return "NAN";
+    } else if(std::isinf(r)) {
+        return r > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+    }
+    os << std::setprecision(17) << r;
+    std::string text = os.str();
+    if(text.find_first_of(".e") == std::string::npos) {
+        text += ".0";
+    }
+    return r < 0 ? "(" + text + ")" : text;
+}
+
+
+// The left operand of a binary operation, in a temporary if a call on
+// the right could change what it reads, or a call in it could change
+// what the right reads.
+std::string CppEmitter::operand(BinaryOp *op, ParseTree *left)
+{
+    std::string result = expr(left);
+    bool before = has_call(op->right()) and not dynamic_cast<Number*>(left);
+    bool after = has_call(left) and not dynamic_cast<Number*>(op->right());
+    if(before or after) {
+        result = temp(result, left->type());
+    }
+    return result;
+}
+
+
+// Arguments are converted to the parameter types. When any argument
+// makes a call, each but the last goes in a temporary.
+std::string CppEmitter::call(FunctionCall *call)
+{
+    std::string name = call->left()->token().lexeme;
+    FunctionDef *fun = resolve(name);
+    if(not fun) {
+        throw std::runtime_error(name + " not defined.");
+    }
+
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = fun->parameters();
+    bool calls = has_call(args);
+    std::string result = fun_name(name) + "(";
+    for(int i=0; i<args->size(); i++) {
+        ResultType type = ((VarDecl*) params->child(i))->child()->type();
+        std::string arg = expr_as(args->child(i), type);
+        if(calls and i < args->size() - 1 and not dynamic_cast<Number*>(args->child(i))) {
+            arg = temp(arg, type);
+        }
+        result += (i ? ", " : "") + arg;
+    }
+    return result + ")";
+}
+
+
+// compute a value into a new temporary now, returning its name
+std::string CppEmitter::temp(const std::string &value, ResultType type)
+{
+    std::ostringstream name;
+    name << "s_" << _temps++;
+    line() << type_name(type) << " " << name.str() << " = " << value << ";" << std::endl;
+    return name.str();
+}
+
+
+// the function a call refers to, from the innermost scope out
+FunctionDef *CppEmitter::resolve(const std::string &name)
+{
+    for(auto scope = _scopes.rbegin(); scope != _scopes.rend(); scope++) {
+        auto itr = scope->find(name);
+        if(itr != scope->end()) return itr->second;
+    }
+    return nullptr;
+}
+
+
+// C++ spellings
+std::string CppEmitter::type_name(ResultType type)
+{
+    switch(type) {
+        case INTEGER:
+            return "int";
+        case REAL:
+            return "double";
+        default:
+            return "void";
+    }
+}
+
+
+std::string CppEmitter::signature(FunctionDef *fun)
+{
+    ArgList *params = fun->parameters();
+    std::string result = type_name(fun->return_type()) + " " + fun_name(fun->name()) + "(";
+    for(int i=0; i<params->size(); i++) {
+        VarDecl *param = (VarDecl*) params->child(i);
+        result += (i ? ", " : "") + type_name(param->child()->type()) + " "
+                + var_name(param->child()->token().lexeme);
+    }
+    return result + ")";
+}
+
+
+// Calc names are prefixed, so they cannot clash with C++. The passes'
+// temporaries, which start with $, get their own prefix.
+std::string CppEmitter::var_name(const std::string &name)
+{
+    if(name[0] == '$') {
+        return "t_" + name.substr(1);
+    }
+    return "v_" + name;
+}
+
+
+std::string CppEmitter::fun_name(const std::string &name)
+{
+    return "f_" + name;
+}
+
+
+// start a line at the current indentation
+std::ostream &CppEmitter::line()
+{
+    for(int i=0; i<_indent; i++) {
+        *_os << "    ";
+    }
+    return *_os;
+}
+
+
+//////////////////////////////////////////
+// Native Builds
+//////////////////////////////////////////
+
+// Build emitted source with g++, into a shared object when the output
+// ends in .so and an executable otherwise. The compiler is run directly
+// rather than through the shell, so paths need no quoting.
+int build_cpp(const std::string &source, const std::string &output)
+{
+    bool shared = output.size() > 3 and output.compare(output.size() - 3, 3, ".so") == 0;
+    std::vector<std::string> args = { "g++", "-O2" };
+    if(shared) {
+        args.insert(args.end(), { "-shared", "-fPIC", "-DCALC_NO_MAIN" });
+    }
+    args.insert(args.end(), { "-o", output, source });
+
+    std::vector<char*> argv;
+    for(auto itr = args.begin(); itr != args.end(); itr++) {
+        argv.push_back((char*) itr->c_str());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        return -1;
+    } else if(pid == 0) {
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status;
+    if(waitpid(pid, &status, 0) < 0 or not WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
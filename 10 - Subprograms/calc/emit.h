@@ -0,0 +1,73 @@
+// This file contains the ahead of time compiler which translates type
+// checked calc programs into standalone C++. Globals and functions
+// declared at the top level become static variables and functions, and
+// functions nested in others become lambdas which share their frame.
+// Every operation keeps the interpreter's semantics, so the compiled
+// program prints exactly what the interpreter would.
+#ifndef EMIT_H
+#define EMIT_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "op.h"
+
+
+class CppEmitter
+{
+public:
+    // write a program as a C++ translation unit
+    virtual void emit(ParseTree *program, std::ostream &os);
+
+protected:
+    // the declarations which belong to a scope, outside nested functions
+    virtual void find_decls(ParseTree *tree, std::vector<ParseTree*> &decls);
+
+    // definitions
+    virtual void function(FunctionDef *fun);
+    virtual void lambda(FunctionDef *fun);
+    virtual void body(FunctionDef *fun);
+    virtual void locals(const std::vector<ParseTree*> &decls);
+    virtual void scope(const std::vector<ParseTree*> &decls);
+
+    // statements, the last statement of a function body returns its value
+    virtual void block(Program *block, FunctionDef *fun, bool returns);
+    virtual void stmt(ParseTree *tree, FunctionDef *fun, bool last);
+    virtual void tail_call(FunctionCall *call, FunctionDef *fun);
+
+    // Expressions, as C++ expressions of the tree's type. Operands which
+    // must be evaluated before a call go in temporaries.
+    virtual std::string expr(ParseTree *tree);
+    virtual std::string expr_as(ParseTree *tree, ResultType type);
+    virtual std::string condition(ParseTree *tree);
+    virtual std::string literal(Number *num);
+    virtual std::string operand(BinaryOp *op, ParseTree *left);
+    virtual std::string call(FunctionCall *call);
+    virtual std::string temp(const std::string &value, ResultType type);
+
+    // the function a call refers to, nullptr if there is none
+    virtual FunctionDef *resolve(const std::string &name);
+
+    // C++ spellings
+    virtual std::string type_name(ResultType type);
+    virtual std::string signature(FunctionDef *fun);
+    virtual std::string var_name(const std::string &name);
+    virtual std::string fun_name(const std::string &name);
+
+    // start a line at the current indentation
+    virtual std::ostream &line();
+
+private:
+    std::ostream *_os;
+    int _indent;
+    int _temps;
+
+    // the functions of each enclosing scope, by name
+    std::vector<std::map<std::string, FunctionDef*> > _scopes;
+};
+
+
+// build emitted source with g++, into a shared object when the output
+// ends in .so and an executable otherwise. Returns the compiler's status.
+int build_cpp(const std::string &source, const std::string &output);
+#endif
@@ -0,0 +1,176 @@
+// Superinstruction selection for calc parse trees.
+#include <typeinfo>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// true if the tree is a read of the named variable
+static bool is_var(ParseTree *tree, const std::string &name)
+{
+    return dynamic_cast<Var*>(tree) and tree->token().lexeme == name;
+}
+
+
+// true if the tree is a variable or a numeric literal
+static bool is_simple(ParseTree *tree)
+{
+    if(not dynamic_cast<Var*>(tree) and not dynamic_cast<Number*>(tree)) {
+        return false;
+    }
+    return tree->type() == INTEGER or tree->type() == REAL;
+}
+
+
+// move the children of a binary node to its fused replacement
+static ParseTree *replace(BinaryOp *old, BinaryOp *result)
+{
+    result->left(old->left());
+    result->right(old->right());
+    result->type(old->type());
+
+    old->left(nullptr);
+    old->right(nullptr);
+    delete old;
+
+    return result;
+}
+
+
+// create the compound assignment for the variable and operand types
+template <class Fn>
+static CompoundAssign *make_compound(LexerToken tok, const std::string &name,
+                                     ParseTree *operand, ResultType vt)
+{
+    if(vt == INTEGER) {
+        return new TypedCompoundAssign<Fn, INTEGER, INTEGER>(tok, name, operand);
+    } else if(operand->type() == INTEGER) {
+        return new TypedCompoundAssign<Fn, REAL, INTEGER>(tok, name, operand);
+    } else {
+        return new TypedCompoundAssign<Fn, REAL, REAL>(tok, name, operand);
+    }
+}
+
+
+//////////////////////////////////////////
+// Superinstructions Implementation
+//////////////////////////////////////////
+
+Superinstructions::Superinstructions()
+{
+    _increments = 0;
+    _compounds = 0;
+    _compare_loops = 0;
+}
+
+
+// the number of each kind of node created
+int Superinstructions::increments() const
+{
+    return _increments;
+}
+
+
+int Superinstructions::compounds() const
+{
+    return _compounds;
+}
+
+
+int Superinstructions::compare_loops() const
+{
+    return _compare_loops;
+}
+
+
+ParseTree *Superinstructions::rewrite(ParseTree *tree)
+{
+    ParseTree *result = nullptr;
+
+    // Fused nodes are subclasses of the nodes they replace, so the exact
+    // type is checked to leave them alone.
+    if(typeid(*tree) == typeid(Assign)) {
+        result = fuse_increment((Assign*) tree);
+        if(not result) result = fuse_compound((Assign*) tree);
+    } else if(typeid(*tree) == typeid(While)) {
+        result = fuse_loop((While*) tree);
+    }
+
+    if(not result) return tree;
+    _count++;
+    return result;
+}
+
+
+// v = v + k, v = k + v or v = v - k
+ParseTree *Superinstructions::fuse_increment(Assign *assign)
+{
+    std::string name = assign->left()->token().lexeme;
+    BinaryOp *op = dynamic_cast<BinaryOp*>(assign->right());
+    if(assign->left()->type() != INTEGER or not op) return nullptr;
+
+    ParseTree *step;
+    int sign = 1;
+    if(dynamic_cast<Add*>(op) and is_var(op->left(), name)) {
+        step = op->right();
+    } else if(dynamic_cast<Add*>(op) and is_var(op->right(), name)) {
+        step = op->left();
+    } else if(dynamic_cast<Sub*>(op) and is_var(op->left(), name)) {
+        step = op->right();
+        sign = -1;
+    } else {
+        return nullptr;
+    }
+
+    Number *num = dynamic_cast<Number*>(step);
+    if(not num or num->type() != INTEGER) return nullptr;
+
+    _increments++;
+    return replace(assign, new Increment(assign->token(), name, sign * num->value().i()));
+}
+
+
+// x = x op y
+ParseTree *Superinstructions::fuse_compound(Assign *assign)
+{
+    std::string name = assign->left()->token().lexeme;
+    ResultType vt = assign->left()->type();
+    BinaryOp *op = dynamic_cast<BinaryOp*>(assign->right());
+    if((vt != INTEGER and vt != REAL) or not op) return nullptr;
+    if(not is_var(op->left(), name) or not is_simple(op->right())) return nullptr;
+
+    // an integer variable would truncate a real result
+    ParseTree *operand = op->right();
+    if(vt == INTEGER and operand->type() != INTEGER) return nullptr;
+
+    LexerToken tok = assign->token();
+    CompoundAssign *result;
+    if(dynamic_cast<Add*>(op)) {
+        result = make_compound<AddFn>(tok, name, operand, vt);
+    } else if(dynamic_cast<Sub*>(op)) {
+        result = make_compound<SubFn>(tok, name, operand, vt);
+    } else if(dynamic_cast<Mul*>(op)) {
+        result = make_compound<MulFn>(tok, name, operand, vt);
+    } else if(dynamic_cast<Div*>(op)) {
+        result = make_compound<DivFn>(tok, name, operand, vt);
+    } else {
+        return nullptr;
+    }
+
+    _compounds++;
+    return replace(assign, result);
+}
+
+
+// while a = b or while a != b
+ParseTree *Superinstructions::fuse_loop(While *loop)
+{
+    BinaryOp *cond = dynamic_cast<BinaryOp*>(loop->left());
+    bool equal = dynamic_cast<Equal*>(cond) != nullptr;
+    if(not equal and not dynamic_cast<NotEqual*>(cond)) return nullptr;
+    if(not is_simple(cond->left()) or not is_simple(cond->right())) return nullptr;
+
+    _compare_loops++;
+    return replace(loop, new CompareLoop(loop->token(), equal, cond->left(), cond->right()));
+}
@@ -0,0 +1,382 @@
+// Function inlining for calc parse trees.
+#include <sstream>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// the number of nodes in a tree
+static int tree_size(ParseTree *tree)
+{
+    if(not tree) {
+        return 0;
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        return 1 + tree_size(op->child());
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        return 1 + tree_size(op->left()) + tree_size(op->right());
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        int size = 1;
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            size += tree_size(*itr);
+        }
+        return size;
+    }
+    return 1;
+}
+
+
+// true if the tree contains a declaration or a print
+static bool has_decl_or_print(ParseTree *tree)
+{
+    if(not tree) {
+        return false;
+    } else if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<Print*>(tree)
+              or dynamic_cast<FunctionDef*>(tree)) {
+        return true;
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        return has_decl_or_print(op->child());
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        return has_decl_or_print(op->left()) or has_decl_or_print(op->right());
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            if(has_decl_or_print(*itr)) return true;
+        }
+    }
+    return false;
+}
+
+
+// true if the statement leaves its value as the value of a block
+static bool is_expression(ParseTree *tree)
+{
+    return not dynamic_cast<Assign*>(tree) and not dynamic_cast<VarDecl*>(tree)
+       and not dynamic_cast<While*>(tree) and not dynamic_cast<Branch*>(tree)
+       and not dynamic_cast<Print*>(tree) and not dynamic_cast<FunctionDef*>(tree)
+       and (tree->type() == INTEGER or tree->type() == REAL);
+}
+
+
+// true if a local of a body is assigned before anything could read it
+static bool written_first(Program *body, const std::string &name)
+{
+    for(auto itr = body->begin(); itr != body->end(); itr++) {
+        std::set<std::string> reads;
+        vars_read(*itr, reads);
+        if(reads.count(name)) {
+            return false;
+        }
+
+        // an unconditional assignment starts the variable again
+        Assign *assign = dynamic_cast<Assign*>(*itr);
+        if(assign and assign->left()->token().lexeme == name) {
+            return true;
+        }
+    }
+    return true;
+}
+
+
+// collect the calls in an expression, in the order they are evaluated
+static void find_calls(ParseTree *parent, ParseTree *tree,
+                       std::vector<std::pair<ParseTree*, FunctionCall*> > &calls)
+{
+    if(not tree) {
+        return;
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        find_calls(call, call->right(), calls);
+        calls.push_back(std::make_pair(parent, call));
+    } else if(Assign *op = dynamic_cast<Assign*>(tree)) {
+        find_calls(op, op->right(), calls);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        find_calls(op, op->child(), calls);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        find_calls(op, op->left(), calls);
+        find_calls(op, op->right(), calls);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            find_calls(op, *itr, calls);
+        }
+    }
+}
+
+
+// replace the variables of an inlined body with copies of their new trees
+static void rename(ParseTree *parent, ParseTree *tree, const std::map<std::string, ParseTree*> &names)
+{
+    if(not tree) {
+        return;
+    } else if(dynamic_cast<Var*>(tree)) {
+        auto itr = names.find(tree->token().lexeme);
+        if(itr != names.end()) {
+            replace_child(parent, tree, clone_tree(itr->second));
+            delete tree;
+        }
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        rename(op, op->child(), names);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        rename(op, op->left(), names);
+        rename(op, op->right(), names);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(int i=0; i<op->size(); i++) {
+            rename(op, op->child(i), names);
+        }
+    }
+}
+
+
+//////////////////////////////////////////
+// Inliner Implementation
+//////////////////////////////////////////
+
+// callees larger than max_size nodes are left alone
+Inliner::Inliner(int max_size)
+{
+    _max_size = max_size;
+}
+
+
+ParseTree *Inliner::run(ParseTree *tree)
+{
+    if(Program *program = dynamic_cast<Program*>(tree)) {
+        _scopes.push_back(std::map<std::string, FunctionDef*>());
+        run_block(program, program);
+        _scopes.pop_back();
+    }
+    return tree;
+}
+
+
+ParseTree *Inliner::rewrite(ParseTree *tree)
+{
+    // the pass works on whole blocks in run_block
+    return tree;
+}
+
+
+// the inlined call sites, as "name (line n)"
+const std::vector<std::string> &Inliner::report() const
+{
+    return _report;
+}
+
+
+// inline the calls in a block, declaring temporaries in scope
+void Inliner::run_block(Program *block, Program *scope)
+{
+    std::vector<VarDecl*> outer;
+    if(block == scope) {
+        outer.swap(_decls);
+    }
+
+    for(int i=0; i<block->size(); i++) {
+        ParseTree *stmt = block->child(i);
+
+        if(FunctionDef *fun = dynamic_cast<FunctionDef*>(stmt)) {
+            // only unconditional definitions are known to exist later
+            if(block == scope) {
+                _scopes.back()[fun->name()] = fun;
+            }
+            _scopes.push_back(std::map<std::string, FunctionDef*>());
+            run_block(fun->body(), fun->body());
+            _scopes.pop_back();
+        } else if(While *loop = dynamic_cast<While*>(stmt)) {
+            // the condition runs every time around, so it stays as it is
+            run_block((Program*) loop->right(), scope);
+        } else if(Branch *branch = dynamic_cast<Branch*>(stmt)) {
+            i += inline_stmt(block, i, branch, branch->left());
+            run_block((Program*) branch->right(), scope);
+        } else {
+            i += inline_stmt(block, i, block, stmt);
+        }
+    }
+
+    // declare the temporaries at the top of the scope
+    if(block == scope) {
+        for(auto itr = _decls.begin(); itr != _decls.end(); itr++) {
+            scope->insert(0, *itr);
+        }
+        _decls.swap(outer);
+    }
+}
+
+
+// inline the calls of one statement, returning the statements added
+int Inliner::inline_stmt(Program *block, int i, ParseTree *parent, ParseTree *expr)
+{
+    std::vector<std::pair<ParseTree*, FunctionCall*> > calls;
+    find_calls(parent, expr, calls);
+    if(calls.empty()) return 0;
+
+    // Moving a call ahead of another call could change what either sees,
+    // so either every call in the statement is inlined or none are.
+    std::vector<FunctionDef*> callees;
+    for(auto itr = calls.begin(); itr != calls.end(); itr++) {
+        FunctionDef *fun = resolve(itr->second->left()->token().lexeme);
+        if(not fun or not can_inline(fun)) return 0;
+
+        // a void function can only be called as a statement
+        if(fun->return_type() == VOID and itr->second != block->child(i)) return 0;
+        callees.push_back(fun);
+    }
+
+    std::vector<ParseTree*> added;
+    bool remove = false;
+    for(int c=0; c<(int) calls.size(); c++) {
+        ParseTree *parent = calls[c].first;
+        FunctionCall *call = calls[c].second;
+        FunctionDef *fun = callees[c];
+        LexerToken tok = call->token();
+        std::string prefix = temp_name("inl");
+        std::map<std::string, ParseTree*> names;
+
+        // Parameters become renamed temporaries. A simple argument of the
+        // same type which the body never assigns is used directly instead.
+        std::set<std::string> written;
+        vars_written(fun->body(), written);
+        ArgList *args = (ArgList*) call->right();
+        ArgList *params = fun->parameters();
+        int first = added.size();
+        for(int p=0; p<params->size(); p++) {
+            Var *param = (Var*) ((VarDecl*) params->child(p))->child();
+            std::string local = param->token().lexeme;
+            ParseTree *arg = args->child(p);
+            args->child(p, nullptr);
+            if((dynamic_cast<Var*>(arg) or dynamic_cast<Number*>(arg))
+               and arg->type() == param->type() and not written.count(local)) {
+                names[local] = arg;
+            } else {
+                std::string name = prefix + "_" + local;
+                names[local] = make_var(tok, name, param->type());
+                _decls.push_back(make_decl(tok, name, param->type()));
+                added.push_back(make_assign(tok, name, param->type(), arg));
+            }
+        }
+
+        // The body's own declarations move to the top of the scope. A call
+        // starts with its locals zeroed, so those which may be read before
+        // they are assigned are zeroed at each inlined call.
+        Program *body = (Program*) clone_tree(fun->body());
+        for(int s=0; s<body->size(); s++) {
+            if(VarDecl *decl = dynamic_cast<VarDecl*>(body->child(s))) {
+                Var *var = (Var*) decl->child();
+                std::string name = prefix + "_" + var->token().lexeme;
+                names[var->token().lexeme] = make_var(tok, name, var->type());
+                _decls.push_back(make_decl(tok, name, var->type()));
+                if(not written_first(body, var->token().lexeme)) {
+                    Result zero;
+                    if(var->type() == INTEGER) {
+                        zero.i(0);
+                    } else {
+                        zero.r(0.0);
+                    }
+                    added.push_back(make_assign(tok, name, var->type(), make_number(tok, zero)));
+                }
+            }
+        }
+        rename(nullptr, body, names);
+        for(auto itr = names.begin(); itr != names.end(); itr++) {
+            delete itr->second;
+        }
+
+        ParseTree *value = nullptr;
+        for(int s=0; s<body->size(); s++) {
+            ParseTree *stmt = body->child(s);
+            body->child(s, nullptr);
+            if(dynamic_cast<VarDecl*>(stmt)) {
+                delete stmt;
+            } else if(s == body->size() - 1 and fun->return_type() != VOID) {
+                value = stmt;
+            } else {
+                added.push_back(stmt);
+            }
+        }
+        delete body;
+
+        // A lone expression of the right type takes the place of the call.
+        // Otherwise it is converted to the return type in a temporary.
+        if(value and (int) added.size() == first and value->type() == fun->return_type()) {
+            replace_child(parent, call, value);
+            value = nullptr;
+        } else if(value) {
+            _decls.push_back(make_decl(tok, prefix, fun->return_type()));
+            added.push_back(make_assign(tok, prefix, fun->return_type(), value));
+            replace_child(parent, call, make_var(tok, prefix, fun->return_type()));
+        }
+
+        // a void call was the whole statement
+        if(fun->return_type() == VOID) {
+            remove = true;
+        }
+        delete call;
+
+        std::ostringstream os;
+        os << fun->name() << " (line " << tok.line << ")";
+        _report.push_back(os.str());
+        _count++;
+    }
+
+    if(remove) {
+        block->child(i, added.back());
+        added.pop_back();
+    }
+    for(int a=added.size()-1; a>=0; a--) {
+        block->insert(i, added[a]);
+    }
+    return added.size();
+}
+
+
+// true if a function can be substituted at its call sites
+bool Inliner::can_inline(FunctionDef *fun)
+{
+    auto itr = _verdict.find(fun);
+    if(itr != _verdict.end()) return itr->second;
+
+    Program *body = fun->body();
+    bool ok = body->size() > 0 and tree_size(body) <= _max_size and not has_call(body);
+
+    // locals are the parameters and the declarations at the top level
+    std::set<std::string> locals;
+    int stmts = 0;
+    for(auto p = fun->parameters()->begin(); ok and p != fun->parameters()->end(); p++) {
+        locals.insert(((VarDecl*) *p)->child()->token().lexeme);
+    }
+    for(auto s = body->begin(); ok and s != body->end(); s++) {
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*s)) {
+            locals.insert(decl->child()->token().lexeme);
+        } else {
+            ok = not has_decl_or_print(*s);
+            stmts++;
+        }
+    }
+    ok = ok and stmts > 0;
+
+    // nothing outside the function may change
+    std::set<std::string> written;
+    if(ok) {
+        vars_written(body, written);
+    }
+    for(auto w = written.begin(); ok and w != written.end(); w++) {
+        ok = locals.count(*w) > 0;
+    }
+
+    // the value of the body is its last expression
+    if(ok and fun->return_type() != VOID) {
+        ok = is_expression(body->child(body->size() - 1));
+    }
+
+    _verdict[fun] = ok;
+    return ok;
+}
+
+
+// find the function a call refers to, nullptr if it is not known
+FunctionDef *Inliner::resolve(const std::string &name)
+{
+    for(auto scope = _scopes.rbegin(); scope != _scopes.rend(); scope++) {
+        auto itr = scope->find(name);
+        if(itr != scope->end()) return itr->second;
+    }
+    return nullptr;
+}
@@ -0,0 +1,897 @@
+// A baseline x86-64 JIT for calc functions. Every variable lives in a
+// stack slot of the native frame, and expressions are evaluated into
+// eax (integers) or xmm0 (reals), with pending left operands pushed on
+// the machine stack.
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <csetjmp>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "jit.h"
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Runtime Support
+//////////////////////////////////////////
+
+// where a runtime error in native code escapes to, and what it was
+static jmp_buf *escape = nullptr;
+static const char *error = nullptr;
+
+// the JIT which the FunctionCall hook uses
+static Jit *active = nullptr;
+
+
+static void native_div_zero()
+{
+    error = "Integer division by zero.";
+    longjmp(*escape, 1);
+}
+
+
+static int native_pow_i(int l, int r)
+{
+    int result;
+    if(not int_pow(l, r, result)) {
+        error = "Integer overflow.";
+        longjmp(*escape, 1);
+    }
+    return result;
+}
+
+
+static double native_pow_r(double l, double r)
+{
+    return pow(l, r);
+}
+
+
+static void native_print_i(int value)
+{
+    std::cout << value << std::endl;
+}
+
+
+static void native_print_r(double value)
+{
+    std::cout << value << std::endl;
+}
+
+
+static bool native_hook(FunctionCall *call, FunctionDef *fun, RefEnv &env, Result &result)
+{
+    return active->call(call, fun, env, result);
+}
+
+
+static bool native_loop_hook(While *loop, RefEnv &env)
+{
+    return active->run_loop(loop, env);
+}
+
+
+//////////////////////////////////////////
+// Code Generation
+//////////////////////////////////////////
+
+// thrown when a function uses something the JIT does not handle
+struct Unsupported {};
+
+
+class NativeCompiler
+{
+public:
+    NativeCompiler(Jit &jit, FunctionDef *fun, RefEnv *scope);
+
+    // generate the function's code and make it executable
+    virtual void compile(NativeFunction *native);
+
+    // generate code which finishes running a loop, from its condition
+    virtual void compile_loop(While *loop, NativeLoop *native);
+
+protected:
+    // A variable in the native frame
+    struct Local
+    {
+        ResultType type;
+        int slot;
+    };
+
+    // statements, leaving the block's value in eax or xmm0 if wanted
+    virtual ResultType compile_block(Program *block, bool want_value);
+    virtual ResultType compile_stmt(ParseTree *tree);
+    virtual void compile_cond(ParseTree *cond);
+
+    // expressions, leaving the value in eax or xmm0
+    virtual void compile_expr(ParseTree *tree);
+    virtual void compile_as(ParseTree *tree, ResultType type);
+    virtual void compile_arith(BinaryOp *op);
+    virtual void compile_compare(BinaryOp *op);
+    virtual void compile_call(FunctionCall *call);
+
+    // operand handling
+    virtual void compile_operands(BinaryOp *op, ResultType type);
+    virtual void convert(ResultType from, ResultType to);
+    virtual void push(ResultType type);
+    virtual Local &local(ParseTree *var);
+    virtual void load(const Local &var);
+    virtual void store(const Local &var);
+    virtual void call_address(void *fn);
+
+    // copy the code into executable memory
+    virtual void *finish(size_t &size);
+
+    // machine code
+    virtual void emit(std::initializer_list<int> bytes);
+    virtual void emit32(int32_t n);
+    virtual void emit64(uint64_t n);
+    virtual int jump(std::initializer_list<int> op);
+    virtual void patch(int pos, int target);
+    virtual int here() const;
+
+private:
+    Jit &_jit;
+    FunctionDef *_fun;
+    RefEnv *_scope;
+    std::vector<uint8_t> _code;
+    std::map<std::string, Local> _locals;
+    int _next_slot;
+    int _pushes;
+    int _loops;
+    std::vector<int> _div_checks;
+};
+
+
+// count the variables declared in a function body
+static int count_decls(Program *block)
+{
+    int n = 0;
+    for(int i=0; i<block->size(); i++) {
+        ParseTree *stmt = block->child(i);
+        if(dynamic_cast<VarDecl*>(stmt)) {
+            n++;
+        } else if(dynamic_cast<While*>(stmt) or dynamic_cast<Branch*>(stmt)) {
+            n += count_decls((Program*) ((BinaryOp*) stmt)->right());
+        }
+    }
+    return n;
+}
+
+
+// the frame displacement of a slot
+static int disp(int slot)
+{
+    return -8 * (slot + 1);
+}
+
+
+NativeCompiler::NativeCompiler(Jit &jit, FunctionDef *fun, RefEnv *scope) : _jit(jit)
+{
+    _fun = fun;
+    _scope = scope;
+    _next_slot = 0;
+    _pushes = 0;
+    _loops = 0;
+}
+
+
+// generate the function's code and make it executable
+void NativeCompiler::compile(NativeFunction *native)
+{
+    ResultType return_type = _fun->return_type();
+    if(return_type != INTEGER and return_type != REAL) throw Unsupported();
+
+    // memoized functions check their table on every call, recursive or not
+    if(_fun->memo()) throw Unsupported();
+
+    // the parameters take the first slots
+    ArgList *params = _fun->parameters();
+    for(int i=0; i<params->size(); i++) {
+        VarDecl *decl = (VarDecl*) params->child(i);
+        ResultType type = decl->child()->type();
+        if(type != INTEGER and type != REAL) throw Unsupported();
+        _locals[decl->child()->token().lexeme] = Local{type, _next_slot++};
+    }
+    int nslots = _next_slot + count_decls(_fun->body());
+    int frame = (8 * nslots + 15) & ~15;
+
+    // push rbp; mov rbp, rsp; sub rsp, frame
+    emit({0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC});
+    emit32(frame);
+
+    // copy the arguments in, the last one is first in memory
+    int n = params->size();
+    for(int i=0; i<n; i++) {
+        emit({0x48, 0x8B, 0x87});           // mov rax, [rdi + d]
+        emit32(8 * (n - 1 - i));
+        emit({0x48, 0x89, 0x85});           // mov [rbp + d], rax
+        emit32(disp(i));
+    }
+
+    // variables start out zero
+    emit({0x31, 0xC0});                     // xor eax, eax
+    for(int i=n; i<nslots; i++) {
+        emit({0x48, 0x89, 0x85});           // mov [rbp + d], rax
+        emit32(disp(i));
+    }
+
+    // the body's last statement is the return value
+    ResultType type = compile_block(_fun->body(), true);
+    convert(type, return_type);
+    if(return_type == REAL) {
+        emit({0x66, 0x48, 0x0F, 0x7E, 0xC0});  // movq rax, xmm0
+    }
+    emit({0xC9, 0xC3});                     // leave; ret
+
+    native->memory = finish(native->size);
+    native->entry = (NativeEntry) native->memory;
+}
+
+
+// Generate code which finishes running a loop, from its condition. The
+// argument is the addresses of the variables the loop uses, which are
+// copied into the frame on entry and back out on exit.
+void NativeCompiler::compile_loop(While *loop, NativeLoop *native)
+{
+    std::set<std::string> names;
+    vars_read(loop, names);
+    vars_written(loop, names);
+    for(auto itr = names.begin(); itr != names.end(); itr++) {
+        RefEnv *owner = _scope->owner(*itr);
+        if(not owner) throw Unsupported();
+        Result &var = (*owner)[*itr];
+        if(var.type() != INTEGER and var.type() != REAL) throw Unsupported();
+        _locals[*itr] = Local{var.type(), _next_slot++};
+        native->names.push_back(*itr);
+    }
+
+    // the argument pointer is kept in the last slot
+    int n = _next_slot++;
+    int frame = (8 * _next_slot + 15) & ~15;
+
+    // push rbp; mov rbp, rsp; sub rsp, frame
+    emit({0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC});
+    emit32(frame);
+    emit({0x48, 0x89, 0xBD});               // mov [rbp + d], rdi
+    emit32(disp(n));
+
+    for(int i=0; i<n; i++) {
+        emit({0x48, 0x8B, 0x87});           // mov rax, [rdi + d]
+        emit32(8 * i);
+        emit({0x48, 0x8B, 0x00});           // mov rax, [rax]
+        emit({0x48, 0x89, 0x85});           // mov [rbp + d], rax
+        emit32(disp(i));
+    }
+
+    compile_stmt(loop);
+
+    // write the variables back
+    emit({0x48, 0x8B, 0xBD});               // mov rdi, [rbp + d]
+    emit32(disp(n));
+    for(int i=0; i<n; i++) {
+        emit({0x48, 0x8B, 0x87});           // mov rax, [rdi + d]
+        emit32(8 * i);
+        emit({0x48, 0x8B, 0x8D});           // mov rcx, [rbp + d]
+        emit32(disp(i));
+        emit({0x48, 0x89, 0x08});           // mov [rax], rcx
+    }
+    emit({0x31, 0xC0, 0xC9, 0xC3});         // xor eax, eax; leave; ret
+
+    native->memory = finish(native->size);
+    native->entry = (NativeEntry) native->memory;
+}
+
+
+// copy the code into executable memory
+void *NativeCompiler::finish(size_t &size)
+{
+    // integer division by zero leaves through the runtime
+    if(not _div_checks.empty()) {
+        for(auto itr = _div_checks.begin(); itr != _div_checks.end(); itr++) {
+            patch(*itr, here());
+        }
+        call_address((void*) native_div_zero);
+    }
+
+    size = (_code.size() + 4095) & ~4095;
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) throw Unsupported();
+    memcpy(mem, _code.data(), _code.size());
+    mprotect(mem, size, PROT_READ | PROT_EXEC);
+
+    return mem;
+}
+
+
+// statements, leaving the block's value in eax or xmm0 if wanted
+ResultType NativeCompiler::compile_block(Program *block, bool want_value)
+{
+    ResultType type = VOID;
+    for(int i=0; i<block->size(); i++) {
+        type = compile_stmt(block->child(i));
+    }
+
+    if(want_value and type == VOID) {
+        emit({0x31, 0xC0});                 // xor eax, eax
+        type = INTEGER;
+    }
+    return type;
+}
+
+
+ResultType NativeCompiler::compile_stmt(ParseTree *tree)
+{
+    if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        // a declaration in a loop is an error on its second pass
+        ResultType type = decl->child()->type();
+        if(_loops or (type != INTEGER and type != REAL)) throw Unsupported();
+        _locals[decl->child()->token().lexeme] = Local{type, _next_slot++};
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        Local &var = local(assign->left());
+        compile_as(assign->right(), var.type);
+        store(var);
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        int top = here();
+        compile_cond(loop->left());
+        int exit = jump({0x0F, 0x84});      // jz exit
+        _loops++;
+        compile_block((Program*) loop->right(), false);
+        _loops--;
+        patch(jump({0xE9}), top);           // jmp top
+        patch(exit, here());
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        compile_cond(branch->left());
+        int exit = jump({0x0F, 0x84});      // jz exit
+        compile_block((Program*) branch->right(), false);
+        patch(exit, here());
+    } else if(Print *print = dynamic_cast<Print*>(tree)) {
+        compile_expr(print->child());
+        if(print->child()->type() == INTEGER) {
+            emit({0x89, 0xC7});             // mov edi, eax
+            call_address((void*) native_print_i);
+        } else {
+            call_address((void*) native_print_r);
+        }
+    } else if(dynamic_cast<FunctionDef*>(tree) or dynamic_cast<Program*>(tree)) {
+        throw Unsupported();
+    } else {
+        // an expression statement
+        compile_expr(tree);
+        return tree->type();
+    }
+
+    return VOID;
+}
+
+
+// conditions are comparisons, which are always integers
+void NativeCompiler::compile_cond(ParseTree *cond)
+{
+    compile_as(cond, INTEGER);
+    emit({0x85, 0xC0});                     // test eax, eax
+}
+
+
+// expressions, leaving the value in eax or xmm0
+void NativeCompiler::compile_expr(ParseTree *tree)
+{
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        Result val = num->value();
+        if(val.type() == INTEGER) {
+            emit({0xB8});                   // mov eax, imm
+            emit32(val.i());
+        } else {
+            emit({0x48, 0xB8});             // mov rax, imm
+            emit64(val.bits());             // a boxed real is just its bits
+            emit({0x66, 0x48, 0x0F, 0x6E, 0xC0});  // movq xmm0, rax
+        }
+    } else if(dynamic_cast<Var*>(tree)) {
+        load(local(tree));
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        compile_expr(neg->child());
+        if(neg->child()->type() == INTEGER) {
+            emit({0xF7, 0xD8});             // neg eax
+        } else {
+            emit({0x48, 0xB8});             // mov rax, sign bit
+            emit64(0x8000000000000000ULL);
+            emit({0x66, 0x48, 0x0F, 0x6E, 0xC8});  // movq xmm1, rax
+            emit({0x66, 0x0F, 0x57, 0xC1});        // xorpd xmm0, xmm1
+        }
+    } else if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        compile_compare((BinaryOp*) tree);
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        compile_call(call);
+    } else if(dynamic_cast<Add*>(tree) or dynamic_cast<Sub*>(tree) or dynamic_cast<Mul*>(tree)
+              or dynamic_cast<Div*>(tree) or dynamic_cast<Pow*>(tree)) {
+        compile_arith((BinaryOp*) tree);
+    } else {
+        throw Unsupported();
+    }
+}
+
+
+void NativeCompiler::compile_as(ParseTree *tree, ResultType type)
+{
+    compile_expr(tree);
+    convert(tree->type(), type);
+}
+
+
+// arithmetic is done in the type of the result
+void NativeCompiler::compile_arith(BinaryOp *op)
+{
+    ResultType t = op->type();
+    compile_operands(op, t);
+
+    if(t == INTEGER) {
+        if(dynamic_cast<Add*>(op)) {
+            emit({0x01, 0xC8});             // add eax, ecx
+        } else if(dynamic_cast<Sub*>(op)) {
+            emit({0x29, 0xC8});             // sub eax, ecx
+        } else if(dynamic_cast<Mul*>(op)) {
+            emit({0x0F, 0xAF, 0xC1});       // imul eax, ecx
+        } else if(dynamic_cast<Div*>(op)) {
+            emit({0x85, 0xC9});             // test ecx, ecx
+            _div_checks.push_back(jump({0x0F, 0x84}));
+            emit({0x83, 0xF9, 0xFF});       // cmp ecx, -1
+            emit({0x75, 0x04});             // jne +4
+            emit({0xF7, 0xD8});             // neg eax, as x / -1 wraps
+            emit({0xEB, 0x03});             // jmp +3
+            emit({0x99, 0xF7, 0xF9});       // cdq; idiv ecx
+        } else {
+            emit({0x89, 0xC7, 0x89, 0xCE}); // mov edi, eax; mov esi, ecx
+            call_address((void*) native_pow_i);
+        }
+    } else {
+        if(dynamic_cast<Add*>(op)) {
+            emit({0xF2, 0x0F, 0x58, 0xC1}); // addsd xmm0, xmm1
+        } else if(dynamic_cast<Sub*>(op)) {
+            emit({0xF2, 0x0F, 0x5C, 0xC1}); // subsd xmm0, xmm1
+        } else if(dynamic_cast<Mul*>(op)) {
+            emit({0xF2, 0x0F, 0x59, 0xC1}); // mulsd xmm0, xmm1
+        } else if(dynamic_cast<Div*>(op)) {
+            emit({0xF2, 0x0F, 0x5E, 0xC1}); // divsd xmm0, xmm1
+        } else {
+            call_address((void*) native_pow_r);
+        }
+    }
+}
+
+
+// comparisons are done on integers unless either side is real
+void NativeCompiler::compile_compare(BinaryOp *op)
+{
+    bool equal = dynamic_cast<Equal*>(op) != nullptr;
+    bool r = op->left()->type() == REAL or op->right()->type() == REAL;
+    compile_operands(op, r ? REAL : INTEGER);
+
+    if(not r) {
+        emit({0x39, 0xC8});                 // cmp eax, ecx
+        emit({0x0F, equal ? 0x94 : 0x95, 0xC0});   // sete/setne al
+    } else if(equal) {
+        // unordered (NaN) operands are never equal
+        emit({0x66, 0x0F, 0x2E, 0xC1});     // ucomisd xmm0, xmm1
+        emit({0x0F, 0x94, 0xC0});           // sete al
+        emit({0x0F, 0x9B, 0xC1});           // setnp cl
+        emit({0x20, 0xC8});                 // and al, cl
+    } else {
+        emit({0x66, 0x0F, 0x2E, 0xC1});     // ucomisd xmm0, xmm1
+        emit({0x0F, 0x95, 0xC0});           // setne al
+        emit({0x0F, 0x9A, 0xC1});           // setp cl
+        emit({0x08, 0xC8});                 // or al, cl
+    }
+    emit({0x0F, 0xB6, 0xC0});               // movzx eax, al
+}
+
+
+// arguments are pushed in order and passed by address
+void NativeCompiler::compile_call(FunctionCall *call)
+{
+    // tail calls rely on the interpreter to reuse the frame
+    if(call->tail()) throw Unsupported();
+
+    FunctionDef *callee = _jit.resolve(call->left()->token().lexeme, _scope);
+    NativeFunction *native = _jit.compile(callee, _scope->owner(callee->name()));
+    if(not native) throw Unsupported();
+
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = callee->parameters();
+    for(int i=0; i<args->size(); i++) {
+        ResultType type = ((VarDecl*) params->child(i))->child()->type();
+        compile_as(args->child(i), type);
+        push(type);
+    }
+
+    // the call goes through the entry field, which may not be filled in yet
+    emit({0x48, 0x89, 0xE7});               // mov rdi, rsp
+    bool pad = _pushes % 2;
+    if(pad) emit({0x48, 0x83, 0xEC, 0x08});  // sub rsp, 8
+    emit({0x48, 0xB8});                     // mov rax, &entry
+    emit64((uint64_t) &native->entry);
+    emit({0xFF, 0x10});                     // call [rax]
+    if(pad) emit({0x48, 0x83, 0xC4, 0x08});  // add rsp, 8
+
+    emit({0x48, 0x81, 0xC4});               // add rsp, 8*n
+    emit32(8 * args->size());
+    _pushes -= args->size();
+
+    if(callee->return_type() == REAL) {
+        emit({0x66, 0x48, 0x0F, 0x6E, 0xC0});  // movq xmm0, rax
+    }
+}
+
+
+// Evaluate both operands of a binary operation. The left ends up in
+// eax or xmm0, and the right in ecx or xmm1.
+void NativeCompiler::compile_operands(BinaryOp *op, ResultType type)
+{
+    compile_as(op->left(), type);
+    push(type);
+    compile_as(op->right(), type);
+
+    if(type == INTEGER) {
+        emit({0x89, 0xC1, 0x58});           // mov ecx, eax; pop rax
+    } else {
+        emit({0x66, 0x0F, 0x28, 0xC8, 0x58});  // movapd xmm1, xmm0; pop rax
+        emit({0x66, 0x48, 0x0F, 0x6E, 0xC0});  // movq xmm0, rax
+    }
+    _pushes--;
+}
+
+
+void NativeCompiler::convert(ResultType from, ResultType to)
+{
+    if(from == INTEGER and to == REAL) {
+        emit({0xF2, 0x0F, 0x2A, 0xC0});     // cvtsi2sd xmm0, eax
+    } else if(from == REAL and to == INTEGER) {
+        emit({0xF2, 0x0F, 0x2C, 0xC0});     // cvttsd2si eax, xmm0
+    } else if(from != to) {
+        throw Unsupported();
+    }
+}
+
+
+void NativeCompiler::push(ResultType type)
+{
+    if(type == REAL) {
+        emit({0x66, 0x48, 0x0F, 0x7E, 0xC0});  // movq rax, xmm0
+    }
+    emit({0x50});                           // push rax
+    _pushes++;
+}
+
+
+// only the function's own variables can be compiled
+NativeCompiler::Local &NativeCompiler::local(ParseTree *var)
+{
+    auto itr = _locals.find(var->token().lexeme);
+    if(itr == _locals.end()) throw Unsupported();
+    return itr->second;
+}
+
+
+void NativeCompiler::load(const Local &var)
+{
+    if(var.type == INTEGER) {
+        emit({0x8B, 0x85});                 // mov eax, [rbp + d]
+    } else {
+        emit({0xF2, 0x0F, 0x10, 0x85});     // movsd xmm0, [rbp + d]
+    }
+    emit32(disp(var.slot));
+}
+
+
+void NativeCompiler::store(const Local &var)
+{
+    if(var.type == INTEGER) {
+        emit({0x89, 0x85});                 // mov [rbp + d], eax
+    } else {
+        emit({0xF2, 0x0F, 0x11, 0x85});     // movsd [rbp + d], xmm0
+    }
+    emit32(disp(var.slot));
+}
+
+
+// call a C++ function, keeping the stack aligned for it
+void NativeCompiler::call_address(void *fn)
+{
+    bool pad = _pushes % 2;
+    if(pad) emit({0x48, 0x83, 0xEC, 0x08});  // sub rsp, 8
+    emit({0x48, 0xB8});                     // mov rax, fn
+    emit64((uint64_t) fn);
+    emit({0xFF, 0xD0});                     // call rax
+    if(pad) emit({0x48, 0x83, 0xC4, 0x08});  // add rsp, 8
+}
+
+
+// machine code
+void NativeCompiler::emit(std::initializer_list<int> bytes)
+{
+    for(auto itr = bytes.begin(); itr != bytes.end(); itr++) {
+        _code.push_back(*itr);
+    }
+}
+
+
+void NativeCompiler::emit32(int32_t n)
+{
+    for(int i=0; i<4; i++) {
+        _code.push_back((n >> (8*i)) & 0xFF);
+    }
+}
+
+
+void NativeCompiler::emit64(uint64_t n)
+{
+    for(int i=0; i<8; i++) {
+        _code.push_back((n >> (8*i)) & 0xFF);
+    }
+}
+
+
+// emit a jump with a 32 bit displacement, returning where it goes
+int NativeCompiler::jump(std::initializer_list<int> op)
+{
+    emit(op);
+    emit32(0);
+    return here() - 4;
+}
+
+
+void NativeCompiler::patch(int pos, int target)
+{
+    int32_t rel = target - (pos + 4);
+    memcpy(&_code[pos], &rel, sizeof(rel));
+}
+
+
+int NativeCompiler::here() const
+{
+    return _code.size();
+}
+
+
+//////////////////////////////////////////
+// Jit Implementation
+//////////////////////////////////////////
+
+Jit::Jit()
+{
+    _nesting = 0;
+    _compiled = 0;
+    _calls = 0;
+    _osr = 0;
+}
+
+
+Jit::~Jit()
+{
+    enable(false);
+    for(auto itr = _native.begin(); itr != _native.end(); itr++) {
+        if(itr->second->memory) {
+            munmap(itr->second->memory, itr->second->size);
+        }
+        delete itr->second;
+    }
+    for(auto itr = _loops.begin(); itr != _loops.end(); itr++) {
+        munmap(itr->second->memory, itr->second->size);
+        delete itr->second;
+    }
+}
+
+
+// switch native calls on or off for every FunctionCall
+void Jit::enable(bool on)
+{
+    if(on) {
+        active = this;
+        FunctionCall::native = native_hook;
+        While::native = native_loop_hook;
+    } else if(active == this) {
+        active = nullptr;
+        FunctionCall::native = nullptr;
+        While::native = nullptr;
+    }
+}
+
+
+// compile a function declared in scope, nullptr if it must be interpreted
+NativeFunction *Jit::compile(FunctionDef *fun, RefEnv *scope)
+{
+    if(_rejected.count(fun)) return nullptr;
+
+    // a function which is being compiled can already be called
+    auto itr = _native.find(fun);
+    if(itr != _native.end()) return itr->second;
+
+    NativeFunction *native = new NativeFunction{fun, nullptr, nullptr, 0};
+    _native[fun] = native;
+    _batch.push_back(fun);
+
+    bool ok = true;
+    _nesting++;
+    try {
+        NativeCompiler(*this, fun, scope).compile(native);
+    } catch(Unsupported) {
+        ok = false;
+    } catch(std::runtime_error &e) {
+        ok = false;
+    }
+    _nesting--;
+
+    if(not ok) {
+        _rejected.insert(fun);
+    }
+
+    // Once the outermost compile finishes, either everything it needed
+    // compiled or the lot is discarded, since the code may refer to a
+    // function which failed.
+    if(_nesting == 0) {
+        if(_rejected.count(fun)) {
+            for(auto b = _batch.begin(); b != _batch.end(); b++) {
+                NativeFunction *discard = _native[*b];
+                if(discard->memory) {
+                    munmap(discard->memory, discard->size);
+                }
+                delete discard;
+                _native.erase(*b);
+            }
+        } else {
+            _compiled += _batch.size();
+        }
+        _batch.clear();
+    }
+
+    return ok ? native : nullptr;
+}
+
+
+// run a call natively if the function can be compiled
+bool Jit::call(FunctionCall *call, FunctionDef *fun, RefEnv &env, Result &result)
+{
+    NativeFunction *native;
+    auto itr = _native.find(fun);
+    if(itr != _native.end()) {
+        native = itr->second;
+    } else if(_rejected.count(fun)) {
+        return false;
+    } else {
+        native = compile(fun, env.owner(call->left()->token().lexeme));
+        if(not native) return false;
+    }
+
+    // evaluate the arguments, converted to the parameter types
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = fun->parameters();
+    int n = args->size();
+    std::vector<uint64_t> words(n);
+    for(int i=0; i<n; i++) {
+        Result arg = args->child(i)->eval(env);
+        Result param;
+        param.type(((VarDecl*) params->child(i))->child()->type());
+        NUM_ASSIGN(param, NUM_RESULT(arg));
+        words[n-1-i] = param.bits();
+    }
+
+    // run it, catching errors raised by the native code
+    jmp_buf here;
+    jmp_buf *saved = escape;
+    escape = &here;
+    if(setjmp(here)) {
+        escape = saved;
+        throw std::runtime_error(error);
+    }
+    uint64_t value = native->entry(words.data());
+    escape = saved;
+    _calls++;
+
+    if(fun->return_type() == INTEGER) {
+        result.i((int) value);
+    } else {
+        double r;
+        memcpy(&r, &value, sizeof(double));
+        result.r(r);
+    }
+    return true;
+}
+
+
+// finish running a hot loop natively if it can be compiled
+bool Jit::run_loop(While *loop, RefEnv &env)
+{
+    NativeLoop *native;
+    auto itr = _loops.find(loop);
+    if(itr != _loops.end()) {
+        native = itr->second;
+    } else if(_rejected_loops.count(loop)) {
+        return false;
+    } else {
+        native = new NativeLoop{loop, {}, nullptr, nullptr, 0};
+        bool ok = true;
+        _nesting++;
+        try {
+            NativeCompiler(*this, nullptr, &env).compile_loop(loop, native);
+        } catch(Unsupported) {
+            ok = false;
+        } catch(std::runtime_error &e) {
+            ok = false;
+        }
+        _nesting--;
+
+        // the functions the loop needed stand or fall with it
+        if(ok) {
+            _compiled += _batch.size();
+        } else {
+            for(auto b = _batch.begin(); b != _batch.end(); b++) {
+                NativeFunction *discard = _native[*b];
+                if(discard->memory) {
+                    munmap(discard->memory, discard->size);
+                }
+                delete discard;
+                _native.erase(*b);
+            }
+        }
+        _batch.clear();
+
+        if(not ok) {
+            delete native;
+            _rejected_loops.insert(loop);
+            return false;
+        }
+        _loops[loop] = native;
+    }
+
+    // hand over the current values of the loop's variables
+    std::vector<uint64_t> vars;
+    for(auto name = native->names.begin(); name != native->names.end(); name++) {
+        vars.push_back((uint64_t) &(*env.owner(*name))[*name]);
+    }
+
+    jmp_buf here;
+    jmp_buf *saved = escape;
+    escape = &here;
+    if(setjmp(here)) {
+        escape = saved;
+        throw std::runtime_error(error);
+    }
+    native->entry(vars.data());
+    escape = saved;
+    _osr++;
+
+    return true;
+}
+
+
+// statistics
+int Jit::compiled() const
+{
+    return _compiled;
+}
+
+
+long long Jit::calls() const
+{
+    return _calls;
+}
+
+
+int Jit::loops() const
+{
+    return _loops.size();
+}
+
+
+long long Jit::loop_entries() const
+{
+    return _osr;
+}
+
+
+// find a function which a compiled function calls
+FunctionDef *Jit::resolve(const std::string &name, RefEnv *scope)
+{
+    Result &fun = (*scope->owner(name))[name];
+    if(fun.type() != FUNCTION_TYPE) throw Unsupported();
+    return (FunctionDef*) fun.ptr();
+}
@@ -0,0 +1,88 @@
+// This file contains a baseline JIT compiler which translates small
+// numeric calc functions into x86-64 machine code. Calls to compiled
+// functions bypass the tree walking evaluator entirely, and hot loops
+// switch to compiled code part way through.
+#ifndef JIT_H
+#define JIT_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "op.h"
+
+// Native functions take their arguments as 64 bit words, with the last
+// argument first, and return their value in a word. Integers use the
+// low 32 bits, reals use all 64.
+typedef uint64_t (*NativeEntry)(const uint64_t *args);
+
+
+// A compiled function
+struct NativeFunction
+{
+    FunctionDef *fun;
+    NativeEntry entry;      // called indirectly, so callers can be compiled first
+    void *memory;           // executable mapping
+    size_t size;
+};
+
+
+// A compiled loop. Its entry takes the addresses of the named variables.
+struct NativeLoop
+{
+    While *loop;
+    std::vector<std::string> names;
+    NativeEntry entry;
+    void *memory;
+    size_t size;
+};
+
+
+class Jit
+{
+public:
+    Jit();
+    virtual ~Jit();
+
+    // switch native calls on or off for every FunctionCall
+    virtual void enable(bool on);
+
+    // compile a function declared in scope, nullptr if it must be interpreted
+    virtual NativeFunction *compile(FunctionDef *fun, RefEnv *scope);
+
+    // run a call natively if the function can be compiled
+    virtual bool call(FunctionCall *call, FunctionDef *fun, RefEnv &env, Result &result);
+
+    // finish running a hot loop natively if it can be compiled
+    virtual bool run_loop(While *loop, RefEnv &env);
+
+    // statistics
+    virtual int compiled() const;
+    virtual long long calls() const;
+    virtual int loops() const;
+    virtual long long loop_entries() const;
+
+protected:
+    // find a function which a compiled function calls
+    virtual FunctionDef *resolve(const std::string &name, RefEnv *scope);
+
+private:
+    // compiled functions, and those which could not be compiled
+    std::map<FunctionDef*, NativeFunction*> _native;
+    std::set<FunctionDef*> _rejected;
+
+    // loops replaced on the stack, and those which could not be
+    std::map<While*, NativeLoop*> _loops;
+    std::set<While*> _rejected_loops;
+
+    // functions compiled since the outermost compile began
+    std::vector<FunctionDef*> _batch;
+    int _nesting;
+
+    int _compiled;
+    long long _calls;
+    long long _osr;
+
+    friend class NativeCompiler;
+};
+#endif
@@ -0,0 +1,149 @@
+// Loop invariant code motion for calc parse trees.
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Invariant Expressions
+//////////////////////////////////////////
+
+// one appearance of an invariant expression
+struct Invariant
+{
+    ParseTree *parent;
+    ParseTree *node;
+};
+
+
+// true if the expression reads none of the written variables
+static bool is_invariant(ParseTree *tree, const std::set<std::string> &written)
+{
+    std::set<std::string> deps;
+    vars_read(tree, deps);
+
+    for(auto itr = deps.begin(); itr != deps.end(); itr++) {
+        if(written.count(*itr)) return false;
+    }
+
+    return true;
+}
+
+
+// collect the largest invariant expressions in a tree
+static void collect(ParseTree *parent, ParseTree *tree, const std::set<std::string> &written,
+                    std::map<std::string, std::vector<Invariant>> &found,
+                    std::vector<std::string> &order)
+{
+    if(not tree or dynamic_cast<VarDecl*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        return;
+    }
+
+    // reading a temporary is not cheaper than a small expression
+    if(is_movable(tree) and is_invariant(tree, written) and tree_cost(tree) > VAR_COST) {
+        std::string key = tree_key(tree);
+        if(found[key].empty()) {
+            order.push_back(key);
+        }
+        found[key].push_back(Invariant{parent, tree});
+        return;
+    }
+
+    // visit the children
+    if(Assign *op = dynamic_cast<Assign*>(tree)) {
+        collect(tree, op->right(), written, found, order);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        collect(tree, op->child(), written, found, order);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        collect(tree, op->left(), written, found, order);
+        collect(tree, op->right(), written, found, order);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(int i=0; i<op->size(); i++) {
+            collect(tree, op->child(i), written, found, order);
+        }
+    }
+}
+
+
+//////////////////////////////////////////
+// LoopInvariantMotion Implementation
+//////////////////////////////////////////
+
+ParseTree *LoopInvariantMotion::run(ParseTree *tree)
+{
+    if(Program *program = dynamic_cast<Program*>(tree)) {
+        run_block(program, program);
+    }
+    return tree;
+}
+
+
+ParseTree *LoopInvariantMotion::rewrite(ParseTree *tree)
+{
+    // the pass works on whole blocks in run_block
+    return tree;
+}
+
+
+// hoist the invariants of the loops in a block
+void LoopInvariantMotion::run_block(Program *block, Program *scope)
+{
+    std::vector<ParseTree*> stmts(block->begin(), block->end());
+
+    // Inner loops go first, so their invariants can continue outward
+    // when they are invariant in the enclosing loop as well.
+    for(auto itr = stmts.begin(); itr != stmts.end(); itr++) {
+        if(While *loop = dynamic_cast<While*>(*itr)) {
+            run_block((Program*) loop->right(), scope);
+            hoist(loop, block, scope);
+        } else if(Branch *branch = dynamic_cast<Branch*>(*itr)) {
+            run_block((Program*) branch->right(), scope);
+        } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(*itr)) {
+            run_block(fun->body(), fun->body());
+        }
+    }
+}
+
+
+// hoist the invariants of one loop
+void LoopInvariantMotion::hoist(While *loop, Program *block, Program *scope)
+{
+    // a call could change any variable the callee can see
+    if(has_call(loop)) return;
+
+    // find the invariant expressions in the condition and body
+    std::set<std::string> written;
+    std::map<std::string, std::vector<Invariant>> found;
+    std::vector<std::string> order;
+    vars_written(loop, written);
+    collect(loop, loop->left(), written, found, order);
+    collect(loop, loop->right(), written, found, order);
+
+    // find where the loop is in its block
+    int pos = 0;
+    while(block->child(pos) != loop) pos++;
+
+    for(auto key = order.begin(); key != order.end(); key++) {
+        std::vector<Invariant> &inv = found[*key];
+        ResultType type = inv[0].node->type();
+        LexerToken tok = inv[0].node->token();
+        std::string name = temp_name("licm");
+
+        // compute the first appearance ahead of the loop
+        replace_child(inv[0].parent, inv[0].node, make_var(tok, name, type));
+        block->insert(pos++, make_assign(tok, name, type, inv[0].node));
+
+        // the rest read the temporary
+        for(auto itr = inv.begin() + 1; itr != inv.end(); itr++) {
+            replace_child(itr->parent, itr->node, make_var(tok, name, type));
+            delete itr->node;
+        }
+
+        // declare the temporary at the top of the scope
+        scope->insert(0, make_decl(tok, name, type));
+        if(scope == block) pos++;
+        _count++;
+    }
+}
@@ -0,0 +1,74 @@
+#include "memo.h"
+
+//////////////////////////////////////////
+// Memo Implementation
+//////////////////////////////////////////
+
+// the size is rounded up to a power of 2
+Memo::Memo(int nargs, int size)
+{
+    int n = 1;
+    while(n < size) n *= 2;
+
+    _table.resize(n);
+    for(auto itr = _table.begin(); itr != _table.end(); itr++) {
+        itr->used = false;
+    }
+    _mask = n - 1;
+    _nargs = nargs;
+}
+
+
+Memo::~Memo()
+{
+}
+
+
+// the remembered result for the arguments, nullptr if there is none
+Result *Memo::find(const int *args)
+{
+    Entry &entry = slot(args);
+    bool match = entry.used;
+    for(int i=0; match and i<_nargs; i++) {
+        match = entry.args[i] == args[i];
+    }
+
+    if(not match) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return &entry.result;
+}
+
+
+// remember a result, evicting the entry it replaces
+void Memo::store(const int *args, const Result &result)
+{
+    Entry &entry = slot(args);
+    if(entry.used) {
+        evictions++;
+    }
+
+    entry.used = true;
+    for(int i=0; i<_nargs; i++) {
+        entry.args[i] = args[i];
+    }
+    entry.result = result;
+}
+
+
+// the entry for an argument list
+Memo::Entry &Memo::slot(const int *args)
+{
+    unsigned h = 2166136261u;
+    for(int i=0; i<_nargs; i++) {
+        h = (h ^ (unsigned) args[i]) * 16777619u;
+    }
+    return _table[(h ^ (h >> 15)) & _mask];
+}
+
+
+long long Memo::hits = 0;
+long long Memo::misses = 0;
+long long Memo::evictions = 0;
@@ -0,0 +1,46 @@
+// This file contains the memo tables which remember the results of pure
+// calc functions. A table is direct mapped: each argument list hashes to
+// one entry, and storing a new result evicts whatever was there.
+#ifndef MEMO_H
+#define MEMO_H
+#include <vector>
+#include "op.h"
+
+
+class Memo
+{
+public:
+    // functions with more integer parameters are not memoized
+    static const int MAX_ARGS = 4;
+
+    // the size is rounded up to a power of 2
+    Memo(int nargs, int size=4096);
+    virtual ~Memo();
+
+    // the remembered result for the arguments, nullptr if there is none
+    virtual Result *find(const int *args);
+
+    // remember a result, evicting the entry it replaces
+    virtual void store(const int *args, const Result &result);
+
+    // statistics for all of the tables
+    static long long hits;
+    static long long misses;
+    static long long evictions;
+
+private:
+    struct Entry
+    {
+        bool used;
+        int args[MAX_ARGS];
+        Result result;
+    };
+
+    // the entry for an argument list
+    Entry &slot(const int *args);
+
+    std::vector<Entry> _table;
+    unsigned _mask;
+    int _nargs;
+};
+#endif
@@ -1,23 +1,68 @@
 #include <iostream>
 #include <cmath>
+#include <climits>
+#include <algorithm>
 #include <stdexcept>
 #include "lexer.h"
 #include "op.h"
+#include "memo.h"
 
 //////////////////////////////////////////
 // Helper Functions
 //////////////////////////////////////////
+
+// raise an integer to an integer power by repeated squaring
+bool int_pow(int base, int exp, int &result)
+{
+    // only 1 and -1 have integer reciprocals, and 0 has none
+    if(exp < 0) {
+        if(base == 0) return false;
+        result = base == 1 ? 1 : base == -1 ? (exp % 2 ? -1 : 1) : 0;
+        return true;
+    }
+
+    long long r = 1;
+    long long b = base;
+    while(exp) {
+        if(exp & 1) {
+            r *= b;
+            if(r > INT_MAX or r < INT_MIN) return false;
+        }
+        exp >>= 1;
+
+        // the remaining bits multiply the result by at least this square
+        if(exp) {
+            b *= b;
+            if(b > INT_MAX) return false;
+        }
+    }
+
+    result = r;
+    return true;
+}
+
+
+// the same, throwing a runtime error when the power does not fit
+int checked_pow(int base, int exp)
+{
+    int result;
+    if(not int_pow(base, exp, result)) {
+        throw std::runtime_error("Integer overflow.");
+    }
+    return result;
+}
+
 static ResultType coerce(Result left, Result right) 
 {
     // if the types match, there is no coercion
-    if(left.type == right.type) return left.type;
+    if(left.type() == right.type()) return left.type();
 
     // if either left or right is void, so is the result
-    if(left.type == VOID or right.type == VOID) return VOID;
+    if(left.type() == VOID or right.type() == VOID) return VOID;
 
     // perform type widening
-    if((left.type == REAL and right.type == INTEGER) or 
-       (left.type == INTEGER and right.type == REAL)) {
+    if((left.type() == REAL and right.type() == INTEGER) or 
+       (left.type() == INTEGER and right.type() == REAL)) {
         return REAL;
     }
 
@@ -27,27 +72,81 @@ static ResultType coerce(Result left, Result right)
 }
 
 
+//////////////////////////////////////////
+// TypeFeedback Implementation
+//////////////////////////////////////////
+
+long long TypeFeedback::threshold = 100;
+long long TypeFeedback::guesses = 0;
+long long TypeFeedback::deopts = 0;
+
+
+TypeFeedback::TypeFeedback()
+{
+    _key = -1;
+    _guess = -1;
+    _mixed = false;
+    _count = 0;
+}
+
+
+// the key of a pair of numeric operands, -1 if either is not a number
+int TypeFeedback::key(const Result &l, const Result &r)
+{
+    ResultType lt = l.type();
+    ResultType rt = r.type();
+    if((lt != INTEGER and lt != REAL) or (rt != INTEGER and rt != REAL)) {
+        return -1;
+    }
+    return (lt == REAL) << 1 | (rt == REAL);
+}
+
+
+// A node only guesses while it has seen a single numeric key. A failed
+// guess is a second key, so the node never guesses again.
+void TypeFeedback::record(int key)
+{
+    if(_guess >= 0) {
+        _guess = -1;
+        deopts++;
+    }
+
+    if(_count == 0) {
+        _key = key;
+    } else if(key != _key) {
+        _mixed = true;
+    }
+
+    if(not _mixed and key >= 0 and ++_count == threshold) {
+        _guess = key;
+        guesses++;
+    }
+}
+
+
 //////////////////////////////////////////
 // Multi-Typed Result Returns
 //////////////////////////////////////////
 
 // handy string conversion for debugging
-const char* RTSTR[] = { "VOID", "INTEGER", "REAL" };
+const char* RTSTR[] = { "VOID", "INTEGER", "REAL", "FUNCTION" };
 
 // print result values
 std::ostream& operator<<(std::ostream& os, const Result &result)
 {
     // handle the numeric types
-    if(result.type == INTEGER) return os << result.val.i;
+    if(result.type() == INTEGER) return os << result.i();
 
-    switch(result.type) {
+    switch(result.type()) {
         case VOID:
             break;
         case INTEGER:
-            os << result.val.i;
+            os << result.i();
             break;
         case REAL:
-            os << result.val.r;
+            os << result.r();
+            break;
+        case FUNCTION_TYPE:
             break;
     }
 
@@ -69,9 +168,46 @@ RefEnv::RefEnv() : RefEnv(nullptr)
 RefEnv::RefEnv(RefEnv *_parent) 
 {
     parent(_parent);
+    _mask = 7;
+    _table = new EnvSlot[_mask + 1];
+    for(unsigned i=0; i<=_mask; i++) {
+        _table[i].sym = nullptr;
+    }
+    _size = 0;
+    _owned = true;
+    _pooled = false;
+    allocations++;
 }
 
 
+// a call frame with room for nvars variables, from the frame stack
+RefEnv::RefEnv(RefEnv *_parent, int nvars)
+{
+    parent(_parent);
+    unsigned n = table_size(nvars);
+    _mark = FrameStack::mark();
+    _table = FrameStack::push(n);
+    _mask = n - 1;
+    _size = 0;
+    _owned = false;
+    _pooled = true;
+}
+
+
+RefEnv::~RefEnv()
+{
+    if(_owned) {
+        delete[] _table;
+    }
+    if(_pooled) {
+        FrameStack::release(_mark);
+    }
+}
+
+
+long long RefEnv::allocations = 0;
+
+
 // access/modify the parent
 RefEnv *RefEnv::parent()
 {
@@ -86,22 +222,34 @@ void RefEnv::parent(RefEnv *_parent)
 
 
 // declare a variable
-void RefEnv::declare(const std::string &name, ResultType type)
+void RefEnv::declare(const Symbol *sym, ResultType type)
 {
     // names must be unique
-    if(exists(name)) {
-        throw std::runtime_error("Redeclaration of " + name);
+    if(find(sym)) {
+        throw std::runtime_error("Redeclaration of " + sym->name());
+    }
+
+    // keep the table at most half full, so that misses end quickly
+    if(2 * (_size + 1) > (int) _mask + 1) {
+        grow();
     }
 
-    // create the variable and add it to the table
-    Result var;
-    var.type = type;
-    _symtab[name] = var;
+    // create the variable in the first free slot
+    unsigned i = free_slot(_table, _mask, sym);
+    _table[i].sym = sym;
+    _table[i].val.type(type);
+    _size++;
 }
 
 
-// check to see if a name exists in the environment
-bool RefEnv::exists(const std::string &name)
+void RefEnv::declare(const std::string &name, ResultType type)
+{
+    declare(Symbol::intern(name), type);
+}
+
+
+// find a variable in this environment or an enclosing one
+Result *RefEnv::find(const Symbol *sym)
 {
     // nested scope type of existing
     // +----------------+
@@ -111,35 +259,191 @@ bool RefEnv::exists(const std::string &name)
     // | | this        ||
     // | +-------------+|
     // +----------------+
-    // Loookup becomes a recursive process
-    if(_symtab.find(name) != _symtab.end()) {
-        // we found it in the local scope
-        return true;
-    } else if(parent() == nullptr) {
-        // this is the end of the recursion
-        return false;
-    } else {
-        // search our parent
-        return parent()->exists(name);
+    // Lookup searches outward, one scope at a time
+    for(RefEnv *env = this; env; env = env->_parent) {
+        Result *val = env->local(sym);
+        if(val) return val;
     }
+    return nullptr;
+}
+
+
+// check to see if a name exists in the environment
+bool RefEnv::exists(const std::string &name)
+{
+    return find(Symbol::intern(name)) != nullptr;
+}
+
+
+// find the environment in which a name is declared
+RefEnv *RefEnv::owner(const Symbol *sym)
+{
+    for(RefEnv *env = this; env; env = env->_parent) {
+        if(env->local(sym)) return env;
+    }
+    throw std::runtime_error(sym->name() + " not defined.");
+}
+
+
+RefEnv *RefEnv::owner(const std::string &name)
+{
+    return owner(Symbol::intern(name));
 }
 
 
 // retrieve a variable associative array style
-Result& RefEnv::operator[](const std::string &name)
+Result& RefEnv::operator[](const Symbol *sym)
 {
     // names must exist
-    if(not exists(name)) {
-        throw std::runtime_error(name + " not defined.");
+    Result *val = find(sym);
+    if(not val) {
+        throw std::runtime_error(sym->name() + " not defined.");
     }
+    return *val;
+}
 
-    if(_symtab.find(name) != _symtab.end()) {
-        // find local variables
-        return _symtab[name];
-    } else {
-        // find outside scope variables
-        return (*parent())[name];
+
+Result& RefEnv::operator[](const std::string &name)
+{
+    return (*this)[Symbol::intern(name)];
+}
+
+
+// retrieve a call frame's variable by its position in the table
+Result& RefEnv::slot(int i)
+{
+    return _table[i].val;
+}
+
+
+// The positions variables take when they are declared in order into an
+// empty call frame. Frames are sized for all their variables, so the
+// table never grows and each position depends only on what came before.
+std::vector<int> RefEnv::layout(const std::vector<const Symbol*> &syms, int nvars)
+{
+    unsigned n = table_size(nvars);
+    std::vector<EnvSlot> table(n);
+    for(unsigned i=0; i<n; i++) {
+        table[i].sym = nullptr;
+    }
+
+    std::vector<int> result;
+    for(auto itr = syms.begin(); itr != syms.end(); itr++) {
+        unsigned i = free_slot(table.data(), n - 1, *itr);
+        table[i].sym = *itr;
+        result.push_back(i);
+    }
+    return result;
+}
+
+
+// the variable declared here, nullptr if there is none
+Result *RefEnv::local(const Symbol *sym)
+{
+    for(unsigned i = sym->hash() & _mask; _table[i].sym; i = (i + 1) & _mask) {
+        if(_table[i].sym == sym) return &_table[i].val;
     }
+    return nullptr;
+}
+
+
+// double the size of the table
+void RefEnv::grow()
+{
+    EnvSlot *old = _table;
+    unsigned old_size = _mask + 1;
+
+    _mask = 2 * old_size - 1;
+    _table = new EnvSlot[_mask + 1];
+    allocations++;
+    for(unsigned i=0; i<=_mask; i++) {
+        _table[i].sym = nullptr;
+    }
+
+    // reinsert each variable
+    for(unsigned i=0; i<old_size; i++) {
+        if(not old[i].sym) continue;
+        _table[free_slot(_table, _mask, old[i].sym)] = old[i];
+    }
+
+    if(_owned) {
+        delete[] old;
+    }
+    _owned = true;
+}
+
+
+// a call frame's table is at most half full
+unsigned RefEnv::table_size(int nvars)
+{
+    unsigned n = 1;
+    while(n < 2 * (unsigned) nvars) n *= 2;
+    return n;
+}
+
+
+// the first free slot, probing linearly from the symbol's hash
+unsigned RefEnv::free_slot(const EnvSlot *table, unsigned mask, const Symbol *sym)
+{
+    unsigned i = sym->hash() & mask;
+    while(table[i].sym) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+
+//////////////////////////////////////////
+// FrameStack Implementation
+//////////////////////////////////////////
+std::vector<FrameStack::Block> FrameStack::_blocks;
+int FrameStack::_block = -1;
+unsigned FrameStack::_top = 0;
+long long FrameStack::frames = 0;
+
+
+// the current top of the stack
+FrameStack::Mark FrameStack::mark()
+{
+    return Mark{_block, _top};
+}
+
+
+// take n empty slots from the top of the stack
+EnvSlot *FrameStack::push(unsigned n)
+{
+    frames++;
+
+    // a frame which does not fit starts the next block
+    if(_block < 0 or _top + n > _blocks[_block].size) {
+        _block++;
+        _top = 0;
+        if(_block == (int) _blocks.size()) {
+            _blocks.push_back(Block{nullptr, 0});
+        }
+        Block &block = _blocks[_block];
+        if(block.size < n) {
+            delete[] block.slots;
+            block.size = std::max(n, 4096u);
+            block.slots = new EnvSlot[block.size];
+            RefEnv::allocations++;
+        }
+    }
+
+    EnvSlot *slots = _blocks[_block].slots + _top;
+    _top += n;
+    for(unsigned i=0; i<n; i++) {
+        slots[i].sym = nullptr;
+    }
+    return slots;
+}
+
+
+// pop everything pushed since a mark
+void FrameStack::release(const Mark &mark)
+{
+    _block = mark.block;
+    _top = mark.top;
 }
 
 
@@ -242,6 +546,13 @@ void BinaryOp::right(ParseTree *child)
 }
 
 
+// the value of the operation, given the values of its children
+Result BinaryOp::combine(const Result &, const Result &)
+{
+    throw std::runtime_error("Cannot combine the operands of " + token().lexeme);
+}
+
+
 // print the tree with 2 children
 void BinaryOp::print(int depth) const
 {
@@ -290,6 +601,22 @@ void NaryOp::push(ParseTree *child)
 }
 
 
+// insert a child before the given position
+void NaryOp::insert(int i, ParseTree *child)
+{
+    _children.insert(_children.begin() + i, child);
+}
+
+
+// take the child at a position out of the list, returning it
+ParseTree *NaryOp::remove(int i)
+{
+    ParseTree *result = _children[i];
+    _children.erase(_children.begin() + i);
+    return result;
+}
+
+
 // access iterators for the children
 std::vector<ParseTree*>::const_iterator NaryOp::begin() const
 {
@@ -303,6 +630,25 @@ std::vector<ParseTree*>::const_iterator NaryOp::end() const
 }
 
 
+// access the children by position
+int NaryOp::size() const
+{
+    return _children.size();
+}
+
+
+ParseTree *NaryOp::child(int i) const
+{
+    return _children[i];
+}
+
+
+void NaryOp::child(int i, ParseTree *_child)
+{
+    _children[i] = _child;
+}
+
+
 // print the tree
 void NaryOp::print(int depth) const
 {
@@ -339,10 +685,12 @@ Result Program::eval(RefEnv &env)
 {
     //programs return the last expression
     Result result;
+    result.type(VOID);
 
-    // evaluate each statement in the program
+    // evaluate each statement in the program, up to a tail call
     for(auto itr = begin(); itr != end(); itr++) {
         result = (*itr)->eval(env);
+        if(FunctionCall::tail_pending) break;
     }
 
     return result;
@@ -386,12 +734,25 @@ Result Add::eval(RefEnv &env)
     Result l = left()->eval(env);
     Result r = right()->eval(env);
 
+    // take the fast path for the types seen so far
+    Result result;
+    if(_feedback.speculate<AddFn>(l, r, result)) return result;
+    return Add::combine(l, r);
+}
+
+
+Result Add::combine(const Result &l, const Result &r)
+{
     // get the type of the result
     Result result;
-    result.type = coerce(l, r);
+    result.type(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) + NUM_RESULT(r));
+    // perform the operation, wrapping integers
+    if(result.type() == INTEGER) {
+        result.i(AddFn::apply(l.i(), r.i()));
+    } else {
+        result.r(NUM_RESULT(l) + NUM_RESULT(r));
+    }
 
     return result;
 }
@@ -413,12 +774,25 @@ Result Sub::eval(RefEnv &env)
     Result l = left()->eval(env);
     Result r = right()->eval(env);
 
+    // take the fast path for the types seen so far
+    Result result;
+    if(_feedback.speculate<SubFn>(l, r, result)) return result;
+    return Sub::combine(l, r);
+}
+
+
+Result Sub::combine(const Result &l, const Result &r)
+{
     // get the type of the result
     Result result;
-    result.type = coerce(l, r);
+    result.type(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) - NUM_RESULT(r));
+    // perform the operation, wrapping integers
+    if(result.type() == INTEGER) {
+        result.i(SubFn::apply(l.i(), r.i()));
+    } else {
+        result.r(NUM_RESULT(l) - NUM_RESULT(r));
+    }
 
     return result;
 }
@@ -440,12 +814,25 @@ Result Mul::eval(RefEnv &env)
     Result l = left()->eval(env);
     Result r = right()->eval(env);
 
+    // take the fast path for the types seen so far
+    Result result;
+    if(_feedback.speculate<MulFn>(l, r, result)) return result;
+    return Mul::combine(l, r);
+}
+
+
+Result Mul::combine(const Result &l, const Result &r)
+{
     // get the type of the result
     Result result;
-    result.type = coerce(l, r);
+    result.type(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) * NUM_RESULT(r));
+    // perform the operation, wrapping integers
+    if(result.type() == INTEGER) {
+        result.i(MulFn::apply(l.i(), r.i()));
+    } else {
+        result.r(NUM_RESULT(l) * NUM_RESULT(r));
+    }
 
     return result;
 }
@@ -467,12 +854,25 @@ Result Div::eval(RefEnv &env)
     Result l = left()->eval(env);
     Result r = right()->eval(env);
 
+    // take the fast path for the types seen so far
+    Result result;
+    if(_feedback.speculate<DivFn>(l, r, result)) return result;
+    return Div::combine(l, r);
+}
+
+
+Result Div::combine(const Result &l, const Result &r)
+{
     // get the type of the result
     Result result;
-    result.type = coerce(l, r);
+    result.type(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, NUM_RESULT(l) / NUM_RESULT(r));
+    // perform the operation, integer division by zero has no value
+    if(result.type() == INTEGER) {
+        result.i(DivFn::apply(l.i(), r.i()));
+    } else {
+        result.r(NUM_RESULT(l) / NUM_RESULT(r));
+    }
 
     return result;
 }
@@ -494,12 +894,25 @@ Result Pow::eval(RefEnv &env)
     Result l = left()->eval(env);
     Result r = right()->eval(env);
 
+    // take the fast path for the types seen so far
+    Result result;
+    if(_feedback.speculate<PowFn>(l, r, result)) return result;
+    return Pow::combine(l, r);
+}
+
+
+Result Pow::combine(const Result &l, const Result &r)
+{
     // get the type of the result
     Result result;
-    result.type = coerce(l, r);
+    result.type(coerce(l, r));
 
-    // perform the operation
-    NUM_ASSIGN(result, pow(NUM_RESULT(l), NUM_RESULT(r)));
+    // perform the operation, exactly for integers
+    if(result.type() == INTEGER) {
+        result.i(checked_pow(l.i(), r.i()));
+    } else {
+        result.r(pow(NUM_RESULT(l), NUM_RESULT(r)));
+    }
 
     return result;
 }
@@ -519,7 +932,11 @@ Result Neg::eval(RefEnv &env)
 {
     //eval the child and then negate it
     Result result = child()->eval(env);
-    NUM_ASSIGN(result, -NUM_RESULT(result));
+    if(result.type() == INTEGER) {
+        result.i(NegFn::apply(result.i()));
+    } else {
+        result.r(-result.r());
+    }
 
     return result;
 }
@@ -541,16 +958,41 @@ Number::Number(LexerToken _token) : ParseTree(_token)
 {
     //get the number's value
     if(_token == INTLIT) {
-        _val.type = INTEGER;
-        _val.val.i = stoi(_token.lexeme);
+        _val.i(stoi(_token.lexeme));
     } else if(_token == REALLIT) {
-        _val.type = REAL;
-        _val.val.r = stod(_token.lexeme);
+        _val.r(stod(_token.lexeme));
     }
 }
 
 
-Result Number::eval(RefEnv &env)
+// construct a literal with a computed value
+Number::Number(LexerToken _token, Result _val) : ParseTree(_token)
+{
+    this->_val = _val;
+    type(_val.type());
+}
+
+
+Result Number::eval(RefEnv &)
+{
+    return _val;
+}
+
+
+int Number::eval_int(RefEnv &)
+{
+    return NUM_RESULT(_val);
+}
+
+
+double Number::eval_real(RefEnv &)
+{
+    return NUM_RESULT(_val);
+}
+
+
+// the value of the literal
+Result Number::value() const
 {
     return _val;
 }
@@ -563,6 +1005,7 @@ Result Number::eval(RefEnv &env)
 ParseTree::ParseTree(LexerToken &token)
 {
     this->_token = token;
+    this->_type = VOID;
 }
 
 
@@ -579,6 +1022,34 @@ LexerToken ParseTree::token() const
 }
 
 
+// access the statically inferred type of the tree
+ResultType ParseTree::type() const
+{
+    return _type;
+}
+
+
+void ParseTree::type(ResultType _type)
+{
+    this->_type = _type;
+}
+
+
+// evaluate a numeric parse tree directly to an integer or real
+int ParseTree::eval_int(RefEnv &env)
+{
+    Result result = eval(env);
+    return NUM_RESULT(result);
+}
+
+
+double ParseTree::eval_real(RefEnv &env)
+{
+    Result result = eval(env);
+    return NUM_RESULT(result);
+}
+
+
 // print the tree (for debug purposes)
 void ParseTree::print(int depth) const
 {
@@ -613,12 +1084,20 @@ void ParseTree::print_prefix(int depth) const
 
 Var::Var(LexerToken _token) : ParseTree(_token)
 {
+    _sym = Symbol::intern(_token.lexeme);
 }
 
 
 Result Var::eval(RefEnv &env)
 {
-    return env[token().lexeme];;
+    return env[_sym];
+}
+
+
+// the interned name of the variable
+const Symbol *Var::symbol() const
+{
+    return _sym;
 }
 
 
@@ -633,7 +1112,7 @@ Print::Print(LexerToken _token) : UnaryOp(_token)
 Result Print::eval(RefEnv &env)
 {
     Result result;
-    result.type = VOID;
+    result.type(VOID);
 
     //print the result of the child
     std::cout << child()->eval(env) << std::endl;
@@ -647,13 +1126,14 @@ Result Print::eval(RefEnv &env)
 //////////////////////////////////////////
 VarDecl::VarDecl(LexerToken _token) : UnaryOp(_token)
 {
+    _sym = nullptr;
 }
 
 Result VarDecl::eval(RefEnv &env)
 {
     ResultType var_type;
     Result result;
-    result.type = VOID;
+    result.type(VOID);
 
     //get the variable type
     switch(token().token)
@@ -662,12 +1142,16 @@ Result VarDecl::eval(RefEnv &env)
             var_type = INTEGER;
             break;
         case REAL_DECL:
+        default:
             var_type = REAL;
             break;
     }
 
     //perform the declaration
-    env.declare(child()->token().lexeme, var_type);
+    if(not _sym) {
+        _sym = Symbol::intern(child()->token().lexeme);
+    }
+    env.declare(_sym, var_type);
 
     return result;
 }
@@ -678,6 +1162,7 @@ Result VarDecl::eval(RefEnv &env)
 //////////////////////////////////////////
 Assign::Assign(LexerToken _token) : BinaryOp(_token)
 {
+    _sym = nullptr;
 }
 
 
@@ -685,13 +1170,15 @@ Result Assign::eval(RefEnv &env)
 {
     // get the value and name to assign
     Result val = right()->eval(env);
-    std::string name = left()->token().lexeme;
+    if(not _sym) {
+        _sym = Symbol::intern(left()->token().lexeme);
+    }
 
     //perform the assignment
-    NUM_ASSIGN(env[name], NUM_RESULT(val));
+    NUM_ASSIGN(env[_sym], NUM_RESULT(val));
 
     Result result;
-    result.type = VOID;
+    result.type(VOID);
 
     return result;
 }
@@ -702,21 +1189,52 @@ Result Assign::eval(RefEnv &env)
 //////////////////////////////////////////
 While::While(LexerToken _token) : BinaryOp(_token) 
 {
+    _trips = 0;
 }
 
 
 Result While::eval(RefEnv &env)
 {
-    while(NUM_RESULT(left()->eval(env)) != 0) {
+    Result result;
+    result.type(VOID);
+
+    // a loop which has been hot before starts in compiled code
+    if(native and _trips >= native_threshold and native(this, env)) {
+        return result;
+    }
+
+    while(test(env)) {
         right()->eval(env);
+        _trips++;
+
+        // count iterations for tiered execution
+        if(Profiler::active and _trips == Profiler::loop_threshold) {
+            Profiler::active->hot(this);
+        }
+
+        // replace the loop on the stack, at the back edge
+        if(native and _trips == native_threshold and native(this, env)) {
+            break;
+        }
     }
 
-    Result result;
-    result.type = VOID;
     return result;
 }
 
 
+// evaluate the condition
+bool While::test(RefEnv &env)
+{
+    // the condition is evaluated once, it may make calls
+    Result cond = left()->eval(env);
+    return NUM_RESULT(cond) != 0;
+}
+
+
+bool (*While::native)(While *loop, RefEnv &env) = nullptr;
+long long While::native_threshold = 1000;
+
+
 //////////////////////////////////////////
 // Branch implementation
 //////////////////////////////////////////
@@ -727,12 +1245,13 @@ Branch::Branch(LexerToken _token) : BinaryOp(_token)
 
 Result Branch::eval(RefEnv &env)
 {
-    if(NUM_RESULT(left()->eval(env)) != 0) {
+    Result cond = left()->eval(env);
+    if(NUM_RESULT(cond) != 0) {
         right()->eval(env);
     }
 
     Result result;
-    result.type = VOID;
+    result.type(VOID);
     return result;
 }
 
@@ -746,14 +1265,22 @@ Equal::Equal(LexerToken _token) : BinaryOp(_token)
 
 
 Result Equal::eval(RefEnv &env)
+{
+    Result l = left()->eval(env);
+    Result r = right()->eval(env);
+    return Equal::combine(l, r);
+}
+
+
+Result Equal::combine(const Result &l, const Result &r)
 {
     Result result;
-    result.type = INTEGER;
+    result.type(INTEGER);
 
-    if(NUM_RESULT(left()->eval(env)) == NUM_RESULT(right()->eval(env))) {
-        result.val.i = 1;
+    if(NUM_RESULT(l) == NUM_RESULT(r)) {
+        result.i(1);
     } else {
-        result.val.i = 0;
+        result.i(0);
     }
 
     return result;
@@ -769,14 +1296,22 @@ NotEqual::NotEqual(LexerToken _token) : BinaryOp(_token)
 
 
 Result NotEqual::eval(RefEnv &env)
+{
+    Result l = left()->eval(env);
+    Result r = right()->eval(env);
+    return NotEqual::combine(l, r);
+}
+
+
+Result NotEqual::combine(const Result &l, const Result &r)
 {
     Result result;
-    result.type = INTEGER;
+    result.type(INTEGER);
 
-    if(NUM_RESULT(left()->eval(env)) != NUM_RESULT(right()->eval(env))) {
-        result.val.i = 1;
+    if(NUM_RESULT(l) != NUM_RESULT(r)) {
+        result.i(1);
     } else {
-        result.val.i = 0;
+        result.i(0);
     }
 
     return result;
@@ -789,17 +1324,30 @@ Result NotEqual::eval(RefEnv &env)
 
 FunctionDef::FunctionDef(LexerToken _token) : ParseTree(_token)
 {
+    _body = nullptr;
+    _calls = 0;
+    _memo = nullptr;
+    _sized = nullptr;
+    _frame_size = 0;
+}
+
+
+FunctionDef::~FunctionDef()
+{
+    delete _memo;
 }
 
 
 Result FunctionDef::eval(RefEnv &env)
 {
     // insert ourselves into the environment
-    env.declare(name(), FUNCTION_TYPE);    
-    env[name()].val.ptr = this;
+    const Symbol *sym = Symbol::intern(name());
+    env.declare(sym, FUNCTION_TYPE);
+    env[sym].ptr(this);
+    bindings++;
 
     Result result;
-    result.type = VOID;
+    result.type(VOID);
     return result;
 }
 
@@ -826,13 +1374,13 @@ void FunctionDef::name(const std::string &_name)
 
 Program *FunctionDef::body() const
 {
-    return _body;
+    return _body.load(std::memory_order_acquire);
 }
 
 
 void FunctionDef::body(Program *_body)
 {
-    this->_body = _body;
+    this->_body.store(_body, std::memory_order_release);
 }
 
 ResultType FunctionDef::return_type() const
@@ -859,6 +1407,74 @@ void FunctionDef::parameters(ArgList *_parameters)
 }
 
 
+// count a call, returning the number so far
+long long FunctionDef::tick()
+{
+    return ++_calls;
+}
+
+
+// Calls are the only scopes, so every declaration in a function body,
+// however deeply nested in loops and branches, lands in the call's frame.
+static int count_decls(ParseTree *tree)
+{
+    if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        return 1;
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        return count_decls(loop->right());
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        return count_decls(branch->right());
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        int n = 0;
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            n += count_decls(*itr);
+        }
+        return n;
+    }
+    return 0;
+}
+
+
+// the number of parameters and variables a call declares
+int FunctionDef::frame_size()
+{
+    return frame_size(body());
+}
+
+
+int FunctionDef::frame_size(Program *body)
+{
+    if(body != _sized) {
+        _frame_size = count_frame(body);
+        _sized = body;
+    }
+    return _frame_size;
+}
+
+
+// count the variables of a body afresh, from any thread
+int FunctionDef::count_frame(Program *body) const
+{
+    return parameters()->size() + count_decls(body);
+}
+
+
+long long FunctionDef::bindings = 0;
+
+
+// the table of remembered results, if the function is pure
+Memo *FunctionDef::memo() const
+{
+    return _memo;
+}
+
+
+void FunctionDef::memo(Memo *_memo)
+{
+    this->_memo = _memo;
+}
+
+
 //////////////////////////////////////////
 // ArgList Implementation
 //////////////////////////////////////////
@@ -868,10 +1484,10 @@ ArgList::ArgList(LexerToken _token) : NaryOp(_token)
 }
 
 
-Result ArgList::eval(RefEnv &env)
+Result ArgList::eval(RefEnv &)
 {
     Result result;
-    result.type = VOID;
+    result.type(VOID);
     return result;
 }
 
@@ -881,30 +1497,292 @@ Result ArgList::eval(RefEnv &env)
 
 FunctionCall::FunctionCall(LexerToken _token) : BinaryOp(_token)
 {
+    _callee = nullptr;
+    _hops = 0;
+    _bindings = -1;
+    _tail = false;
 }
 
 
+bool (*FunctionCall::native)(FunctionCall *call, FunctionDef *fun, RefEnv &env, Result &result) = nullptr;
+long long FunctionCall::cache_hits = 0;
+long long FunctionCall::cache_misses = 0;
+
+
 Result FunctionCall::eval(RefEnv &env)
 {
-    // get the function
-    Result fun_var = left()->eval(env);
-    FunctionDef *fun = (FunctionDef*) fun_var.val.ptr;
+    // Find the function and its scope. Scopes only come from calls, and
+    // names cannot be declared again in nested scopes, so a call site
+    // finds its callee the same number of scopes up. A function defined
+    // under an if may not have been bound in this call's scope though, so
+    // the cached callee is only used if the scope still binds it.
+    const Symbol *name = ((Var*) left())->symbol();
+    RefEnv *scope = &env;
+    for(int i=0; i<_hops; i++) {
+        scope = scope->parent();
+    }
+    Result *bound = _bindings == FunctionDef::bindings ? scope->find(name) : nullptr;
+    if(bound and bound->ptr() == _callee) {
+        cache_hits++;
+    } else {
+        cache_misses++;
+        RefEnv *owner = env.owner(name);
+        _hops = 0;
+        for(scope = &env; scope != owner; scope = scope->parent()) {
+            _hops++;
+        }
+        _callee = (FunctionDef*) (*owner)[name].ptr();
+        _bindings = FunctionDef::bindings;
+    }
+    FunctionDef *fun = _callee;
+    ArgList *args = (ArgList*) right();
+
+    // count calls for tiered execution
+    if(Profiler::active and fun->tick() == Profiler::call_threshold) {
+        Profiler::active->hot(fun);
+    }
+
+    // A tail call leaves its arguments for the call which is running the
+    // function. The body stops, and that call starts it again.
+    if(_tail) {
+        std::vector<Result> values;
+        for(auto itr = args->begin(); itr != args->end(); itr++) {
+            values.push_back((*itr)->eval(env));
+        }
+        tail_args.swap(values);
+        tail_pending = true;
+
+        Result result;
+        result.type(fun->return_type());
+        return result;
+    }
+
+    // let the JIT have it, if it is switched on
+    Result native_result;
+    if(native and native(this, fun, env, native_result)) {
+        return native_result;
+    }
+
+    // a pure function may remember the result already
+    if(Memo *memo = fun->memo()) {
+        Result values[Memo::MAX_ARGS];
+        int key[Memo::MAX_ARGS];
+        for(int i=0; i<args->size(); i++) {
+            values[i] = args->child(i)->eval(env);
+            key[i] = NUM_RESULT(values[i]);
+        }
+
+        Result *known = memo->find(key);
+        if(known) return *known;
+
+        Result result = invoke(fun, scope, env, values);
+        memo->store(key, result);
+        return result;
+    }
+
+    return invoke(fun, scope, env, nullptr);
+}
+
+
+// run the function, binding values to the parameters if they are given
+Result FunctionCall::invoke(FunctionDef *fun, RefEnv *scope, RefEnv &env, const Result *values)
+{
     ArgList *args = (ArgList*) right();
+    ArgList *params = fun->parameters();
+    int nparams = params->size();
+    Result body_result;
+    for(;;) {
+        // The function runs in the scope where it was declared, not the
+        // scope of its caller. This keeps recursive calls from colliding
+        // with the parameters of the calling instance.
+        Program *body = fun->body();
+        RefEnv local(scope, fun->frame_size(body));
+
+        // Declare and bind the local parameters. Arguments are converted to
+        // the parameter type, just like assignment. A call site which has
+        // only passed arguments of the parameter types copies them instead.
+        // Its key has a bit for each argument which needed converting.
+        bool copy = _arg_feedback.guess() == 0;
+        int converted = 0;
+        for(int i=0; i<nparams; i++) {
+            VarDecl *vdec = (VarDecl*) params->child(i);
+            vdec->eval(local);
+            Result arg = values ? values[i] : args->child(i)->eval(env);
+            Result &param = local[((Var*) vdec->child())->symbol()];
+            if(arg.type() != param.type()) {
+                converted |= 1 << (i % 31);
+                NUM_ASSIGN(param, NUM_RESULT(arg));
+            } else if(copy) {
+                param = arg;
+            } else {
+                NUM_ASSIGN(param, NUM_RESULT(arg));
+            }
+        }
+        if(converted != _arg_feedback.guess()) {
+            _arg_feedback.record(converted);
+        }
+
+        // a tail call starts the body again with its arguments
+        body_result = body->eval(local);
+        if(not tail_pending) break;
+        tail_pending = false;
+        values = tail_args.data();
+    }
+
+    // convert the body's value to the declared return type
+    Result result;
+    result.type(fun->return_type());
+    if(result.type() != VOID) {
+        NUM_ASSIGN(result, NUM_RESULT(body_result));
+    }
+    return result;
+}
+
+
+// calls in tail position reuse the caller's frame
+bool FunctionCall::tail() const
+{
+    return _tail;
+}
+
+
+void FunctionCall::tail(bool _tail)
+{
+    this->_tail = _tail;
+}
+
+
+bool FunctionCall::tail_pending = false;
+std::vector<Result> FunctionCall::tail_args;
+
+
+//////////////////////////////////////////
+// Profiler Implementation
+//////////////////////////////////////////
+
+Profiler *Profiler::active = nullptr;
+long long Profiler::call_threshold = 0;
+long long Profiler::loop_threshold = 0;
+
+
+Profiler::~Profiler()
+{
+}
+
+
+//////////////////////////////////////////
+// Superinstruction Implementations
+//////////////////////////////////////////
+Increment::Increment(LexerToken _token, const std::string &name, int step) : Assign(_token)
+{
+    _name = Symbol::intern(name);
+    _step = step;
+}
+
+
+Result Increment::eval(RefEnv &env)
+{
+    hits++;
+    Result &var = env[_name];
+    var.i(AddFn::apply(var.i(), _step));
+
+    Result result;
+    result.type(VOID);
+    return result;
+}
+
+
+long long Increment::hits = 0;
+
+
+CompoundAssign::CompoundAssign(LexerToken _token, const std::string &name, ParseTree *operand) 
+    : Assign(_token)
+{
+    _name = Symbol::intern(name);
+    _operand = operand;
+}
+
+
+long long CompoundAssign::hits = 0;
+
+
+CompareLoop::CompareLoop(LexerToken _token, bool equal, ParseTree *l, ParseTree *r) : While(_token)
+{
+    _equal = equal;
+    _l = operand(l);
+    _r = operand(r);
+}
 
 
-    //declare and bind the local parameters
-    RefEnv local(&env);
-    auto argItr = args->begin();
-    for(auto itr = fun->parameters()->begin(); itr != fun->parameters()->end(); itr++) {
-        (*itr)->eval(local);
-        VarDecl *vdec = (VarDecl*) (*itr);
-        local[vdec->child()->token().lexeme] = (*argItr)->eval(env);
-        argItr++;
+// compare the operands without evaluating any nodes
+bool CompareLoop::test(RefEnv &env)
+{
+    hits++;
+    const Result &l = _l.name ? env[_l.name] : _l.val;
+    const Result &r = _r.name ? env[_r.name] : _r.val;
+    return (NUM_RESULT(l) == NUM_RESULT(r)) == _equal;
+}
+
+
+CompareLoop::Operand CompareLoop::operand(ParseTree *tree)
+{
+    Operand result;
+    result.name = nullptr;
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        result.val = num->value();
+    } else {
+        result.name = Symbol::intern(tree->token().lexeme);
     }
+    return result;
+}
 
 
-    Result result = fun->body()->eval(local);
-    if(fun->return_type() == VOID) 
-        result.type = VOID;
+long long CompareLoop::hits = 0;
+
+
+//////////////////////////////////////////
+// Frame Slot Implementations
+//////////////////////////////////////////
+SlotVar::SlotVar(LexerToken _token, int slot) : Var(_token)
+{
+    _slot = slot;
+}
+
+
+Result SlotVar::eval(RefEnv &env)
+{
+    return env.slot(_slot);
+}
+
+
+int SlotVar::eval_int(RefEnv &env)
+{
+    Result &var = env.slot(_slot);
+    return NUM_RESULT(var);
+}
+
+
+double SlotVar::eval_real(RefEnv &env)
+{
+    Result &var = env.slot(_slot);
+    return NUM_RESULT(var);
+}
+
+
+SlotAssign::SlotAssign(LexerToken _token, int slot) : Assign(_token)
+{
+    _slot = slot;
+}
+
+
+Result SlotAssign::eval(RefEnv &env)
+{
+    // the variable keeps its declared type
+    Result val = right()->eval(env);
+    Result &var = env.slot(_slot);
+    NUM_ASSIGN(var, NUM_RESULT(val));
+
+    Result result;
+    result.type(VOID);
     return result;
 }
@@ -5,13 +5,20 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <cmath>
+#include <stdexcept>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include "lexer.h"
+#include "symbol.h"
 
 
 //////////////////////////////////////////
 // Multi-Typed Result Returns
 //////////////////////////////////////////
 class FunctionDef;
+class Memo;
 union ResultField
 {
     int i;
@@ -29,11 +36,69 @@ enum ResultType
 };
 
 
-struct Result
+// A value of any calc type packed into 8 bytes, so that it is returned
+// in a single register. Reals are stored as themselves. Every other type
+// is hidden in the payload of a negative quiet NaN, with the type in the
+// top 16 bits. Arithmetic never produces those NaNs, and storing a real
+// replaces one with the ordinary NaN.
+//
+//   top 16 bits    low 48 bits
+//   < 0xFFF9       the bits of a real
+//   0xFFF9         void
+//   0xFFFA         integer in the low 32 bits
+//   0xFFFC         function pointer
+class Result
 {
-    // the value and type of the result
-    ResultField val;
-    ResultType type;
+public:
+    // a new result is void
+    Result() : _bits(BOX) {}
+
+    // the type of the value
+    ResultType type() const
+    {
+        uint64_t tag = _bits >> 48;
+        return tag < (BOX >> 48) ? REAL : (ResultType) (tag - (BOX >> 48));
+    }
+
+    // change the type, with a zero value
+    void type(ResultType _type)
+    {
+        if(_type == REAL) {
+            _bits = 0;
+        } else {
+            _bits = BOX + ((uint64_t) _type << 48);
+        }
+    }
+
+    // access/modify the value, setting its type
+    int i() const { return (int) (uint32_t) _bits; }
+    void i(int _i) { _bits = BOX + ((uint64_t) INTEGER << 48) + (uint32_t) _i; }
+
+    double r() const
+    {
+        double _r;
+        memcpy(&_r, &_bits, sizeof(_r));
+        return _r;
+    }
+
+    void r(double _r)
+    {
+        memcpy(&_bits, &_r, sizeof(_r));
+        if(_bits >= BOX) _bits = QNAN;
+    }
+
+    void *ptr() const { return (void*) (_bits & PAYLOAD); }
+    void ptr(void *_ptr) { _bits = BOX + ((uint64_t) FUNCTION_TYPE << 48) + (uint64_t) _ptr; }
+
+    // the boxed word. An integer's low 32 bits and a real's 64 bits can
+    // be written through the address of a result without changing type.
+    uint64_t bits() const { return _bits; }
+
+private:
+    static const uint64_t BOX = 0xFFF9000000000000ULL;
+    static const uint64_t QNAN = 0x7FF8000000000000ULL;
+    static const uint64_t PAYLOAD = 0x0000FFFFFFFFFFFFULL;
+    uint64_t _bits;
 };
 
 // convert result types to strings
@@ -43,40 +108,178 @@ extern const char* RTSTR[];
 std::ostream& operator<<(std::ostream& os, const Result &result);
 
 // A macro to extract the numeric result from Result
-#define NUM_RESULT(res) ((res).type == INTEGER ? (res).val.i : (res).val.r)
+#define NUM_RESULT(res) ((res).type() == INTEGER ? (res).i() : (res).r())
 
 // A macro to assign the correct numeric field
-#define NUM_ASSIGN(res, n) ((res).type == INTEGER ? (res).val.i=(n) : (res).val.r=(n))
+#define NUM_ASSIGN(res, n) ((res).type() == INTEGER ? (res).i(n) : (res).r(n))
 
 
 //////////////////////////////////////////
 // Variable Storage
 //////////////////////////////////////////
+// A variable in an environment's table
+struct EnvSlot
+{
+    const Symbol *sym;
+    Result val;
+};
+
+
+// The tables of call frames are carved from a stack of slots. The stack
+// is kept in blocks which are reused once popped, so calls stop
+// allocating as soon as the stack has reached the program's deepest
+// recursion.
+class FrameStack
+{
+public:
+    // a position in the stack to return to
+    struct Mark
+    {
+        int block;
+        unsigned top;
+    };
+
+    // the current top of the stack
+    static Mark mark();
+
+    // take n empty slots from the top of the stack
+    static EnvSlot *push(unsigned n);
+
+    // pop everything pushed since a mark
+    static void release(const Mark &mark);
+
+    // the number of frames pushed
+    static long long frames;
+
+private:
+    struct Block
+    {
+        EnvSlot *slots;
+        unsigned size;
+    };
+    static std::vector<Block> _blocks;
+    static int _block;          // the block holding the top
+    static unsigned _top;       // the first free slot in that block
+};
+
+
 class RefEnv {
 public:
     // constructor
     RefEnv();
     RefEnv(RefEnv *_parent);
 
+    // a call frame with room for nvars variables, from the frame stack
+    RefEnv(RefEnv *_parent, int nvars);
+    virtual ~RefEnv();
+
     // access/modify the parent
     virtual RefEnv *parent();
     virtual void parent(RefEnv *_parent);
 
     // declare a variable
+    virtual void declare(const Symbol *sym, ResultType type);
     virtual void declare(const std::string &name, ResultType type);
 
+    // find a variable in this environment or an enclosing one, nullptr if
+    // it is not declared. Declaring may move the variables of the
+    // environment it declares into.
+    virtual Result *find(const Symbol *sym);
+
     // check to see if a name exists in the environment
     virtual bool exists(const std::string &name);
 
+    // find the environment in which a name is declared
+    virtual RefEnv *owner(const Symbol *sym);
+    virtual RefEnv *owner(const std::string &name);
+
     // retrieve a variable associative array style
+    virtual Result& operator[](const Symbol *sym);
     virtual Result& operator[](const std::string &name);
 
+    // retrieve a call frame's variable by its position in the table
+    virtual Result& slot(int i);
+
+    // The positions variables take when they are declared in order into
+    // an empty call frame with room for nvars variables
+    static std::vector<int> layout(const std::vector<const Symbol*> &syms, int nvars);
+
+    // the number of variable tables allocated on the heap
+    static long long allocations;
+
 private:
-    std::map<std::string, Result> _symtab;
+    // The variables are an open addressed hash table, probed linearly
+    // from each symbol's hash, and kept at most half full.
+
+    // the variable declared here, nullptr if there is none
+    Result *local(const Symbol *sym);
+
+    // the size of a call frame's table, and where a new variable goes in one
+    static unsigned table_size(int nvars);
+    static unsigned free_slot(const EnvSlot *table, unsigned mask, const Symbol *sym);
+
+    // double the size of the table
+    void grow();
+
+    RefEnv(const RefEnv &) = delete;
+    RefEnv &operator=(const RefEnv &) = delete;
+
+    EnvSlot *_table;
+    unsigned _mask;
+    int _size;
+    bool _owned;                // the table is on the heap
+    bool _pooled;               // the frame stack must be popped
+    FrameStack::Mark _mark;
     RefEnv *_parent;
 };
 
 
+//////////////////////////////////////////
+// Type Feedback
+//////////////////////////////////////////
+
+// What a generic node has seen of the types of its operands, as a key.
+// Once a node has seen one key a threshold number of times, it guesses
+// that it will see no other. A guessing node checks the key before
+// taking a fast path for it. When the check fails the node records the
+// new key, stops guessing and runs the generic path from then on.
+class TypeFeedback
+{
+public:
+    TypeFeedback();
+
+    // the key of a pair of numeric operands, -1 if either is not a number
+    static int key(const Result &l, const Result &r);
+
+    // the key guessed, -1 while the node is generic
+    int guess() const { return _guess; }
+
+    // true once more than one key has been seen
+    bool mixed() const { return _mixed; }
+
+    // record a key seen on the generic path
+    void record(int key);
+
+    // The arithmetic fast path, guarded by the operand types. It is
+    // false, with the key recorded, when the guard fails.
+    template <class Fn>
+    bool speculate(const Result &l, const Result &r, Result &result);
+
+    // monomorphic executions before a node guesses
+    static long long threshold;
+
+    // the nodes which started guessing, and those which stopped
+    static long long guesses;
+    static long long deopts;
+
+private:
+    int _key;
+    int _guess;
+    bool _mixed;
+    unsigned _count;
+};
+
+
 //////////////////////////////////////////
 // Base Classes
 //////////////////////////////////////////
@@ -90,9 +293,17 @@ public:
     // get the token of the parse tree
     virtual LexerToken token() const;
 
+    // access the statically inferred type of the tree
+    virtual ResultType type() const;
+    virtual void type(ResultType _type);
+
     // evaluate the parse tree
     virtual Result eval(RefEnv &env)=0;
 
+    // evaluate a numeric parse tree directly to an integer or real
+    virtual int eval_int(RefEnv &env);
+    virtual double eval_real(RefEnv &env);
+
     // print the tree (for debug purposes)
     virtual void print(int depth) const;
 
@@ -100,6 +311,7 @@ public:
     virtual void print_prefix(int depth) const;
 private:
     LexerToken _token;
+    ResultType _type;
 };
 
 
@@ -142,12 +354,18 @@ public:
     virtual ParseTree *right() const;
     virtual void right(ParseTree *child);
 
+    // the value of the operation, given the values of its children
+    virtual Result combine(const Result &l, const Result &r);
+
     // print the tree with 2 children
     virtual void print(int depth) const;
 
 protected:
     ParseTree *_lchild;    
     ParseTree *_rchild;    
+
+    // the operand types seen by generic arithmetic
+    TypeFeedback _feedback;
 };
 
 
@@ -162,10 +380,21 @@ public:
     // push a child onto the list
     virtual void push(ParseTree *child);
 
+    // insert a child before the given position
+    virtual void insert(int i, ParseTree *child);
+
+    // take the child at a position out of the list, returning it
+    virtual ParseTree *remove(int i);
+
     // access iterators for the children
     virtual std::vector<ParseTree*>::const_iterator begin() const;
     virtual std::vector<ParseTree*>::const_iterator end() const;
 
+    // access the children by position
+    virtual int size() const;
+    virtual ParseTree *child(int i) const;
+    virtual void child(int i, ParseTree *_child);
+
     // print the tree
     virtual void print(int depth) const;
 protected:
@@ -193,6 +422,7 @@ class Add : public BinaryOp
 public:
     Add(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -202,6 +432,7 @@ class Sub : public BinaryOp
 public:
     Sub(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -211,6 +442,7 @@ class Mul: public BinaryOp
 public:
     Mul(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -220,6 +452,7 @@ class Div: public BinaryOp
 public:
     Div(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -229,6 +462,7 @@ class Pow: public BinaryOp
 public:
     Pow(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -247,7 +481,13 @@ class Number: public ParseTree
 {
 public:
     Number(LexerToken _token);
+    Number(LexerToken _token, Result _val);
     virtual Result eval(RefEnv &env);
+    virtual int eval_int(RefEnv &env);
+    virtual double eval_real(RefEnv &env);
+
+    // the value of the literal
+    virtual Result value() const;
 protected:
     Result _val;
 };
@@ -259,6 +499,11 @@ class Var: public ParseTree
 public:
     Var(LexerToken _token);
     virtual Result eval(RefEnv &env);
+
+    // the interned name of the variable
+    virtual const Symbol *symbol() const;
+private:
+    const Symbol *_sym;
 };
 
 
@@ -277,6 +522,8 @@ class VarDecl: public UnaryOp
 public:
     VarDecl(LexerToken _token);
     virtual Result eval(RefEnv &env);
+private:
+    const Symbol *_sym;     // interned when first declared
 };
 
 
@@ -286,6 +533,8 @@ class Assign : public BinaryOp
 public:
     Assign(LexerToken _token);
     virtual Result eval(RefEnv &env);
+private:
+    const Symbol *_sym;     // interned when first assigned
 };
 
 
@@ -295,6 +544,17 @@ class While : public BinaryOp
 public:
     While(LexerToken _token);
     virtual Result eval(RefEnv &env);
+
+    // finishes the loop in compiled code, false if it must be interpreted
+    static bool (*native)(While *loop, RefEnv &env);
+    static long long native_threshold;
+
+protected:
+    // evaluate the condition
+    virtual bool test(RefEnv &env);
+
+private:
+    long long _trips;
 };
 
 
@@ -313,6 +573,7 @@ class Equal : public BinaryOp
 public:
     Equal(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -322,6 +583,7 @@ class NotEqual : public BinaryOp
 public:
     NotEqual(LexerToken _token);
     virtual Result eval(RefEnv &env);
+    virtual Result combine(const Result &l, const Result &r);
 };
 
 
@@ -339,6 +601,7 @@ class FunctionDef : public ParseTree
 {
 public:
     FunctionDef(LexerToken _token);
+    virtual ~FunctionDef();
     virtual Result eval(RefEnv &env);
     virtual void print(int depth) const;
 
@@ -354,11 +617,36 @@ public:
     virtual ArgList *parameters() const;
     virtual void parameters(ArgList *_parameters);
 
+    // count a call, returning the number so far
+    virtual long long tick();
+
+    // The number of parameters and variables a call declares. Tiered
+    // execution replaces the body while calls are running, so a call sizes
+    // its frame for the body it loaded. The count for the last body is
+    // remembered, by the interpreter's thread only.
+    virtual int frame_size();
+    virtual int frame_size(Program *body);
+
+    // count the variables of a body afresh, from any thread
+    virtual int count_frame(Program *body) const;
+
+    // the table of remembered results, if the function is pure
+    virtual Memo *memo() const;
+    virtual void memo(Memo *_memo);
+
+    // bumped whenever a function name is bound, which invalidates the
+    // callees cached by call sites
+    static long long bindings;
+
 private:
     std::string _name;
     ArgList *_parameters;
-    Program *_body;
+    std::atomic<Program*> _body;    // replaced while running by tiered execution
     ResultType _return_type;
+    long long _calls;
+    Memo *_memo;
+    Program *_sized;                // the body counted by _frame_size
+    int _frame_size;
 };
 
 
@@ -368,5 +656,398 @@ class FunctionCall : public BinaryOp
 public:
     FunctionCall(LexerToken _token);
     virtual Result eval(RefEnv &env);
+
+    // An optional hook which may run a call as native code. It returns
+    // true if it did, leaving the function's value in result.
+    static bool (*native)(FunctionCall *call, FunctionDef *fun, RefEnv &env, Result &result);
+
+    // A call in tail position reuses the frame of the call running its
+    // function, instead of nesting another one inside it.
+    virtual bool tail() const;
+    virtual void tail(bool _tail);
+
+    // set by a tail call on its way out of the body
+    static bool tail_pending;
+
+    // call site cache statistics
+    static long long cache_hits;
+    static long long cache_misses;
+
+private:
+    // run the function, binding values to the parameters if they are given
+    Result invoke(FunctionDef *fun, RefEnv *scope, RefEnv &env, const Result *values);
+
+    // the arguments of a pending tail call
+    static std::vector<Result> tail_args;
+    bool _tail;
+
+    // which arguments needed converting to their parameter's type
+    TypeFeedback _arg_feedback;
+
+    // The callee found by the last lookup, and how many scopes up from
+    // the caller it is declared. These are valid until a binding changes.
+    FunctionDef *_callee;
+    int _hops;
+    long long _bindings;
+};
+
+
+//////////////////////////////////////////
+// Execution Profiling
+//////////////////////////////////////////
+
+// Functions count their calls and loops count their iterations. When a
+// count reaches its threshold, the active profiler hears about it once.
+class Profiler
+{
+public:
+    virtual ~Profiler();
+
+    // a function or loop has run often enough to be worth optimizing
+    virtual void hot(FunctionDef *fun)=0;
+    virtual void hot(While *loop)=0;
+
+    static Profiler *active;
+    static long long call_threshold;
+    static long long loop_threshold;
+};
+
+
+//////////////////////////////////////////
+// Type Specialized Arithmetic
+//////////////////////////////////////////
+
+// Raise an integer to an integer power by repeated squaring. Negative
+// exponents truncate toward zero, as converting the real power would.
+// The result is false if the power does not fit in an int.
+bool int_pow(int base, int exp, int &result);
+
+// the same, throwing a runtime error when the power does not fit
+int checked_pow(int base, int exp);
+
+
+// The arithmetic operations, applied to like typed values. Integer
+// results wrap around on overflow, computed through unsigned arithmetic
+// so that the wrapping is defined.
+struct NegFn
+{
+    static double apply(double x) { return -x; }
+    static int apply(int x) { return (int) (0u - (unsigned) x); }
+};
+
+
+struct AddFn
+{
+    static double apply(double l, double r) { return l + r; }
+    static int apply(int l, int r) { return (int) ((unsigned) l + (unsigned) r); }
+};
+
+
+struct SubFn
+{
+    static double apply(double l, double r) { return l - r; }
+    static int apply(int l, int r) { return (int) ((unsigned) l - (unsigned) r); }
+};
+
+
+struct MulFn
+{
+    static double apply(double l, double r) { return l * r; }
+    static int apply(int l, int r) { return (int) ((unsigned) l * (unsigned) r); }
+};
+
+
+struct DivFn
+{
+    static double apply(double l, double r) { return l / r; }
+    static int apply(int l, int r) 
+    {
+        if(r == 0) {
+            throw std::runtime_error("Integer division by zero.");
+        } else if(r == -1) {
+            return NegFn::apply(l);
+        }
+        return l / r;
+    }
+};
+
+
+struct PowFn
+{
+    static double apply(double l, double r) { return pow(l, r); }
+    static int apply(int l, int r) { return checked_pow(l, r); }
+};
+
+
+// The fast path computes as the specialized nodes do. Keys are 0 for
+// two integers, and otherwise have bit 1 set for a real left operand and
+// bit 0 for a real right operand.
+template <class Fn>
+bool TypeFeedback::speculate(const Result &l, const Result &r, Result &result)
+{
+    int k = key(l, r);
+    if(k != _guess) {
+        record(k);
+        return false;
+    }
+
+    if(k == 0) {
+        result.i(Fn::apply(l.i(), r.i()));
+    } else {
+        result.r(Fn::apply(k & 2 ? l.r() : (double) l.i(), k & 1 ? r.r() : (double) r.i()));
+    }
+    return true;
+}
+
+
+// An arithmetic operation with operand types fixed by the type checker.
+// It is a subclass of its generic operation (Base), so it is treated the
+// same by everything except eval, which skips the coerce() dispatch.
+// Integer operands are widened when they meet a real.
+template <class Base, class Fn, ResultType LT, ResultType RT>
+class TypedArith : public Base
+{
+public:
+    TypedArith(LexerToken _token) : Base(_token) { }
+
+    virtual Result eval(RefEnv &env)
+    {
+        Result result;
+        if(LT == INTEGER and RT == INTEGER) {
+            result.i(eval_int(env));
+        } else {
+            result.r(eval_real(env));
+        }
+
+        return result;
+    }
+
+    // The typed entry points evaluate the children through their own typed
+    // entry points, so no Result is built along the way.
+    virtual int eval_int(RefEnv &env)
+    {
+        if(LT == INTEGER and RT == INTEGER) {
+            int l = this->_lchild->eval_int(env);
+            int r = this->_rchild->eval_int(env);
+            return Fn::apply(l, r);
+        }
+        return eval_real(env);
+    }
+
+    virtual double eval_real(RefEnv &env)
+    {
+        if(LT == INTEGER and RT == INTEGER) {
+            return eval_int(env);
+        }
+
+        double l = LT == INTEGER ? this->_lchild->eval_int(env) : this->_lchild->eval_real(env);
+        double r = RT == INTEGER ? this->_rchild->eval_int(env) : this->_rchild->eval_real(env);
+        return Fn::apply(l, r);
+    }
+
+    virtual Result combine(const Result &l, const Result &r)
+    {
+        Result result;
+        if(LT == INTEGER and RT == INTEGER) {
+            result.i(Fn::apply(l.i(), r.i()));
+        } else {
+            result.r(Fn::apply((double) NUM_RESULT(l), (double) NUM_RESULT(r)));
+        }
+        return result;
+    }
+};
+
+
+//////////////////////////////////////////
+// Superinstructions
+//////////////////////////////////////////
+
+// Fused nodes do the work of a common statement shape in one eval. They
+// keep the children of the statement they replace, so everything but the
+// tree walker sees the original statement. Each counts how often it runs.
+
+// v = v + k or v = v - k, for an integer variable and literal
+class Increment : public Assign
+{
+public:
+    Increment(LexerToken _token, const std::string &name, int step);
+    virtual Result eval(RefEnv &env);
+
+    static long long hits;
+private:
+    const Symbol *_name;
+    int _step;
+};
+
+
+// x = x op y, where y is a variable or a literal
+class CompoundAssign : public Assign
+{
+public:
+    CompoundAssign(LexerToken _token, const std::string &name, ParseTree *operand);
+
+    static long long hits;
+protected:
+    const Symbol *_name;
+    ParseTree *_operand;    // belongs to the right child
+};
+
+
+// The compound assignment for a variable of type VT and operand of type
+// OT. An integer variable only takes an integer operand.
+template <class Fn, ResultType VT, ResultType OT>
+class TypedCompoundAssign : public CompoundAssign
+{
+public:
+    TypedCompoundAssign(LexerToken _token, const std::string &name, ParseTree *operand) 
+        : CompoundAssign(_token, name, operand) { }
+
+    virtual Result eval(RefEnv &env)
+    {
+        hits++;
+        Result &var = env[_name];
+        if(VT == INTEGER) {
+            var.i(Fn::apply(var.i(), _operand->eval_int(env)));
+        } else if(OT == INTEGER) {
+            var.r(Fn::apply(var.r(), (double) _operand->eval_int(env)));
+        } else {
+            var.r(Fn::apply(var.r(), _operand->eval_real(env)));
+        }
+
+        return Result();
+    }
+};
+
+
+// while a = b or while a != b, where a and b are variables or literals
+class CompareLoop : public While
+{
+public:
+    CompareLoop(LexerToken _token, bool equal, ParseTree *l, ParseTree *r);
+
+    static long long hits;
+protected:
+    virtual bool test(RefEnv &env);
+
+private:
+    // an operand is a variable name, or a literal when the name is null
+    struct Operand
+    {
+        const Symbol *name;
+        Result val;
+    };
+    static Operand operand(ParseTree *tree);
+
+    bool _equal;
+    Operand _l;
+    Operand _r;
+};
+
+
+//////////////////////////////////////////
+// Strength Reduced Powers
+//////////////////////////////////////////
+
+// The powers with small literal exponents, as cheaper operations. Integer
+// powers still check for overflow.
+struct SquareFn
+{
+    // one rounding, the same as pow's, and nan keeps its sign
+    static double apply(double x) { return x * x; }
+    static int apply(int x) { return checked_pow(x, 2); }
+};
+
+
+struct CubeFn
+{
+    // x * x * x rounds twice, so reals stay with pow
+    static double apply(double x) { return pow(x, 3.0); }
+    static int apply(int x) { return checked_pow(x, 3); }
+};
+
+
+struct SqrtFn
+{
+    // pow differs from sqrt for -0 and -inf
+    static double apply(double x) { return x > 0 ? sqrt(x) : pow(x, 0.5); }
+};
+
+
+// A power whose exponent is a literal, which only evaluates its base. The
+// base has type LT and the result has type RT. Like TypedArith, it is a
+// Pow to everything except the tree walker.
+template <class Fn, ResultType LT, ResultType RT>
+class LiteralPow : public Pow
+{
+public:
+    LiteralPow(LexerToken _token) : Pow(_token) { }
+
+    virtual Result eval(RefEnv &env)
+    {
+        Result result;
+        if(RT == INTEGER) {
+            result.i(eval_int(env));
+        } else {
+            result.r(eval_real(env));
+        }
+        return result;
+    }
+
+    virtual int eval_int(RefEnv &env)
+    {
+        if(RT == INTEGER) {
+            return Fn::apply(this->_lchild->eval_int(env));
+        }
+        return eval_real(env);
+    }
+
+    virtual double eval_real(RefEnv &env)
+    {
+        if(RT == INTEGER) {
+            return eval_int(env);
+        }
+        double x = LT == INTEGER ? this->_lchild->eval_int(env) : this->_lchild->eval_real(env);
+        return Fn::apply(x);
+    }
+
+    virtual Result combine(const Result &l, const Result &)
+    {
+        Result result;
+        if(RT == INTEGER) {
+            result.i(Fn::apply(l.i()));
+        } else {
+            result.r(Fn::apply((double) NUM_RESULT(l)));
+        }
+        return result;
+    }
+};
+
+
+//////////////////////////////////////////
+// Frame Slots
+//////////////////////////////////////////
+
+// The reads and writes of a call's own variables, at the positions the
+// variables are known to take in the frame's table. They are a Var and an
+// Assign to everything except the tree walker, which skips the lookup.
+class SlotVar : public Var
+{
+public:
+    SlotVar(LexerToken _token, int slot);
+    virtual Result eval(RefEnv &env);
+    virtual int eval_int(RefEnv &env);
+    virtual double eval_real(RefEnv &env);
+private:
+    int _slot;
+};
+
+
+class SlotAssign : public Assign
+{
+public:
+    SlotAssign(LexerToken _token, int slot);
+    virtual Result eval(RefEnv &env);
+private:
+    int _slot;
 };
 #endif
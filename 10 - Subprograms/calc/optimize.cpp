@@ -0,0 +1,735 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <typeinfo>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// move the children of a binary node to its replacement
+static ParseTree *replace(BinaryOp *old, BinaryOp *result)
+{
+    result->left(old->left());
+    result->right(old->right());
+    result->type(old->type());
+
+    // the old node no longer owns its children
+    old->left(nullptr);
+    old->right(nullptr);
+    delete old;
+
+    return result;
+}
+
+
+// create the typed version of an arithmetic operation
+template <class Base, class Fn>
+static BinaryOp *make_typed(LexerToken tok, ResultType l, ResultType r)
+{
+    if(l == INTEGER and r == INTEGER) {
+        return new TypedArith<Base, Fn, INTEGER, INTEGER>(tok);
+    } else if(l == INTEGER) {
+        return new TypedArith<Base, Fn, INTEGER, REAL>(tok);
+    } else if(r == INTEGER) {
+        return new TypedArith<Base, Fn, REAL, INTEGER>(tok);
+    } else {
+        return new TypedArith<Base, Fn, REAL, REAL>(tok);
+    }
+}
+
+
+// true if the tree is a literal with the given value
+static bool is_literal(ParseTree *tree, double value)
+{
+    Number *num = dynamic_cast<Number*>(tree);
+    if(not num) return false;
+
+    Result val = num->value();
+    return NUM_RESULT(val) == value;
+}
+
+
+// is the tree a literal with its sign bit set, such as -0
+static bool is_negative(ParseTree *tree)
+{
+    Number *num = dynamic_cast<Number*>(tree);
+    if(not num) return false;
+
+    Result val = num->value();
+    return std::signbit(NUM_RESULT(val));
+}
+
+
+// create a power of a literal exponent for the base and result types
+template <class Fn>
+static BinaryOp *make_literal_pow(LexerToken tok, ResultType l, ResultType t)
+{
+    if(t == INTEGER) {
+        return new LiteralPow<Fn, INTEGER, INTEGER>(tok);
+    } else if(l == INTEGER) {
+        return new LiteralPow<Fn, INTEGER, REAL>(tok);
+    } else {
+        return new LiteralPow<Fn, REAL, REAL>(tok);
+    }
+}
+
+
+// x^2 and x^3 become multiplication and x^0.5 a square root
+static BinaryOp *reduce_pow(BinaryOp *op, ResultType l, ResultType t)
+{
+    LexerToken tok = op->token();
+    if(is_literal(op->right(), 2)) {
+        return make_literal_pow<SquareFn>(tok, l, t);
+    } else if(is_literal(op->right(), 3)) {
+        return make_literal_pow<CubeFn>(tok, l, t);
+    } else if(is_literal(op->right(), 0.5)) {
+        return make_literal_pow<SqrtFn>(tok, l, t);
+    }
+    return nullptr;
+}
+
+
+// detach one child of a binary node and delete the rest of it
+static ParseTree *keep(BinaryOp *op, ParseTree *child)
+{
+    if(op->left() == child) op->left(nullptr);
+    if(op->right() == child) op->right(nullptr);
+    delete op;
+    return child;
+}
+
+
+//////////////////////////////////////////
+// Pass Utilities
+//////////////////////////////////////////
+
+// build a literal node holding a computed value
+Number *make_number(LexerToken tok, Result val)
+{
+    std::ostringstream os;
+    if(val.type() == INTEGER) {
+        tok.token = INTLIT;
+        os << val.i();
+    } else {
+        tok.token = REALLIT;
+        os << std::setprecision(17) << val.r();
+    }
+    tok.lexeme = os.str();
+
+    return new Number(tok, val);
+}
+
+
+// true if evaluating the tree can have no side effects
+bool is_pure(ParseTree *tree)
+{
+    if(dynamic_cast<Number*>(tree) or dynamic_cast<Var*>(tree)) {
+        return true;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return is_pure(neg->child());
+    } else if(not is_arith(tree)) {
+        return false;
+    } 
+
+    // integer division can fail unless the divisor is a non-zero literal
+    BinaryOp *op = (BinaryOp*) tree;
+    if(dynamic_cast<Div*>(tree) and op->type() != REAL) {
+        Number *num = dynamic_cast<Number*>(op->right());
+        if(not num or is_literal(num, 0)) return false;
+    }
+
+    // integer powers can overflow unless they are literals which fit
+    if(dynamic_cast<Pow*>(tree) and op->type() != REAL) {
+        Number *base = dynamic_cast<Number*>(op->left());
+        Number *exp = dynamic_cast<Number*>(op->right());
+        int result;
+        if(not base or not exp or not int_pow(base->value().i(), exp->value().i(), result)) return false;
+    }
+
+    return is_pure(op->left()) and is_pure(op->right());
+}
+
+
+// true if the tree is arithmetic or comparison on its children
+bool is_arith(ParseTree *tree)
+{
+    return dynamic_cast<Add*>(tree) or dynamic_cast<Sub*>(tree) or
+           dynamic_cast<Mul*>(tree) or dynamic_cast<Div*>(tree) or
+           dynamic_cast<Pow*>(tree) or dynamic_cast<Equal*>(tree) or 
+           dynamic_cast<NotEqual*>(tree);
+}
+
+
+// true if the tree contains a function call
+bool has_call(ParseTree *tree)
+{
+    if(not tree) {
+        return false;
+    } else if(dynamic_cast<FunctionCall*>(tree)) {
+        return true;
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        return has_call(op->child());
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        return has_call(op->left()) or has_call(op->right());
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(int i=0; i<op->size(); i++) {
+            if(has_call(op->child(i))) return true;
+        }
+    }
+
+    // function definitions do not run their bodies
+    return false;
+}
+
+
+// collect the names of the variables read by a tree
+void vars_read(ParseTree *tree, std::set<std::string> &names)
+{
+    if(not tree or dynamic_cast<VarDecl*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        return;
+    } else if(dynamic_cast<Var*>(tree)) {
+        names.insert(tree->token().lexeme);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        vars_read(op->child(), names);
+    } else if(Assign *op = dynamic_cast<Assign*>(tree)) {
+        vars_read(op->right(), names);
+    } else if(FunctionCall *op = dynamic_cast<FunctionCall*>(tree)) {
+        vars_read(op->right(), names);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        vars_read(op->left(), names);
+        vars_read(op->right(), names);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(int i=0; i<op->size(); i++) {
+            vars_read(op->child(i), names);
+        }
+    }
+}
+
+
+// collect the names of the variables assigned or declared in a tree
+void vars_written(ParseTree *tree, std::set<std::string> &names)
+{
+    if(not tree or dynamic_cast<FunctionDef*>(tree)) {
+        return;
+    } else if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        names.insert(decl->child()->token().lexeme);
+    } else if(Assign *op = dynamic_cast<Assign*>(tree)) {
+        names.insert(op->left()->token().lexeme);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        vars_written(op->child(), names);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        vars_written(op->left(), names);
+        vars_written(op->right(), names);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(int i=0; i<op->size(); i++) {
+            vars_written(op->child(i), names);
+        }
+    }
+}
+
+
+// a string which is equal for structurally identical expressions
+std::string tree_key(ParseTree *tree)
+{
+    std::ostringstream os;
+
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        Result val = num->value();
+        os << "#" << RTSTR[val.type()] << ":" << std::setprecision(17) << NUM_RESULT(val);
+    } else if(dynamic_cast<Var*>(tree)) {
+        os << tree->token().lexeme;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        os << "(- " << tree_key(neg->child()) << ")";
+    } else if(is_arith(tree)) {
+        BinaryOp *op = (BinaryOp*) tree;
+        os << "(" << TSTR[tree->token().token] << ":" << RTSTR[tree->type()] << " "
+           << tree_key(op->left()) << " " << tree_key(op->right()) << ")";
+    } else {
+        // other trees are never equal
+        os << "@" << tree;
+    }
+
+    return os.str();
+}
+
+
+// replace the child of a node with another tree
+void replace_child(ParseTree *parent, ParseTree *child, ParseTree *replacement)
+{
+    if(UnaryOp *op = dynamic_cast<UnaryOp*>(parent)) {
+        op->child(replacement);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(parent)) {
+        if(op->left() == child) op->left(replacement);
+        if(op->right() == child) op->right(replacement);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(parent)) {
+        for(int i=0; i<op->size(); i++) {
+            if(op->child(i) == child) op->child(i, replacement);
+        }
+    } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(parent)) {
+        fun->body((Program*) replacement);
+    }
+}
+
+
+// Compiler generated names start with $, which the lexer never produces.
+std::string temp_name(const std::string &prefix)
+{
+    static int counter = 0;
+    std::ostringstream os;
+    os << "$" << prefix << counter++;
+    return os.str();
+}
+
+
+Var *make_var(LexerToken tok, const std::string &name, ResultType type)
+{
+    tok.token = IDENTIFIER;
+    tok.lexeme = name;
+    Var *result = new Var(tok);
+    result->type(type);
+    return result;
+}
+
+
+VarDecl *make_decl(LexerToken tok, const std::string &name, ResultType type)
+{
+    tok.token = type == INTEGER ? INTEGER_DECL : REAL_DECL;
+    tok.lexeme = type == INTEGER ? "integer" : "real";
+    VarDecl *result = new VarDecl(tok);
+    result->child(make_var(tok, name, type));
+    return result;
+}
+
+
+Assign *make_assign(LexerToken tok, const std::string &name, ResultType type, ParseTree *value)
+{
+    tok.token = EQUAL;
+    tok.lexeme = "=";
+    Assign *result = new Assign(tok);
+    result->left(make_var(tok, name, type));
+    result->right(value);
+    return result;
+}
+
+
+// Make a deep copy of a tree, keeping its types. Specialized nodes are
+// copied as their generic base class.
+ParseTree *clone_tree(ParseTree *tree)
+{
+    if(not tree) return nullptr;
+
+    LexerToken tok = tree->token();
+    ParseTree *result;
+
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        result = new Number(tok, num->value());
+    } else if(dynamic_cast<Var*>(tree)) {
+        result = new Var(tok);
+    } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        FunctionDef *copy = new FunctionDef(tok);
+        copy->name(fun->name());
+        copy->return_type(fun->return_type());
+        copy->parameters((ArgList*) clone_tree(fun->parameters()));
+        copy->body((Program*) clone_tree(fun->body()));
+        result = copy;
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        UnaryOp *copy;
+        if(dynamic_cast<Neg*>(tree)) {
+            copy = new Neg(tok);
+        } else if(dynamic_cast<Print*>(tree)) {
+            copy = new Print(tok);
+        } else if(dynamic_cast<VarDecl*>(tree)) {
+            copy = new VarDecl(tok);
+        } else {
+            throw std::runtime_error("Cannot copy " + tok.lexeme);
+        }
+        copy->child(clone_tree(op->child()));
+        result = copy;
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        BinaryOp *copy;
+        if(dynamic_cast<Add*>(tree)) {
+            copy = new Add(tok);
+        } else if(dynamic_cast<Sub*>(tree)) {
+            copy = new Sub(tok);
+        } else if(dynamic_cast<Mul*>(tree)) {
+            copy = new Mul(tok);
+        } else if(dynamic_cast<Div*>(tree)) {
+            copy = new Div(tok);
+        } else if(dynamic_cast<Pow*>(tree)) {
+            copy = new Pow(tok);
+        } else if(dynamic_cast<Assign*>(tree)) {
+            copy = new Assign(tok);
+        } else if(dynamic_cast<While*>(tree)) {
+            copy = new While(tok);
+        } else if(dynamic_cast<Branch*>(tree)) {
+            copy = new Branch(tok);
+        } else if(dynamic_cast<Equal*>(tree)) {
+            copy = new Equal(tok);
+        } else if(dynamic_cast<NotEqual*>(tree)) {
+            copy = new NotEqual(tok);
+        } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+            copy = new FunctionCall(tok);
+            ((FunctionCall*) copy)->tail(call->tail());
+        } else {
+            throw std::runtime_error("Cannot copy " + tok.lexeme);
+        }
+        copy->left(clone_tree(op->left()));
+        copy->right(clone_tree(op->right()));
+        result = copy;
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        NaryOp *copy;
+        if(dynamic_cast<Program*>(tree)) {
+            copy = new Program(tok);
+        } else if(dynamic_cast<ArgList*>(tree)) {
+            copy = new ArgList(tok);
+        } else {
+            throw std::runtime_error("Cannot copy " + tok.lexeme);
+        }
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            copy->push(clone_tree(*itr));
+        }
+        result = copy;
+    } else {
+        throw std::runtime_error("Cannot copy " + tok.lexeme);
+    }
+
+    result->type(tree->type());
+    return result;
+}
+
+
+// true if the expression is pure arithmetic on variables
+bool is_movable(ParseTree *tree)
+{
+    if(not is_arith(tree) or dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        return false;
+    }
+
+    if(tree->type() != INTEGER and tree->type() != REAL) {
+        return false;
+    }
+
+    // literal only expressions are left to the constant folder
+    std::set<std::string> deps;
+    vars_read(tree, deps);
+    return not deps.empty() and is_pure(tree);
+}
+
+
+// Rough relative costs of evaluating a node in the tree walker.
+static const int NUM_COST = 1;
+static const int OP_COST = 1;
+static const int DIV_COST = 2;
+static const int POW_COST = 8;
+
+
+// estimate the cost of evaluating a pure expression
+int tree_cost(ParseTree *tree)
+{
+    if(dynamic_cast<Var*>(tree)) {
+        return VAR_COST;
+    } else if(dynamic_cast<Number*>(tree)) {
+        return NUM_COST;
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return OP_COST + tree_cost(neg->child());
+    }
+
+    BinaryOp *op = (BinaryOp*) tree;
+    int result = tree_cost(op->left()) + tree_cost(op->right());
+    if(dynamic_cast<Pow*>(tree)) {
+        result += POW_COST;
+    } else if(dynamic_cast<Div*>(tree)) {
+        result += DIV_COST;
+    } else {
+        result += OP_COST;
+    }
+
+    return result;
+}
+
+
+//////////////////////////////////////////
+// TreePass Implementation
+//////////////////////////////////////////
+
+// constructor and destructor
+TreePass::TreePass()
+{
+    _count = 0;
+}
+
+
+TreePass::~TreePass()
+{
+    // nothing to do
+}
+
+
+// run the pass over a tree, returning the (possibly new) root
+ParseTree *TreePass::run(ParseTree *tree)
+{
+    if(not tree) return tree;
+
+    // visit the children first
+    if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        op->child(run(op->child()));
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        op->left(run(op->left()));
+        op->right(run(op->right()));
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(int i=0; i<op->size(); i++) {
+            op->child(i, run(op->child(i)));
+        }
+    } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        fun->body((Program*) run(fun->body()));
+    }
+
+    return rewrite(tree);
+}
+
+
+// the number of nodes the pass has changed
+int TreePass::count() const
+{
+    return _count;
+}
+
+
+//////////////////////////////////////////
+// Specializer Implementation
+//////////////////////////////////////////
+
+Specializer::Specializer()
+{
+    _reduced = 0;
+}
+
+
+// the number of powers replaced by cheaper operations
+int Specializer::reduced() const
+{
+    return _reduced;
+}
+
+
+ParseTree *Specializer::rewrite(ParseTree *tree)
+{
+    BinaryOp *op = dynamic_cast<BinaryOp*>(tree);
+    if(not op) return tree;
+
+    // only numeric operands can be specialized
+    ResultType l = op->left() ? op->left()->type() : VOID;
+    ResultType r = op->right() ? op->right()->type() : VOID;
+    if((l != INTEGER and l != REAL) or (r != INTEGER and r != REAL)) {
+        return tree;
+    }
+
+    // Select the typed node. The typeid comparison leaves nodes which
+    // are already specialized alone.
+    const std::type_info &t = typeid(*tree);
+    LexerToken tok = tree->token();
+    BinaryOp *result;
+    if(t == typeid(Add)) {
+        result = make_typed<Add, AddFn>(tok, l, r);
+    } else if(t == typeid(Sub)) {
+        result = make_typed<Sub, SubFn>(tok, l, r);
+    } else if(t == typeid(Mul)) {
+        result = make_typed<Mul, MulFn>(tok, l, r);
+    } else if(t == typeid(Div)) {
+        result = make_typed<Div, DivFn>(tok, l, r);
+    } else if(t == typeid(Pow) and (result = reduce_pow(op, l, op->type()))) {
+        _reduced++;
+    } else if(t == typeid(Pow)) {
+        result = make_typed<Pow, PowFn>(tok, l, r);
+    } else {
+        return tree;
+    }
+
+    _count++;
+    return replace(op, result);
+}
+
+
+//////////////////////////////////////////
+// TailCalls Implementation
+//////////////////////////////////////////
+
+// true if the tree is a call of the function itself
+static bool is_self_call(ParseTree *tree, FunctionDef *fun)
+{
+    return dynamic_cast<FunctionCall*>(tree) and ((FunctionCall*) tree)->left()->token().lexeme == fun->name();
+}
+
+
+ParseTree *TailCalls::rewrite(ParseTree *tree)
+{
+    FunctionDef *fun = dynamic_cast<FunctionDef*>(tree);
+    if(not fun or fun->body()->size() == 0) return tree;
+
+    // the body ends with a call, maybe at the end of if statements
+    Program *body = fun->body();
+    ParseTree *last = body->child(body->size() - 1);
+    if(is_self_call(last, fun) or dynamic_cast<Branch*>(last)) {
+        mark(fun, last, "");
+        return tree;
+    }
+
+    // the body ends by returning a local of the return type
+    if(not dynamic_cast<Var*>(last) or last->type() != fun->return_type() or body->size() < 2) {
+        return tree;
+    }
+    std::string result = last->token().lexeme;
+    bool local = false;
+    for(auto itr = fun->parameters()->begin(); itr != fun->parameters()->end(); itr++) {
+        local = local or ((VarDecl*) *itr)->child()->token().lexeme == result;
+    }
+    for(auto itr = body->begin(); itr != body->end(); itr++) {
+        VarDecl *decl = dynamic_cast<VarDecl*>(*itr);
+        local = local or (decl and decl->child()->token().lexeme == result);
+    }
+
+    if(local) {
+        mark(fun, body->child(body->size() - 2), result);
+    }
+    return tree;
+}
+
+
+// Mark a call in tail position. With a result variable the call must
+// assign it, without one the call is the statement.
+void TailCalls::mark(FunctionDef *fun, ParseTree *stmt, const std::string &result)
+{
+    if(result.empty() and is_self_call(stmt, fun)) {
+        ((FunctionCall*) stmt)->tail(true);
+        _count++;
+    } else if(Assign *assign = dynamic_cast<Assign*>(stmt)) {
+        if(assign->left()->token().lexeme == result and is_self_call(assign->right(), fun)) {
+            ((FunctionCall*) assign->right())->tail(true);
+            _count++;
+        }
+    } else if(Branch *branch = dynamic_cast<Branch*>(stmt)) {
+        Program *block = (Program*) branch->right();
+        if(block->size() > 0) {
+            mark(fun, block->child(block->size() - 1), result);
+        }
+    }
+}
+
+
+//////////////////////////////////////////
+// ConstantFolder Implementation
+//////////////////////////////////////////
+
+// Literals are computed from their values alone, without an environment,
+// since the optimizing tier folds on its own thread.
+ParseTree *ConstantFolder::rewrite(ParseTree *tree)
+{
+    // negation of literals and double negation
+    if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        if(Number *num = dynamic_cast<Number*>(neg->child())) {
+            _count++;
+            Result val = num->value();
+            if(val.type() == INTEGER) {
+                val.i(NegFn::apply(val.i()));
+            } else {
+                val.r(NegFn::apply(val.r()));
+            }
+            Number *result = make_number(tree->token(), val);
+            delete neg;
+            return result;
+        } else if(Neg *inner = dynamic_cast<Neg*>(neg->child())) {
+            _count++;
+            ParseTree *result = inner->child();
+            inner->child(nullptr);
+            delete neg;
+            return result;
+        }
+        return tree;
+    }
+
+    if(not is_arith(tree)) return tree;
+    BinaryOp *op = (BinaryOp*) tree;
+    Number *l = dynamic_cast<Number*>(op->left());
+    Number *r = dynamic_cast<Number*>(op->right());
+
+    // operations with non-literal operands can only be simplified
+    if(not l or not r) {
+        return simplify(op);
+    }
+
+    // leave integer division by zero to fail at runtime
+    if(dynamic_cast<Div*>(tree) and l->type() == INTEGER and 
+       r->type() == INTEGER and is_literal(r, 0)) {
+        return tree;
+    }
+
+    // likewise an integer power which overflows
+    Result val;
+    try {
+        val = op->combine(l->value(), r->value());
+    } catch(std::runtime_error &e) {
+        return tree;
+    }
+
+    _count++;
+    Number *result = make_number(tree->token(), val);
+    delete op;
+    return result;
+}
+
+
+// apply algebraic identities to an arithmetic node
+ParseTree *ConstantFolder::simplify(BinaryOp *op)
+{
+    ParseTree *l = op->left();
+    ParseTree *r = op->right();
+    ResultType t = op->type();
+
+    // identities may only drop an operand with the result's type
+    if(t != INTEGER and t != REAL) return op;
+    bool keep_l = l->type() == t;
+    bool keep_r = r->type() == t;
+
+    ParseTree *result = nullptr;
+    if(dynamic_cast<Add*>(op)) {
+        // x + 0 and 0 + x for integers (reals have -0 + 0 = 0)
+        if(t == INTEGER and is_literal(r, 0)) result = l;
+        else if(t == INTEGER and is_literal(l, 0)) result = r;
+    } else if(dynamic_cast<Sub*>(op)) {
+        // x - 0, but not x - -0 which is x + 0
+        if(keep_l and is_literal(r, 0) and not is_negative(r)) result = l;
+    } else if(dynamic_cast<Mul*>(op)) {
+        // x * 1 and 1 * x
+        if(keep_l and is_literal(r, 1)) result = l;
+        else if(keep_r and is_literal(l, 1)) result = r;
+
+        // x * 0 and 0 * x for integers (reals have inf*0 = nan)
+        else if(t == INTEGER and is_literal(r, 0) and is_pure(l)) result = r;
+        else if(t == INTEGER and is_literal(l, 0) and is_pure(r)) result = l;
+    } else if(dynamic_cast<Div*>(op)) {
+        // x / 1
+        if(keep_l and is_literal(r, 1)) result = l;
+    } else if(dynamic_cast<Pow*>(op)) {
+        // x ^ 1 
+        if(keep_l and is_literal(r, 1)) result = l;
+
+        // x ^ 0 is 1, even for 0 and nan
+        else if(is_literal(r, 0) and is_pure(l)) {
+            Result one;
+            one.type(t);
+            NUM_ASSIGN(one, 1);
+            _count++;
+            Number *num = make_number(op->token(), one);
+            delete op;
+            return num;
+        }
+    }
+
+    if(not result) return op;
+
+    _count++;
+    return keep(op, result);
+}
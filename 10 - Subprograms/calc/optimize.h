@@ -0,0 +1,340 @@
+// This file contains the optimization passes which rewrite type checked
+// calc parse trees before they are evaluated.
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+#include "op.h"
+
+
+//////////////////////////////////////////
+// Base Class
+//////////////////////////////////////////
+
+// A pass which rewrites a parse tree from the bottom up
+class TreePass
+{
+public:
+    // constructor and destructor
+    TreePass();
+    virtual ~TreePass();
+
+    // run the pass over a tree, returning the (possibly new) root
+    virtual ParseTree *run(ParseTree *tree);
+
+    // the number of nodes the pass has changed
+    virtual int count() const;
+
+protected:
+    // rewrite a node whose children have already been visited
+    virtual ParseTree *rewrite(ParseTree *tree)=0;
+
+    int _count;
+};
+
+
+//////////////////////////////////////////
+// Passes
+//////////////////////////////////////////
+
+// Replace generic arithmetic with the TypedArith version for the
+// operand types found by the type checker. Powers with a literal exponent
+// of 2, 3 or 0.5 become a LiteralPow instead.
+class Specializer : public TreePass
+{
+public:
+    Specializer();
+
+    // the number of powers replaced by cheaper operations
+    virtual int reduced() const;
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    int _reduced;
+};
+
+
+// Mark the recursive calls which are the last thing a function does, so
+// they reuse the running call instead of nesting. A call is in tail
+// position when it is the body's last statement, or when it is assigned
+// to the local which the body ends by returning, with nothing but the
+// ends of if statements in between. Every engine runs the calls this
+// marks, and only those, in constant space.
+class TailCalls : public TreePass
+{
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // Mark a call in tail position. With a result variable the call must
+    // assign it, without one the call is the statement.
+    virtual void mark(FunctionDef *fun, ParseTree *stmt, const std::string &result);
+};
+
+
+// Fold operations on literals into a single Number and apply algebraic
+// identities (x+0, x*1, x^1, ...) which do not change the result's type.
+class ConstantFolder : public TreePass
+{
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // apply algebraic identities to an arithmetic node
+    virtual ParseTree *simplify(BinaryOp *op);
+};
+
+
+// Evaluate repeated pure subexpressions once into a compiler generated
+// temporary. Candidates stay available until a statement assigns one of
+// their variables or calls a function (which might write a global).
+class CommonSubexpressions : public TreePass
+{
+public:
+    virtual ParseTree *run(ParseTree *tree);
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // eliminate subexpressions in a block, declaring temporaries in scope
+    virtual void run_block(Program *block, Program *scope);
+
+    // find and replace the most profitable repeated subexpression
+    virtual bool eliminate_one(Program *block, Program *scope);
+};
+
+
+// Hoist pure expressions which do not depend on anything a while loop
+// assigns out of the loop, into temporaries computed before it starts.
+// Loops containing function calls are left alone.
+class LoopInvariantMotion : public TreePass
+{
+public:
+    virtual ParseTree *run(ParseTree *tree);
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // hoist the invariants of the loops in a block
+    virtual void run_block(Program *block, Program *scope);
+
+    // hoist the invariants of one loop
+    virtual void hoist(While *loop, Program *block, Program *scope);
+};
+
+
+// Substitute the bodies of small functions at their call sites. A callee
+// is inlined when its body makes no calls, does not print and writes only
+// its own locals, so running it just before the calling statement cannot
+// be observed. Its locals are renamed into temporaries declared at the
+// top of the caller's scope.
+class Inliner : public TreePass
+{
+public:
+    // callees larger than max_size nodes are left alone
+    Inliner(int max_size=40);
+
+    virtual ParseTree *run(ParseTree *tree);
+
+    // the inlined call sites, as "name (line n)"
+    virtual const std::vector<std::string> &report() const;
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // inline the calls in a block, declaring temporaries in scope
+    virtual void run_block(Program *block, Program *scope);
+
+    // inline the calls in an expression of the i'th statement of a block,
+    // returning the number of statements added before it
+    virtual int inline_stmt(Program *block, int i, ParseTree *parent, ParseTree *expr);
+
+    // true if a function can be substituted at its call sites
+    virtual bool can_inline(FunctionDef *fun);
+
+    // find the function a call refers to, nullptr if it is not known
+    virtual FunctionDef *resolve(const std::string &name);
+
+    int _max_size;
+    std::map<FunctionDef*, bool> _verdict;
+    std::vector<std::map<std::string, FunctionDef*> > _scopes;
+    std::vector<VarDecl*> _decls;
+    std::vector<std::string> _report;
+};
+
+
+// Give memo tables to pure functions: those whose integer arguments are
+// all they read, which write nothing outside themselves, do not print and
+// only call other pure functions.
+class Memoizer : public TreePass
+{
+public:
+    virtual ParseTree *run(ParseTree *tree);
+
+    // the names of the memoized functions
+    virtual const std::vector<std::string> &report() const;
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // find the functions in a block, which is a scope if root is set
+    virtual void run_block(Program *block, bool root);
+
+    // the purity analysis
+    virtual bool pure_function(FunctionDef *fun);
+    virtual bool pure_tree(ParseTree *tree);
+
+    // find the function a call refers to, nullptr if it is not known
+    virtual FunctionDef *resolve(const std::string &name);
+
+    std::map<FunctionDef*, bool> _verdict;
+    std::vector<std::map<std::string, FunctionDef*> > _scopes;
+    std::vector<std::string> _report;
+};
+
+
+// Remove what a whole program can never use: functions which no call
+// reachable from the top level names, assignments to variables which
+// are never read when the value has no side effects, declarations of
+// variables nothing mentions, and loops and branches whose condition is
+// a literal zero. A branch whose condition is a literal non-zero is
+// replaced by its body. The last statement of a function body is its
+// value, so it is always kept.
+class DeadCodeEliminator : public TreePass
+{
+public:
+    DeadCodeEliminator();
+
+    virtual ParseTree *run(ParseTree *tree);
+
+    // the number of each kind of statement removed
+    virtual int functions() const;
+    virtual int stores() const;
+    virtual int decls() const;
+    virtual int branches() const;
+
+    // the approximate size of the removed trees
+    virtual long long bytes() const;
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // remove the dead statements of a block, and the blocks inside it.
+    // If value is set, the last statement is the block's value.
+    virtual bool run_block(Program *block, bool value);
+
+    // the names of the functions reachable from the top level
+    virtual void find_live(Program *program);
+
+    // delete a removed statement, counting its size
+    virtual void discard(ParseTree *tree);
+
+    std::set<std::string> _live;        // reachable function names
+    std::set<std::string> _read;        // variables read anywhere
+    std::set<std::string> _used;        // variables mentioned anywhere
+    int _functions;
+    int _stores;
+    int _decls;
+    int _branches;
+    long long _bytes;
+};
+
+
+// Replace common statement shapes with fused nodes: integer increments,
+// compound assignments with a simple operand and loops which compare two
+// simple operands. This runs last, on specialized trees.
+class Superinstructions : public TreePass
+{
+public:
+    Superinstructions();
+
+    // the number of each kind of node created
+    virtual int increments() const;
+    virtual int compounds() const;
+    virtual int compare_loops() const;
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // try each pattern, nullptr if the node does not match
+    virtual ParseTree *fuse_increment(Assign *assign);
+    virtual ParseTree *fuse_compound(Assign *assign);
+    virtual ParseTree *fuse_loop(While *loop);
+
+    int _increments;
+    int _compounds;
+    int _compare_loops;
+};
+
+
+// Resolve the variables of a function body to their positions in the
+// call's frame. A call declares its parameters and then the body's top
+// level declarations in order, into a table sized for the body, so each
+// of them always lands in the same position. A loop or branch may skip
+// its declarations, which leaves the names after it to be looked up. Reads
+// and assignments after a variable's declaration become a SlotVar and
+// SlotAssign, and functions nested in the body are resolved for their
+// own frames. This runs on specialized trees, before Superinstructions.
+class SlotResolver : public TreePass
+{
+public:
+    // resolve a body of the function, which need not be installed yet
+    virtual void resolve(FunctionDef *fun, Program *body);
+
+    // visit everything but nested functions, declarations and callees
+    virtual ParseTree *run(ParseTree *tree);
+
+protected:
+    virtual ParseTree *rewrite(ParseTree *tree);
+
+    // the positions of the variables visible to the statement being visited
+    std::map<const Symbol*, int> _slots;
+};
+
+
+//////////////////////////////////////////
+// Pass Utilities
+//////////////////////////////////////////
+
+// build a literal node holding a computed value
+Number *make_number(LexerToken tok, Result val);
+
+// true if evaluating the tree can have no side effects
+bool is_pure(ParseTree *tree);
+
+// true if the tree is arithmetic or comparison on its children
+bool is_arith(ParseTree *tree);
+
+// true if the expression is pure arithmetic on variables
+bool is_movable(ParseTree *tree);
+
+// Estimate the cost of evaluating a pure expression. Variable access is a
+// scope lookup, so small expressions are not worth a temporary.
+const int VAR_COST = 3;
+int tree_cost(ParseTree *tree);
+
+// true if the tree contains a function call
+bool has_call(ParseTree *tree);
+
+// collect the names of the variables read by a tree
+void vars_read(ParseTree *tree, std::set<std::string> &names);
+
+// collect the names of the variables assigned or declared in a tree
+void vars_written(ParseTree *tree, std::set<std::string> &names);
+
+// a string which is equal for structurally identical expressions
+std::string tree_key(ParseTree *tree);
+
+// replace the child of a node with another tree
+void replace_child(ParseTree *parent, ParseTree *child, ParseTree *replacement);
+
+// build nodes for compiler generated variables
+std::string temp_name(const std::string &prefix);
+Var *make_var(LexerToken tok, const std::string &name, ResultType type);
+VarDecl *make_decl(LexerToken tok, const std::string &name, ResultType type);
+Assign *make_assign(LexerToken tok, const std::string &name, ResultType type, ParseTree *value);
+
+// make a deep copy of a tree, keeping its types
+ParseTree *clone_tree(ParseTree *tree);
+#endif
@@ -0,0 +1,133 @@
+// Purity analysis, which finds the calc functions worth memoizing.
+#include "memo.h"
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Memoizer Implementation
+//////////////////////////////////////////
+
+ParseTree *Memoizer::run(ParseTree *tree)
+{
+    if(Program *program = dynamic_cast<Program*>(tree)) {
+        _scopes.push_back(std::map<std::string, FunctionDef*>());
+        run_block(program, true);
+        _scopes.pop_back();
+    }
+    return tree;
+}
+
+
+ParseTree *Memoizer::rewrite(ParseTree *tree)
+{
+    // the pass works on whole blocks in run_block
+    return tree;
+}
+
+
+// the memoized functions
+const std::vector<std::string> &Memoizer::report() const
+{
+    return _report;
+}
+
+
+// find the functions in a block, which is a scope if root is set
+void Memoizer::run_block(Program *block, bool root)
+{
+    for(auto itr = block->begin(); itr != block->end(); itr++) {
+        if(FunctionDef *fun = dynamic_cast<FunctionDef*>(*itr)) {
+            // only unconditional definitions are known to exist later
+            if(root) {
+                _scopes.back()[fun->name()] = fun;
+            }
+            if(pure_function(fun)) {
+                fun->memo(new Memo(fun->parameters()->size()));
+                _report.push_back(fun->name());
+                _count++;
+            }
+
+            _scopes.push_back(std::map<std::string, FunctionDef*>());
+            run_block(fun->body(), true);
+            _scopes.pop_back();
+        } else if(dynamic_cast<While*>(*itr) or dynamic_cast<Branch*>(*itr)) {
+            run_block((Program*) ((BinaryOp*) *itr)->right(), false);
+        }
+    }
+}
+
+
+// True if a function's result depends only on its integer arguments and
+// calling it has no effects. A function being checked is assumed to be
+// pure, which allows recursion.
+bool Memoizer::pure_function(FunctionDef *fun)
+{
+    auto itr = _verdict.find(fun);
+    if(itr != _verdict.end()) return itr->second;
+    _verdict[fun] = true;
+
+    bool ok = fun->return_type() != VOID and fun->parameters()->size() <= Memo::MAX_ARGS;
+
+    // the locals are the parameters and the declarations at the top level
+    std::set<std::string> locals;
+    for(auto p = fun->parameters()->begin(); ok and p != fun->parameters()->end(); p++) {
+        ParseTree *param = ((VarDecl*) *p)->child();
+        ok = param->type() == INTEGER;
+        locals.insert(param->token().lexeme);
+    }
+    Program *body = fun->body();
+    for(auto s = body->begin(); s != body->end(); s++) {
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*s)) {
+            locals.insert(decl->child()->token().lexeme);
+        }
+    }
+
+    // nothing outside the function is read or written
+    std::set<std::string> used;
+    vars_read(body, used);
+    vars_written(body, used);
+    for(auto name = used.begin(); ok and name != used.end(); name++) {
+        ok = locals.count(*name) > 0;
+    }
+
+    // every statement is free of effects, and so is everything it calls
+    for(auto s = body->begin(); ok and s != body->end(); s++) {
+        ok = pure_tree(*s);
+    }
+
+    _verdict[fun] = ok;
+    return ok;
+}
+
+
+// true if a tree has no prints, definitions or impure calls
+bool Memoizer::pure_tree(ParseTree *tree)
+{
+    if(not tree) {
+        return true;
+    } else if(dynamic_cast<Print*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        return false;
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        FunctionDef *callee = resolve(call->left()->token().lexeme);
+        return callee and pure_function(callee) and pure_tree(call->right());
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        return pure_tree(op->child());
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        return pure_tree(op->left()) and pure_tree(op->right());
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            if(not pure_tree(*itr)) return false;
+        }
+    }
+    return true;
+}
+
+
+// find the function a call refers to, nullptr if it is not known
+FunctionDef *Memoizer::resolve(const std::string &name)
+{
+    for(auto scope = _scopes.rbegin(); scope != _scopes.rend(); scope++) {
+        auto itr = scope->find(name);
+        if(itr != scope->end()) return itr->second;
+    }
+    return nullptr;
+}
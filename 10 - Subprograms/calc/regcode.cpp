@@ -0,0 +1,595 @@
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include "regcode.h"
+#include "optimize.h"
+
+// convert opcodes to strings
+const char* RGSTR[] = {
+    "HALT",
+    "LOADK_I",
+    "LOADK_R",
+    "MOVE",
+    "GET_G",
+    "SET_G",
+    "GET_UP",
+    "SET_UP",
+    "ADD_I",
+    "ADD_R",
+    "SUB_I",
+    "SUB_R",
+    "MUL_I",
+    "MUL_R",
+    "DIV_I",
+    "DIV_R",
+    "POW_I",
+    "POW_R",
+    "NEG_I",
+    "NEG_R",
+    "I2R",
+    "R2I",
+    "EQ_I",
+    "EQ_R",
+    "NE_I",
+    "NE_R",
+    "JMP",
+    "JZ",
+    "JEQ_I",
+    "JEQ_R",
+    "JNE_I",
+    "JNE_R",
+    "CALL",
+    "TAILCALL",
+    "RET",
+    "PRINT_I",
+    "PRINT_R"
+};
+
+
+// the number of operands of each instruction
+int rg_operands(int op)
+{
+    switch(op) {
+        case RG_HALT:
+            return 0;
+        case RG_JMP:
+        case RG_RET:
+        case RG_PRINT_I:
+        case RG_PRINT_R:
+            return 1;
+        case RG_LOADK_I:
+        case RG_LOADK_R:
+        case RG_MOVE:
+        case RG_GET_G:
+        case RG_SET_G:
+        case RG_NEG_I:
+        case RG_NEG_R:
+        case RG_I2R:
+        case RG_R2I:
+        case RG_JZ:
+        case RG_TAILCALL:
+            return 2;
+        case RG_CALL:
+            return 4;
+        default:
+            return 3;
+    }
+}
+
+
+// count the variables declared in a function body, including its loops
+static int count_decls(Program *block)
+{
+    int n = 0;
+    for(int i=0; i<block->size(); i++) {
+        ParseTree *stmt = block->child(i);
+        if(dynamic_cast<VarDecl*>(stmt)) {
+            n++;
+        } else if(dynamic_cast<While*>(stmt) or dynamic_cast<Branch*>(stmt)) {
+            n += count_decls((Program*) ((BinaryOp*) stmt)->right());
+        }
+    }
+    return n;
+}
+
+
+//////////////////////////////////////////
+// RegisterCode Implementation
+//////////////////////////////////////////
+
+// print a readable listing of the program
+void RegisterCode::disassemble(std::ostream &os) const
+{
+    for(int f=0; f<(int) functions.size(); f++) {
+        const RegisterFunction &fun = functions[f];
+        int end = f+1 < (int) functions.size() ? functions[f+1].entry : code.size();
+
+        os << "function " << f << " " << fun.name
+           << " (params: " << fun.nparams
+           << ", slots: " << fun.nslots
+           << ", registers: " << fun.nregs << ")" << std::endl;
+
+        for(int pc = fun.entry; pc < end; pc += 1 + rg_operands(code[pc])) {
+            os << std::setw(6) << pc << "  " << RGSTR[code[pc]];
+            for(int i=1; i<=rg_operands(code[pc]); i++) {
+                os << " " << code[pc+i];
+            }
+            if(code[pc] == RG_LOADK_R) {
+                os << "  (" << reals[code[pc+2]] << ")";
+            }
+            os << std::endl;
+        }
+    }
+}
+
+
+//////////////////////////////////////////
+// RegisterCompiler Implementation
+//////////////////////////////////////////
+
+// compile a type checked program
+RegisterCode *RegisterCompiler::compile(ParseTree *program)
+{
+    std::vector<Scope*> scopes;
+    _rc = new RegisterCode();
+    _pending.clear();
+
+    // the top level program is function 0
+    RegisterFunction main;
+    main.name = "<main>";
+    _rc->functions.push_back(main);
+    _pending.push_back(Pending{0, nullptr, nullptr});
+
+    // Compile the functions one after another. Their scopes stay alive
+    // until the end because nested functions refer to them.
+    for(int i=0; i<(int) _pending.size(); i++) {
+        Pending p = _pending[i];
+        _scope = new Scope();
+        _scope->parent = p.scope;
+        _scope->depth = p.scope ? p.scope->depth + 1 : 0;
+        _scope->fid = p.fid;
+        scopes.push_back(_scope);
+
+        if(p.fun) {
+            compile_function(p.fid, p.fun->body(), p.fun->return_type());
+        } else {
+            compile_function(p.fid, (Program*) program, VOID);
+        }
+    }
+
+    for(auto itr = scopes.begin(); itr != scopes.end(); itr++) {
+        delete *itr;
+    }
+
+    return _rc;
+}
+
+
+// compile a function body in a new scope
+void RegisterCompiler::compile_function(int fid, Program *body, ResultType return_type)
+{
+    _rc->functions[fid].entry = here();
+    _next_slot = 0;
+
+    // parameters come first in the window
+    if(fid != 0) {
+        ArgList *params = _pending[fid].fun->parameters();
+        for(auto itr = params->begin(); itr != params->end(); itr++) {
+            VarDecl *decl = (VarDecl*) *itr;
+            declare(decl->child()->token().lexeme, decl->child()->type(), _next_slot++);
+        }
+    }
+    _rc->functions[fid].nparams = _next_slot;
+
+    // temporaries go above all of the variables
+    _next_temp = _max_temp = _next_slot + count_decls(body);
+    _rc->functions[fid].nslots = _next_temp;
+
+    // the body's last statement is the return value
+    int result = compile_block(body, return_type != VOID);
+    if(fid == 0) {
+        emit(RG_HALT);
+    } else if(return_type == VOID) {
+        result = alloc();
+        emit(RG_LOADK_I, result, 0);
+        emit(RG_RET, result);
+    } else {
+        ParseTree *last = body->size() ? body->child(body->size()-1) : nullptr;
+        ResultType type = last ? last->type() : VOID;
+        if(type == INTEGER and return_type == REAL) {
+            int t = alloc();
+            emit(RG_I2R, t, result);
+            result = t;
+        } else if(type == REAL and return_type == INTEGER) {
+            int t = alloc();
+            emit(RG_R2I, t, result);
+            result = t;
+        }
+        emit(RG_RET, result);
+    }
+
+    _rc->functions[fid].nregs = _max_temp;
+}
+
+
+// compile a block, returning the register of its value if wanted
+int RegisterCompiler::compile_block(Program *block, bool want_value)
+{
+    // functions may be called before their definition runs
+    for(int i=0; i<block->size(); i++) {
+        FunctionDef *fun = dynamic_cast<FunctionDef*>(block->child(i));
+        if(not fun) continue;
+
+        int fid = _rc->functions.size();
+        RegisterFunction code;
+        code.name = fun->name();
+        _rc->functions.push_back(code);
+        _pending.push_back(Pending{fid, fun, _scope});
+        declare(fun->name(), FUNCTION_TYPE, fid);
+    }
+
+    int result = -1;
+    for(int i=0; i<block->size(); i++) {
+        result = compile(block->child(i), want_value and i == block->size()-1);
+    }
+
+    if(want_value and block->size() == 0) {
+        result = alloc();
+        emit(RG_LOADK_I, result, 0);
+    }
+
+    return result;
+}
+
+
+// compile a statement, returning the register of its value if wanted
+int RegisterCompiler::compile(ParseTree *tree, bool want_value)
+{
+    int mark = _next_temp;
+
+    if(Print *print = dynamic_cast<Print*>(tree)) {
+        int a = compile_expr(print->child());
+        emit(print->child()->type() == INTEGER ? RG_PRINT_I : RG_PRINT_R, a);
+    } else if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        // registers are zeroed when the window is created
+        declare(decl->child()->token().lexeme, decl->child()->type(), _next_slot++);
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        compile_store(assign->left()->token().lexeme, assign->right());
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        int top = here();
+        int exit = compile_exit(loop->left());
+        compile_block((Program*) loop->right(), false);
+        emit(RG_JMP, top);
+        _rc->code[exit] = here();
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        int exit = compile_exit(branch->left());
+        compile_block((Program*) branch->right(), false);
+        _rc->code[exit] = here();
+    } else if(dynamic_cast<FunctionDef*>(tree)) {
+        // compiled on its own after the enclosing function
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        return compile_block(block, want_value);
+    } else {
+        // an expression statement
+        int result = compile_expr(tree);
+        if(want_value) {
+            return result;
+        }
+    }
+    release(mark);
+
+    // statements have no value
+    if(want_value) {
+        int result = alloc();
+        emit(RG_LOADK_I, result, 0);
+        return result;
+    }
+    return -1;
+}
+
+
+// compile a loop or branch condition, returning the jump to patch
+int RegisterCompiler::compile_exit(ParseTree *cond)
+{
+    int mark = _next_temp;
+    BinaryOp *op = dynamic_cast<BinaryOp*>(cond);
+
+    if(dynamic_cast<Equal*>(cond) or dynamic_cast<NotEqual*>(cond)) {
+        // compare and branch in one instruction
+        bool r = op->left()->type() == REAL or op->right()->type() == REAL;
+        int a, b;
+        compile_operands(op, r ? REAL : INTEGER, a, b);
+        if(dynamic_cast<Equal*>(cond)) {
+            emit(r ? RG_JNE_R : RG_JNE_I, a, b, 0);
+        } else {
+            emit(r ? RG_JEQ_R : RG_JEQ_I, a, b, 0);
+        }
+    } else {
+        emit(RG_JZ, compile_as(cond, INTEGER), 0);
+    }
+
+    release(mark);
+    return here() - 1;
+}
+
+
+// compile an expression, returning the register which holds it
+int RegisterCompiler::compile_expr(ParseTree *tree)
+{
+    // local variables are used where they are
+    if(dynamic_cast<Var*>(tree)) {
+        Symbol sym = lookup(tree->token().lexeme);
+        if(sym.type != FUNCTION_TYPE and is_local(sym)) {
+            return sym.slot;
+        }
+    }
+
+    int result = alloc();
+    compile_into(tree, result);
+    return result;
+}
+
+
+// compile an expression converted to the given type
+int RegisterCompiler::compile_as(ParseTree *tree, ResultType type)
+{
+    if(tree->type() == type) {
+        return compile_expr(tree);
+    }
+
+    int result = alloc();
+    compile_into_as(tree, type, result);
+    return result;
+}
+
+
+// compile an expression into a particular register
+void RegisterCompiler::compile_into(ParseTree *tree, int dst)
+{
+    int mark = _next_temp;
+
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        Result val = num->value();
+        if(val.type() == INTEGER) {
+            emit(RG_LOADK_I, dst, val.i());
+        } else {
+            _rc->reals.push_back(val.r());
+            emit(RG_LOADK_R, dst, _rc->reals.size() - 1);
+        }
+    } else if(dynamic_cast<Var*>(tree)) {
+        Symbol sym = lookup(tree->token().lexeme);
+        if(sym.type == FUNCTION_TYPE) {
+            // function values are only ever discarded
+            emit(RG_LOADK_I, dst, 0);
+        } else if(is_local(sym)) {
+            if(sym.slot != dst) {
+                emit(RG_MOVE, dst, sym.slot);
+            }
+        } else if(sym.depth == 0) {
+            emit(RG_GET_G, dst, sym.slot);
+        } else {
+            emit(RG_GET_UP, dst, _scope->depth - sym.depth, sym.slot);
+        }
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        int a = compile_expr(neg->child());
+        emit(neg->child()->type() == INTEGER ? RG_NEG_I : RG_NEG_R, dst, a);
+    } else if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        compile_compare((BinaryOp*) tree, dst);
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        compile_call(call, dst);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        compile_arith(op, dst);
+    } else {
+        throw std::runtime_error("Cannot compile " + tree->token().lexeme);
+    }
+
+    release(mark);
+}
+
+
+void RegisterCompiler::compile_into_as(ParseTree *tree, ResultType type, int dst)
+{
+    ResultType from = tree->type();
+    if(from == type or (from != INTEGER and from != REAL)) {
+        compile_into(tree, dst);
+        return;
+    }
+
+    // literals are converted as they are loaded
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        Result val = num->value();
+        if(type == INTEGER) {
+            emit(RG_LOADK_I, dst, (int) val.r());
+        } else {
+            _rc->reals.push_back(val.i());
+            emit(RG_LOADK_R, dst, _rc->reals.size() - 1);
+        }
+        return;
+    }
+
+    int mark = _next_temp;
+    int a = compile_expr(tree);
+    emit(from == INTEGER ? RG_I2R : RG_R2I, dst, a);
+    release(mark);
+}
+
+
+// arithmetic is done in the type of the result
+void RegisterCompiler::compile_arith(BinaryOp *op, int dst)
+{
+    ResultType t = op->type();
+    int a, b;
+    compile_operands(op, t, a, b);
+
+    bool r = t == REAL;
+    if(dynamic_cast<Add*>(op)) {
+        emit(r ? RG_ADD_R : RG_ADD_I, dst, a, b);
+    } else if(dynamic_cast<Sub*>(op)) {
+        emit(r ? RG_SUB_R : RG_SUB_I, dst, a, b);
+    } else if(dynamic_cast<Mul*>(op)) {
+        emit(r ? RG_MUL_R : RG_MUL_I, dst, a, b);
+    } else if(dynamic_cast<Div*>(op)) {
+        emit(r ? RG_DIV_R : RG_DIV_I, dst, a, b);
+    } else if(dynamic_cast<Pow*>(op)) {
+        emit(r ? RG_POW_R : RG_POW_I, dst, a, b);
+    }
+}
+
+
+// comparisons are done on integers unless either side is real
+void RegisterCompiler::compile_compare(BinaryOp *op, int dst)
+{
+    bool r = op->left()->type() == REAL or op->right()->type() == REAL;
+    int a, b;
+    compile_operands(op, r ? REAL : INTEGER, a, b);
+
+    if(dynamic_cast<Equal*>(op)) {
+        emit(r ? RG_EQ_R : RG_EQ_I, dst, a, b);
+    } else {
+        emit(r ? RG_NE_R : RG_NE_I, dst, a, b);
+    }
+}
+
+
+// arguments are converted to their parameter types
+void RegisterCompiler::compile_call(FunctionCall *call, int dst)
+{
+    Symbol fun = lookup(call->left()->token().lexeme);
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = _pending[fun.slot].fun->parameters();
+
+    // the arguments become the first registers of the callee's window
+    int base = _next_temp;
+    for(int i=0; i<args->size(); i++) {
+        alloc();
+    }
+    for(int i=0; i<args->size(); i++) {
+        compile_into_as(args->child(i), ((VarDecl*) params->child(i))->child()->type(), base + i);
+    }
+
+    // A tail call of the running function reuses its window. Otherwise
+    // the static link is found by walking out to the declaring function.
+    if(call->tail() and fun.slot == _scope->fid) {
+        emit(RG_TAILCALL, fun.slot, base);
+    } else {
+        emit(RG_CALL, dst, fun.slot, _scope->depth - fun.depth, base);
+    }
+}
+
+
+// Compile both operands of a binary operation. A variable on the left
+// is copied if the right side makes a call, which could change it.
+void RegisterCompiler::compile_operands(BinaryOp *op, ResultType type, int &a, int &b)
+{
+    if(has_call(op->right())) {
+        a = alloc();
+        compile_into_as(op->left(), type, a);
+    } else {
+        a = compile_as(op->left(), type);
+    }
+    b = compile_as(op->right(), type);
+}
+
+
+void RegisterCompiler::compile_store(const std::string &name, ParseTree *value)
+{
+    Symbol sym = lookup(name);
+
+    if(is_local(sym)) {
+        compile_into_as(value, sym.type, sym.slot);
+    } else if(sym.depth == 0) {
+        emit(RG_SET_G, sym.slot, compile_as(value, sym.type));
+    } else {
+        emit(RG_SET_UP, _scope->depth - sym.depth, sym.slot, compile_as(value, sym.type));
+    }
+}
+
+
+// name resolution
+RegisterCompiler::Symbol RegisterCompiler::lookup(const std::string &name)
+{
+    for(Scope *scope = _scope; scope; scope = scope->parent) {
+        auto itr = scope->names.find(name);
+        if(itr != scope->names.end()) {
+            return itr->second;
+        }
+    }
+
+    throw std::runtime_error(name + " not defined.");
+}
+
+
+void RegisterCompiler::declare(const std::string &name, ResultType type, int slot)
+{
+    Symbol sym;
+    sym.type = type;
+    sym.depth = _scope->depth;
+    sym.slot = slot;
+    _scope->names[name] = sym;
+}
+
+
+// a variable in the current window
+bool RegisterCompiler::is_local(const Symbol &sym) const
+{
+    return sym.depth == _scope->depth;
+}
+
+
+// register allocation, temporaries are released in stack order
+int RegisterCompiler::alloc()
+{
+    int r = _next_temp++;
+    if(_next_temp > _max_temp) {
+        _max_temp = _next_temp;
+    }
+    return r;
+}
+
+
+void RegisterCompiler::release(int mark)
+{
+    _next_temp = mark;
+}
+
+
+// emit instructions
+void RegisterCompiler::emit(int op)
+{
+    _rc->code.push_back(op);
+}
+
+
+void RegisterCompiler::emit(int op, int a)
+{
+    emit(op);
+    _rc->code.push_back(a);
+}
+
+
+void RegisterCompiler::emit(int op, int a, int b)
+{
+    emit(op, a);
+    _rc->code.push_back(b);
+}
+
+
+void RegisterCompiler::emit(int op, int a, int b, int c)
+{
+    emit(op, a, b);
+    _rc->code.push_back(c);
+}
+
+
+void RegisterCompiler::emit(int op, int a, int b, int c, int d)
+{
+    emit(op, a, b, c);
+    _rc->code.push_back(d);
+}
+
+
+// the position of the next instruction
+int RegisterCompiler::here() const
+{
+    return _rc->code.size();
+}
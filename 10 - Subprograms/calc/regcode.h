@@ -0,0 +1,186 @@
+// This file contains the register bytecode for calc programs and the
+// compiler which translates type checked parse trees into it.
+#ifndef REGCODE_H
+#define REGCODE_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "op.h"
+
+
+//////////////////////////////////////////
+// Instruction Set
+//////////////////////////////////////////
+
+// Each function invocation has a fixed window of registers. Parameters
+// come first, then local variables, then temporaries. Operands name
+// registers in the current window unless noted otherwise.
+enum RegOpcode
+{
+    RG_HALT=0,
+    RG_LOADK_I,     // d value              d = integer literal
+    RG_LOADK_R,     // d index              d = real from the constant pool
+    RG_MOVE,        // d a                  d = a
+    RG_GET_G,       // d slot               d = global variable
+    RG_SET_G,       // slot a               global variable = a
+    RG_GET_UP,      // d hops slot          d = variable of an enclosing function
+    RG_SET_UP,      // hops slot a          variable of an enclosing function = a
+    RG_ADD_I,       // d a b                d = a + b
+    RG_ADD_R,
+    RG_SUB_I,
+    RG_SUB_R,
+    RG_MUL_I,
+    RG_MUL_R,
+    RG_DIV_I,
+    RG_DIV_R,
+    RG_POW_I,
+    RG_POW_R,
+    RG_NEG_I,       // d a                  d = -a
+    RG_NEG_R,
+    RG_I2R,         // d a                  d = a widened to a real
+    RG_R2I,         // d a                  d = a truncated to an integer
+    RG_EQ_I,        // d a b                d = a == b
+    RG_EQ_R,
+    RG_NE_I,        // d a b                d = a != b
+    RG_NE_R,
+    RG_JMP,         // target               jump to an absolute code position
+    RG_JZ,          // a target             jump if a is zero
+    RG_JEQ_I,       // a b target           jump if a == b
+    RG_JEQ_R,
+    RG_JNE_I,       // a b target           jump if a != b
+    RG_JNE_R,
+    RG_CALL,        // d fid hops base      call with arguments in base..., d = result
+    RG_TAILCALL,    // fid base             call the running function again in its own window
+    RG_RET,         // a                    return a
+    RG_PRINT_I,     // a
+    RG_PRINT_R,
+    RG_COUNT
+};
+
+// convert opcodes to strings
+extern const char* RGSTR[];
+
+// the number of operands of each instruction
+int rg_operands(int op);
+
+
+// A compiled function. The window holds nregs registers, of which the
+// first nslots are its parameters and variables.
+struct RegisterFunction
+{
+    std::string name;
+    int entry;          // position of the first instruction
+    int nparams;        // number of parameters
+    int nslots;         // parameters and locals
+    int nregs;          // slots and temporaries
+};
+
+
+// A compiled program. Function 0 is the top level program, whose
+// window holds the global variables.
+struct RegisterCode
+{
+    std::vector<int> code;
+    std::vector<double> reals;
+    std::vector<RegisterFunction> functions;
+
+    // print a readable listing of the program
+    void disassemble(std::ostream &os) const;
+};
+
+
+//////////////////////////////////////////
+// The Compiler
+//////////////////////////////////////////
+class RegisterCompiler
+{
+public:
+    // compile a type checked program
+    virtual RegisterCode *compile(ParseTree *program);
+
+protected:
+    // What a name refers to
+    struct Symbol
+    {
+        ResultType type;
+        int depth;          // nesting depth of the declaring function
+        int slot;           // register or function id
+    };
+
+    // The names declared by one function
+    struct Scope
+    {
+        std::map<std::string, Symbol> names;
+        Scope *parent;
+        int depth;
+        int fid;
+    };
+
+    // compile a function body in a new scope
+    virtual void compile_function(int fid, Program *body, ResultType return_type);
+
+    // compile a block, returning the register of its value if wanted
+    virtual int compile_block(Program *block, bool want_value);
+
+    // compile a statement, returning the register of its value if wanted
+    virtual int compile(ParseTree *tree, bool want_value);
+
+    // compile a loop or branch condition, returning the jump to patch
+    virtual int compile_exit(ParseTree *cond);
+
+    // compile an expression, returning the register which holds it
+    virtual int compile_expr(ParseTree *tree);
+
+    // compile an expression converted to the given type
+    virtual int compile_as(ParseTree *tree, ResultType type);
+
+    // compile an expression into a particular register
+    virtual void compile_into(ParseTree *tree, int dst);
+    virtual void compile_into_as(ParseTree *tree, ResultType type, int dst);
+
+    // node specific compilers
+    virtual void compile_arith(BinaryOp *op, int dst);
+    virtual void compile_compare(BinaryOp *op, int dst);
+    virtual void compile_call(FunctionCall *call, int dst);
+    virtual void compile_operands(BinaryOp *op, ResultType type, int &a, int &b);
+    virtual void compile_store(const std::string &name, ParseTree *value);
+
+    // name resolution
+    virtual Symbol lookup(const std::string &name);
+    virtual void declare(const std::string &name, ResultType type, int slot);
+    virtual bool is_local(const Symbol &sym) const;
+
+    // register allocation, temporaries are released in stack order
+    virtual int alloc();
+    virtual void release(int mark);
+
+    // emit instructions
+    virtual void emit(int op);
+    virtual void emit(int op, int a);
+    virtual void emit(int op, int a, int b);
+    virtual void emit(int op, int a, int b, int c);
+    virtual void emit(int op, int a, int b, int c, int d);
+
+    // the position of the next instruction
+    virtual int here() const;
+
+private:
+    RegisterCode *_rc;
+    Scope *_scope;
+
+    // deferred function bodies
+    struct Pending
+    {
+        int fid;
+        FunctionDef *fun;
+        Scope *scope;
+    };
+    std::vector<Pending> _pending;
+
+    // registers of the function being compiled
+    int _next_slot;
+    int _next_temp;
+    int _max_temp;
+};
+#endif
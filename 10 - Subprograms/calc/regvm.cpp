@@ -0,0 +1,329 @@
+#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include "regvm.h"
+
+// Threaded code replaces each opcode with the address of its handler,
+// and every handler ends by jumping to the next one. Otherwise each
+// handler is a case of a switch in a loop.
+#ifdef THREADED_CODE
+#define HANDLER(op) L_##op
+#define NEXT count++; goto *(void*) *pc++
+#else
+#define HANDLER(op) case op
+#define NEXT break
+#endif
+
+//////////////////////////////////////////
+// RegisterVM Implementation
+//////////////////////////////////////////
+
+// constructor, the stack size is a number of registers
+RegisterVM::RegisterVM(int stack_size) : _stack(stack_size)
+{
+    _count = 0;
+}
+
+
+// run a compiled program
+void RegisterVM::run(const RegisterCode &rc)
+{
+    const double *reals = rc.reals.data();
+    ResultField *base = _stack.data();
+    ResultField *end = base + _stack.size();
+    const RegisterFunction &main = rc.functions[0];
+    long long count = 0;
+
+    // the top level program's window holds the globals
+    if(main.nregs > (int) _stack.size()) {
+        throw std::runtime_error("Stack overflow.");
+    }
+    for(int i=0; i<main.nslots; i++) {
+        base[i].r = 0;
+    }
+    _frames.clear();
+    _frames.push_back(Frame{nullptr, base, -1, 0});
+
+    // machine registers
+    int frame = 0;
+    ResultField *fp = base;
+    const CodeWord *code;
+    const CodeWord *pc;
+
+#ifdef THREADED_CODE
+    // handler addresses, in opcode order
+    static void *handlers[] = {
+        &&L_RG_HALT, &&L_RG_LOADK_I, &&L_RG_LOADK_R, &&L_RG_MOVE,
+        &&L_RG_GET_G, &&L_RG_SET_G, &&L_RG_GET_UP, &&L_RG_SET_UP,
+        &&L_RG_ADD_I, &&L_RG_ADD_R, &&L_RG_SUB_I, &&L_RG_SUB_R,
+        &&L_RG_MUL_I, &&L_RG_MUL_R, &&L_RG_DIV_I, &&L_RG_DIV_R,
+        &&L_RG_POW_I, &&L_RG_POW_R, &&L_RG_NEG_I, &&L_RG_NEG_R,
+        &&L_RG_I2R, &&L_RG_R2I, &&L_RG_EQ_I, &&L_RG_EQ_R,
+        &&L_RG_NE_I, &&L_RG_NE_R, &&L_RG_JMP, &&L_RG_JZ,
+        &&L_RG_JEQ_I, &&L_RG_JEQ_R, &&L_RG_JNE_I, &&L_RG_JNE_R,
+        &&L_RG_CALL, &&L_RG_TAILCALL, &&L_RG_RET, &&L_RG_PRINT_I,
+        &&L_RG_PRINT_R
+    };
+
+    // replace each opcode with the address of its handler
+    _code.assign(rc.code.begin(), rc.code.end());
+    for(int i=0; i<(int) _code.size(); i += 1 + rg_operands(rc.code[i])) {
+        _code[i] = (CodeWord) handlers[rc.code[i]];
+    }
+    code = _code.data();
+    pc = code + main.entry;
+
+    // each handler jumps straight to the next one
+    NEXT;
+#else
+    code = rc.code.data();
+    pc = code + main.entry;
+
+    for(;;) {
+    count++;
+    switch(*pc++) {
+#endif
+        HANDLER(RG_HALT):
+            _count = count;
+            return;
+
+        HANDLER(RG_LOADK_I):
+            fp[pc[0]].i = pc[1];
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_LOADK_R):
+            fp[pc[0]].r = reals[pc[1]];
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_MOVE):
+            fp[pc[0]] = fp[pc[1]];
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_GET_G):
+            fp[pc[0]] = base[pc[1]];
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_SET_G):
+            base[pc[0]] = fp[pc[1]];
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_GET_UP): {
+            int f = frame;
+            for(int hops = pc[1]; hops; hops--) f = _frames[f].link;
+            fp[pc[0]] = _frames[f].fp[pc[2]];
+            pc += 3;
+            NEXT;
+        }
+
+        HANDLER(RG_SET_UP): {
+            int f = frame;
+            for(int hops = pc[0]; hops; hops--) f = _frames[f].link;
+            _frames[f].fp[pc[1]] = fp[pc[2]];
+            pc += 3;
+            NEXT;
+        }
+
+        // arithmetic
+        HANDLER(RG_ADD_I):
+            fp[pc[0]].i = AddFn::apply(fp[pc[1]].i, fp[pc[2]].i);
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_ADD_R):
+            fp[pc[0]].r = fp[pc[1]].r + fp[pc[2]].r;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_SUB_I):
+            fp[pc[0]].i = SubFn::apply(fp[pc[1]].i, fp[pc[2]].i);
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_SUB_R):
+            fp[pc[0]].r = fp[pc[1]].r - fp[pc[2]].r;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_MUL_I):
+            fp[pc[0]].i = MulFn::apply(fp[pc[1]].i, fp[pc[2]].i);
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_MUL_R):
+            fp[pc[0]].r = fp[pc[1]].r * fp[pc[2]].r;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_DIV_I):
+            fp[pc[0]].i = DivFn::apply(fp[pc[1]].i, fp[pc[2]].i);
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_DIV_R):
+            fp[pc[0]].r = fp[pc[1]].r / fp[pc[2]].r;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_POW_I):
+            fp[pc[0]].i = checked_pow(fp[pc[1]].i, fp[pc[2]].i);
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_POW_R):
+            fp[pc[0]].r = pow(fp[pc[1]].r, fp[pc[2]].r);
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_NEG_I):
+            fp[pc[0]].i = NegFn::apply(fp[pc[1]].i);
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_NEG_R):
+            fp[pc[0]].r = -fp[pc[1]].r;
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_I2R):
+            fp[pc[0]].r = fp[pc[1]].i;
+            pc += 2;
+            NEXT;
+
+        HANDLER(RG_R2I):
+            fp[pc[0]].i = fp[pc[1]].r;
+            pc += 2;
+            NEXT;
+
+        // comparisons
+        HANDLER(RG_EQ_I):
+            fp[pc[0]].i = fp[pc[1]].i == fp[pc[2]].i;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_EQ_R):
+            fp[pc[0]].i = fp[pc[1]].r == fp[pc[2]].r;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_NE_I):
+            fp[pc[0]].i = fp[pc[1]].i != fp[pc[2]].i;
+            pc += 3;
+            NEXT;
+
+        HANDLER(RG_NE_R):
+            fp[pc[0]].i = fp[pc[1]].r != fp[pc[2]].r;
+            pc += 3;
+            NEXT;
+
+        // control flow
+        HANDLER(RG_JMP):
+            pc = code + pc[0];
+            NEXT;
+
+        HANDLER(RG_JZ):
+            pc = fp[pc[0]].i == 0 ? code + pc[1] : pc + 2;
+            NEXT;
+
+        HANDLER(RG_JEQ_I):
+            pc = fp[pc[0]].i == fp[pc[1]].i ? code + pc[2] : pc + 3;
+            NEXT;
+
+        HANDLER(RG_JEQ_R):
+            pc = fp[pc[0]].r == fp[pc[1]].r ? code + pc[2] : pc + 3;
+            NEXT;
+
+        HANDLER(RG_JNE_I):
+            pc = fp[pc[0]].i != fp[pc[1]].i ? code + pc[2] : pc + 3;
+            NEXT;
+
+        HANDLER(RG_JNE_R):
+            pc = fp[pc[0]].r != fp[pc[1]].r ? code + pc[2] : pc + 3;
+            NEXT;
+
+        HANDLER(RG_CALL): {
+            const RegisterFunction &fun = rc.functions[pc[1]];
+
+            // find the frame of the function's declaring scope
+            int link = frame;
+            for(int hops = pc[2]; hops; hops--) link = _frames[link].link;
+
+            // the arguments are already in the bottom of the new window
+            ResultField *nfp = fp + pc[3];
+            if(nfp + fun.nregs > end) {
+                throw std::runtime_error("Stack overflow.");
+            }
+            for(int i = fun.nparams; i < fun.nslots; i++) {
+                nfp[i].r = 0;
+            }
+
+            _frames.push_back(Frame{pc + 4, nfp, link, (int) pc[0]});
+            frame = _frames.size() - 1;
+            fp = nfp;
+            pc = code + fun.entry;
+            NEXT;
+        }
+
+        HANDLER(RG_TAILCALL): {
+            const RegisterFunction &fun = rc.functions[pc[0]];
+
+            // the arguments replace the parameters and the locals start over
+            for(int i = 0; i < fun.nparams; i++) {
+                fp[i] = fp[pc[1] + i];
+            }
+            for(int i = fun.nparams; i < fun.nslots; i++) {
+                fp[i].r = 0;
+            }
+
+            pc = code + fun.entry;
+            NEXT;
+        }
+
+        HANDLER(RG_RET): {
+            ResultField result = fp[pc[0]];
+            int dst = _frames[frame].dst;
+            pc = _frames[frame].ret;
+            _frames.pop_back();
+            frame--;
+            fp = _frames[frame].fp;
+            fp[dst] = result;
+            NEXT;
+        }
+
+        // output
+        HANDLER(RG_PRINT_I):
+            std::cout << fp[pc[0]].i << std::endl;
+            pc++;
+            NEXT;
+
+        HANDLER(RG_PRINT_R):
+            std::cout << fp[pc[0]].r << std::endl;
+            pc++;
+            NEXT;
+#ifndef THREADED_CODE
+    }
+    }
+#endif
+}
+
+
+// the number of instructions executed by the last run
+long long RegisterVM::count() const
+{
+    return _count;
+}
+
+
+// the name of the dispatch technique compiled in
+const char *RegisterVM::dispatch()
+{
+#ifdef THREADED_CODE
+    return "threaded";
+#else
+    return "switch";
+#endif
+}
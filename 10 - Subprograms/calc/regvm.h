@@ -0,0 +1,50 @@
+// This file contains the virtual machine which runs calc register code.
+#ifndef REGVM_H
+#define REGVM_H
+#include <vector>
+#include <cstdint>
+#include "op.h"
+#include "regcode.h"
+
+// Threaded dispatch needs GNU labels as values. Define NO_THREADED_CODE
+// to build the portable switch loop instead.
+#if defined(__GNUC__) and not defined(NO_THREADED_CODE)
+#define THREADED_CODE
+typedef intptr_t CodeWord;
+#else
+typedef int CodeWord;
+#endif
+
+
+class RegisterVM
+{
+public:
+    // constructor, the stack size is a number of registers
+    RegisterVM(int stack_size=1024*1024);
+
+    // run a compiled program
+    virtual void run(const RegisterCode &rc);
+
+    // the number of instructions executed by the last run
+    virtual long long count() const;
+
+    // the name of the dispatch technique compiled in
+    static const char *dispatch();
+
+protected:
+    // The record of a function activation
+    struct Frame
+    {
+        const CodeWord *ret; // where to continue in the caller
+        ResultField *fp;    // the first register of the window
+        int link;           // the frame of the declaring function
+        int dst;            // the caller's register for the result
+    };
+
+private:
+    std::vector<ResultField> _stack;
+    std::vector<Frame> _frames;
+    std::vector<CodeWord> _code;
+    long long _count;
+};
+#endif
@@ -0,0 +1,129 @@
+// Frame slot resolution for the bodies of calc functions.
+#include <typeinfo>
+#include "optimize.h"
+
+//////////////////////////////////////////
+// Helper Functions
+//////////////////////////////////////////
+
+// true if a loop or branch declares something, which it may not run
+static bool declares(ParseTree *tree)
+{
+    if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        return true;
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        return declares(loop->right());
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        return declares(branch->right());
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            if(declares(*itr)) return true;
+        }
+    }
+    return false;
+}
+
+
+//////////////////////////////////////////
+// SlotResolver Implementation
+//////////////////////////////////////////
+
+// resolve a body of the function, which need not be installed yet
+void SlotResolver::resolve(FunctionDef *fun, Program *body)
+{
+    // The order of the frame's declarations, with the statement making
+    // each one. Parameters come before any statement.
+    std::vector<const Symbol*> order;
+    std::vector<int> stmt;
+    std::vector<bool> variable;
+    ArgList *params = fun->parameters();
+    for(auto itr = params->begin(); itr != params->end(); itr++) {
+        order.push_back(Symbol::intern(((VarDecl*) *itr)->child()->token().lexeme));
+        stmt.push_back(-1);
+        variable.push_back(true);
+    }
+    for(int i=0; i<body->size(); i++) {
+        ParseTree *tree = body->child(i);
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+            order.push_back(Symbol::intern(decl->child()->token().lexeme));
+            variable.push_back(true);
+        } else if(FunctionDef *nested = dynamic_cast<FunctionDef*>(tree)) {
+            order.push_back(Symbol::intern(nested->name()));
+            variable.push_back(false);
+        } else if(declares(tree)) {
+            break;
+        } else {
+            continue;
+        }
+        stmt.push_back(i);
+    }
+
+    // a name declared twice fails the call before it matters
+    std::set<const Symbol*> unique(order.begin(), order.end());
+    std::map<const Symbol*, int> saved;
+    saved.swap(_slots);
+    std::vector<int> slots;
+    if(unique.size() == order.size()) {
+        slots = RefEnv::layout(order, fun->count_frame(body));
+    }
+
+    // each statement sees the variables declared before it
+    unsigned next = 0;
+    for(int i=0; i<body->size(); i++) {
+        for(; next < slots.size() and stmt[next] < i; next++) {
+            if(variable[next]) {
+                _slots[order[next]] = slots[next];
+            }
+        }
+        body->child(i, run(body->child(i)));
+    }
+
+    _slots.swap(saved);
+}
+
+
+// visit everything but nested functions, declarations and callees
+ParseTree *SlotResolver::run(ParseTree *tree)
+{
+    if(FunctionDef *nested = dynamic_cast<FunctionDef*>(tree)) {
+        resolve(nested, nested->body());
+        return tree;
+    } else if(dynamic_cast<VarDecl*>(tree)) {
+        return tree;
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        call->right(run(call->right()));
+        return tree;
+    }
+    return TreePass::run(tree);
+}
+
+
+ParseTree *SlotResolver::rewrite(ParseTree *tree)
+{
+    // the exact type is checked to leave other passes' nodes alone
+    if(typeid(*tree) == typeid(Var)) {
+        auto itr = _slots.find(((Var*) tree)->symbol());
+        if(itr == _slots.end()) return tree;
+
+        SlotVar *result = new SlotVar(tree->token(), itr->second);
+        result->type(tree->type());
+        delete tree;
+        _count++;
+        return result;
+    } else if(typeid(*tree) == typeid(Assign)) {
+        Assign *assign = (Assign*) tree;
+        auto itr = _slots.find(((Var*) assign->left())->symbol());
+        if(itr == _slots.end()) return tree;
+
+        SlotAssign *result = new SlotAssign(tree->token(), itr->second);
+        result->left(assign->left());
+        result->right(assign->right());
+        result->type(assign->type());
+        assign->left(nullptr);
+        assign->right(nullptr);
+        delete assign;
+        _count++;
+        return result;
+    }
+    return tree;
+}
@@ -0,0 +1,970 @@
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include "ssa.h"
+
+//////////////////////////////////////////
+// Instruction Set
+//////////////////////////////////////////
+
+const char *SSASTR[] = {
+    "const", "param", "phi", "add", "sub", "mul", "div", "pow", "neg",
+    "i2r", "r2i", "eq", "ne", "load", "store", "declare", "define", "call",
+    "print", "jump", "branch", "return"
+};
+
+
+// true for arithmetic which depends only on its operands
+bool SsaInstr::is_pure() const
+{
+    return op == SSA_CONST or (op >= SSA_ADD and op <= SSA_NE);
+}
+
+
+// Integer division and powers raise errors, so they run whatever becomes
+// of their values.
+bool SsaInstr::has_effect() const
+{
+    if(op == SSA_DIV or op == SSA_POW) {
+        return type == INTEGER;
+    }
+    return op >= SSA_STORE;
+}
+
+
+bool SsaInstr::is_terminator() const
+{
+    return op == SSA_JUMP or op == SSA_BRANCH or op == SSA_RETURN;
+}
+
+
+// compute a pure instruction from the values of its operands
+Result ssa_compute(const SsaInstr *instr, const Result &a, const Result &b)
+{
+    Result result;
+    bool integer = instr->type == INTEGER;
+    switch(instr->op) {
+        case SSA_CONST:
+            return instr->value;
+        case SSA_ADD:
+            integer ? result.i(AddFn::apply(a.i(), b.i())) : result.r(AddFn::apply(a.r(), b.r()));
+            break;
+        case SSA_SUB:
+            integer ? result.i(SubFn::apply(a.i(), b.i())) : result.r(SubFn::apply(a.r(), b.r()));
+            break;
+        case SSA_MUL:
+            integer ? result.i(MulFn::apply(a.i(), b.i())) : result.r(MulFn::apply(a.r(), b.r()));
+            break;
+        case SSA_DIV:
+            integer ? result.i(DivFn::apply(a.i(), b.i())) : result.r(DivFn::apply(a.r(), b.r()));
+            break;
+        case SSA_POW:
+            integer ? result.i(PowFn::apply(a.i(), b.i())) : result.r(PowFn::apply(a.r(), b.r()));
+            break;
+        case SSA_NEG:
+            integer ? result.i(NegFn::apply(a.i())) : result.r(NegFn::apply(a.r()));
+            break;
+        case SSA_I2R:
+            result.r(a.i());
+            break;
+        case SSA_R2I:
+            result.i(a.r());
+            break;
+        case SSA_EQ:
+            result.i(instr->args[0]->type == INTEGER ? a.i() == b.i() : a.r() == b.r());
+            break;
+        case SSA_NE:
+            result.i(instr->args[0]->type == INTEGER ? a.i() != b.i() : a.r() != b.r());
+            break;
+        default:
+            throw std::runtime_error(std::string("Cannot compute ") + SSASTR[instr->op]);
+    }
+    return result;
+}
+
+
+//////////////////////////////////////////
+// SsaBlock Implementation
+//////////////////////////////////////////
+
+// the last instruction, which says where control goes
+SsaInstr *SsaBlock::terminator() const
+{
+    return instrs.empty() ? nullptr : instrs.back();
+}
+
+
+// the number of phis at the start of the block
+int SsaBlock::phis() const
+{
+    int n = 0;
+    while(n < (int) instrs.size() and instrs[n]->op == SSA_PHI) {
+        n++;
+    }
+    return n;
+}
+
+
+// forget a predecessor, and its operand of each phi
+void SsaBlock::remove_pred(SsaBlock *pred)
+{
+    auto itr = std::find(preds.begin(), preds.end(), pred);
+    int i = itr - preds.begin();
+    preds.erase(itr);
+    for(int j=0; j<phis(); j++) {
+        instrs[j]->args.erase(instrs[j]->args.begin() + i);
+    }
+}
+
+
+//////////////////////////////////////////
+// SsaFunction Implementation
+//////////////////////////////////////////
+
+SsaFunction::SsaFunction(const std::string &name)
+{
+    this->name = name;
+    def = nullptr;
+    return_type = VOID;
+    frame_size = 0;
+    _next_block = 0;
+}
+
+
+SsaFunction::~SsaFunction()
+{
+    for(auto itr = _instrs.begin(); itr != _instrs.end(); itr++) {
+        delete *itr;
+    }
+    for(auto itr = blocks.begin(); itr != blocks.end(); itr++) {
+        delete *itr;
+    }
+}
+
+
+// make a new instruction, which is in no block yet
+SsaInstr *SsaFunction::instr(SsaOpcode op, ResultType type)
+{
+    SsaInstr *result = new SsaInstr;
+    result->id = _instrs.size();
+    result->op = op;
+    result->type = type;
+    result->block = nullptr;
+    result->index = 0;
+    result->sym = nullptr;
+    result->fun = nullptr;
+    result->tail = false;
+    _instrs.push_back(result);
+    return result;
+}
+
+
+// make a new block at the end of the function
+SsaBlock *SsaFunction::block()
+{
+    SsaBlock *result = new SsaBlock;
+    result->id = _next_block++;
+    blocks.push_back(result);
+    return result;
+}
+
+
+// the number of instruction ids used
+int SsaFunction::values() const
+{
+    return _instrs.size();
+}
+
+
+// make every use of one instruction a use of another
+void SsaFunction::replace_uses(SsaInstr *from, SsaInstr *to)
+{
+    for(auto block = blocks.begin(); block != blocks.end(); block++) {
+        for(auto instr = (*block)->instrs.begin(); instr != (*block)->instrs.end(); instr++) {
+            std::replace((*instr)->args.begin(), (*instr)->args.end(), from, to);
+        }
+    }
+}
+
+
+// take an instruction out of its block
+void SsaFunction::remove(SsaInstr *instr)
+{
+    std::vector<SsaInstr*> &instrs = instr->block->instrs;
+    instrs.erase(std::find(instrs.begin(), instrs.end(), instr));
+    instr->block = nullptr;
+}
+
+
+// throw a runtime error if the graph is malformed
+void SsaFunction::verify() const
+{
+    std::set<SsaBlock*> known(blocks.begin(), blocks.end());
+    for(auto bitr = blocks.begin(); bitr != blocks.end(); bitr++) {
+        SsaBlock *block = *bitr;
+        std::string where = name + " b" + std::to_string(block->id);
+        if(not block->terminator() or not block->terminator()->is_terminator()) {
+            throw std::runtime_error("SSA: " + where + " has no terminator.");
+        }
+
+        int phis = block->phis();
+        for(int i=0; i<(int) block->instrs.size(); i++) {
+            SsaInstr *instr = block->instrs[i];
+            if(instr->block != block) {
+                throw std::runtime_error("SSA: " + where + " has a stray instruction.");
+            } else if(instr->op == SSA_PHI and i >= phis) {
+                throw std::runtime_error("SSA: " + where + " has a phi after other instructions.");
+            } else if(instr->op == SSA_PHI and instr->args.size() != block->preds.size()) {
+                throw std::runtime_error("SSA: " + where + " has a phi without an operand per predecessor.");
+            } else if(instr->is_terminator() and i != (int) block->instrs.size() - 1) {
+                throw std::runtime_error("SSA: " + where + " has code after its terminator.");
+            }
+            for(auto arg = instr->args.begin(); arg != instr->args.end(); arg++) {
+                if(not (*arg)->block or not known.count((*arg)->block)) {
+                    throw std::runtime_error("SSA: " + where + " uses a removed instruction.");
+                }
+            }
+            for(auto target = instr->targets.begin(); target != instr->targets.end(); target++) {
+                std::vector<SsaBlock*> &preds = (*target)->preds;
+                if(not known.count(*target) or std::find(preds.begin(), preds.end(), block) == preds.end()) {
+                    throw std::runtime_error("SSA: " + where + " jumps to a block which does not expect it.");
+                }
+            }
+        }
+    }
+}
+
+
+// print a value's name
+static std::ostream &operator<<(std::ostream &os, const SsaInstr *instr)
+{
+    return os << "%" << instr->id;
+}
+
+
+// print a readable listing of the function
+void SsaFunction::print(std::ostream &os) const
+{
+    if(def) {
+        os << "function " << name << "(";
+        for(int i=0; i<(int) params.size(); i++) {
+            os << (i ? ", " : "") << RTSTR[params[i]];
+        }
+        os << ") returns " << RTSTR[return_type] << std::endl;
+    } else {
+        os << "program" << std::endl;
+    }
+
+    for(auto bitr = blocks.begin(); bitr != blocks.end(); bitr++) {
+        SsaBlock *block = *bitr;
+        os << "b" << block->id << ":";
+        for(int i=0; i<(int) block->preds.size(); i++) {
+            os << (i ? ", b" : "    ; preds b") << block->preds[i]->id;
+        }
+        os << std::endl;
+
+        for(auto itr = block->instrs.begin(); itr != block->instrs.end(); itr++) {
+            SsaInstr *instr = *itr;
+            os << "    ";
+            if(instr->type != VOID and instr->op != SSA_DECLARE) {
+                os << instr << ":" << RTSTR[instr->type] << " = ";
+            }
+            os << (instr->tail ? "tail " : "") << SSASTR[instr->op];
+
+            switch(instr->op) {
+                case SSA_CONST:
+                    os << " " << std::setprecision(17) << instr->value << std::setprecision(6);
+                    break;
+                case SSA_PARAM:
+                    os << " " << instr->index;
+                    break;
+                case SSA_PHI:
+                    for(int i=0; i<(int) instr->args.size(); i++) {
+                        os << (i ? ", [b" : " [b") << block->preds[i]->id << " " << instr->args[i] << "]";
+                    }
+                    break;
+                case SSA_DECLARE:
+                    os << " " << RTSTR[instr->type] << " " << instr->sym->name();
+                    break;
+                case SSA_CALL:
+                    os << " " << instr->sym->name() << "(";
+                    for(int i=0; i<(int) instr->args.size(); i++) {
+                        os << (i ? ", " : "") << instr->args[i];
+                    }
+                    os << ")";
+                    break;
+                default:
+                    if(instr->sym) {
+                        os << " " << instr->sym->name() << (instr->args.empty() ? "" : ",");
+                    }
+                    for(int i=0; i<(int) instr->args.size(); i++) {
+                        os << (i ? ", " : " ") << instr->args[i];
+                    }
+                    for(int i=0; i<(int) instr->targets.size(); i++) {
+                        os << (i or not instr->args.empty() ? ", b" : " b") << instr->targets[i]->id;
+                    }
+            }
+            os << std::endl;
+        }
+    }
+}
+
+
+//////////////////////////////////////////
+// SsaProgram Implementation
+//////////////////////////////////////////
+
+SsaProgram::~SsaProgram()
+{
+    for(auto itr = functions.begin(); itr != functions.end(); itr++) {
+        delete *itr;
+    }
+}
+
+
+// the number of instructions in the program
+int SsaProgram::size() const
+{
+    int n = 0;
+    for(auto fun = functions.begin(); fun != functions.end(); fun++) {
+        for(auto block = (*fun)->blocks.begin(); block != (*fun)->blocks.end(); block++) {
+            n += (*block)->instrs.size();
+        }
+    }
+    return n;
+}
+
+
+// print a readable listing of the program
+void SsaProgram::print(std::ostream &os) const
+{
+    for(int i=0; i<(int) functions.size(); i++) {
+        if(i) os << std::endl;
+        functions[i]->print(os);
+    }
+}
+
+
+//////////////////////////////////////////
+// SsaBuilder Implementation
+//////////////////////////////////////////
+
+// Collect the declarations of a scope. Calls are the only scopes, so they
+// may be nested in loops and branches, but not in other functions.
+static void find_decls(ParseTree *tree, std::vector<ParseTree*> &decls)
+{
+    if(dynamic_cast<VarDecl*>(tree) or dynamic_cast<FunctionDef*>(tree)) {
+        decls.push_back(tree);
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        find_decls(loop->right(), decls);
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        find_decls(branch->right(), decls);
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            find_decls(*itr, decls);
+        }
+    }
+}
+
+
+// Collect every name used in a tree, including in the functions it
+// defines.
+static void names_used(ParseTree *tree, std::set<std::string> &names)
+{
+    if(not tree) {
+        return;
+    } else if(dynamic_cast<Var*>(tree)) {
+        names.insert(tree->token().lexeme);
+    } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        names_used(fun->body(), names);
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        names_used(op->child(), names);
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        names_used(op->left(), names);
+        names_used(op->right(), names);
+    } else if(NaryOp *op = dynamic_cast<NaryOp*>(tree)) {
+        for(auto itr = op->begin(); itr != op->end(); itr++) {
+            names_used(*itr, names);
+        }
+    }
+}
+
+
+SsaProgram *SsaBuilder::build(ParseTree *program)
+{
+    _program = new SsaProgram;
+    _frame = nullptr;
+    function("program", nullptr, (Program*) program);
+    return _program;
+}
+
+
+// lower a function body, returning the new function
+SsaFunction *SsaBuilder::function(const std::string &name, FunctionDef *def, Program *body)
+{
+    SsaFunction *fun = new SsaFunction(name);
+    _program->functions.push_back(fun);
+    fun->def = def;
+
+    Frame frame;
+    frame.outer = _frame;
+    _frame = &frame;
+    frame.fun = fun;
+
+    // The variables of the scope are promoted to values, except those the
+    // functions defined in it can see.
+    std::vector<ParseTree*> decls;
+    if(def) {
+        ArgList *params = def->parameters();
+        decls.insert(decls.end(), params->begin(), params->end());
+        fun->return_type = def->return_type();
+        fun->frame_size = def->frame_size();
+    }
+    find_decls(body, decls);
+    std::set<std::string> captured;
+    for(auto itr = decls.begin(); itr != decls.end(); itr++) {
+        if(FunctionDef *nested = dynamic_cast<FunctionDef*>(*itr)) {
+            names_used(*itr, captured);
+            frame.functions[nested->name()] = nested;
+        }
+    }
+    for(auto itr = decls.begin(); itr != decls.end(); itr++) {
+        if(VarDecl *decl = dynamic_cast<VarDecl*>(*itr)) {
+            Var *var = (Var*) decl->child();
+            if(not captured.count(var->token().lexeme)) {
+                frame.vars[var->symbol()] = var->type();
+            }
+        }
+    }
+
+    frame.current = fun->block();
+    seal(frame.current);
+
+    // the arguments arrive converted to the parameter types
+    if(def) {
+        ArgList *params = def->parameters();
+        for(int i=0; i<params->size(); i++) {
+            Var *var = (Var*) ((VarDecl*) params->child(i))->child();
+            fun->params.push_back(var->type());
+            SsaInstr *param = emit(SSA_PARAM, var->type());
+            param->index = i;
+            if(promoted(var->symbol())) {
+                write(var->symbol(), frame.current, param);
+            } else {
+                emit(SSA_DECLARE, var->type())->sym = var->symbol();
+                emit(SSA_STORE, VOID, param)->sym = var->symbol();
+            }
+        }
+    }
+
+    // A body which ends in a statement has no value, which returns as 0.
+    SsaInstr *val = block(body);
+    if(fun->return_type == VOID) {
+        emit(SSA_RETURN, VOID);
+    } else if(val and val->type != VOID) {
+        emit(SSA_RETURN, VOID, convert(val, fun->return_type));
+    } else {
+        Result zero;
+        zero.type(fun->return_type);
+        emit(SSA_RETURN, VOID, constant(zero));
+    }
+
+    _frame = frame.outer;
+    return fun;
+}
+
+
+// statements, returning the value of the last if it is an expression
+SsaInstr *SsaBuilder::block(Program *block)
+{
+    SsaInstr *result = nullptr;
+    for(auto itr = block->begin(); itr != block->end(); itr++) {
+        result = stmt(*itr);
+    }
+    return result;
+}
+
+
+SsaInstr *SsaBuilder::stmt(ParseTree *tree)
+{
+    if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        Var *var = (Var*) decl->child();
+        if(promoted(var->symbol())) {
+            Result zero;
+            zero.type(var->type());
+            write(var->symbol(), _frame->current, constant(zero));
+        } else {
+            emit(SSA_DECLARE, var->type())->sym = var->symbol();
+        }
+    } else if(FunctionDef *def = dynamic_cast<FunctionDef*>(tree)) {
+        SsaFunction *fun = function(def->name(), def, def->body());
+        SsaInstr *define = emit(SSA_DEFINE, VOID);
+        define->sym = Symbol::intern(def->name());
+        define->fun = fun;
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        Var *var = (Var*) assign->left();
+        SsaInstr *val = expr_as(assign->right(), var->type());
+        if(promoted(var->symbol())) {
+            write(var->symbol(), _frame->current, val);
+        } else {
+            emit(SSA_STORE, VOID, val)->sym = var->symbol();
+        }
+    } else if(Print *print = dynamic_cast<Print*>(tree)) {
+        emit(SSA_PRINT, VOID, expr(print->child()));
+    } else if(While *loop = dynamic_cast<While*>(tree)) {
+        this->loop(loop);
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        this->branch(branch);
+    } else {
+        return expr(tree);
+    }
+    return nullptr;
+}
+
+
+// The header tests the condition and is entered from before the loop and
+// from the end of the body, so it is sealed once the body is done.
+void SsaBuilder::loop(While *loop)
+{
+    SsaBlock *header = _frame->fun->block();
+    jump(header);
+    _frame->current = header;
+
+    SsaInstr *test = expr(loop->left());
+    SsaBlock *body = _frame->fun->block();
+    SsaBlock *exit = _frame->fun->block();
+    branch(test, body, exit);
+
+    seal(body);
+    _frame->current = body;
+    block((Program*) loop->right());
+    jump(header);
+    seal(header);
+
+    seal(exit);
+    _frame->current = exit;
+}
+
+
+void SsaBuilder::branch(Branch *branch)
+{
+    SsaInstr *test = expr(branch->left());
+    SsaBlock *then = _frame->fun->block();
+    SsaBlock *join = _frame->fun->block();
+    this->branch(test, then, join);
+
+    seal(then);
+    _frame->current = then;
+    block((Program*) branch->right());
+    jump(join);
+
+    seal(join);
+    _frame->current = join;
+}
+
+
+// expressions
+SsaInstr *SsaBuilder::expr(ParseTree *tree)
+{
+    if(Number *num = dynamic_cast<Number*>(tree)) {
+        return constant(num->value());
+    } else if(Var *var = dynamic_cast<Var*>(tree)) {
+        if(promoted(var->symbol())) {
+            return read(var->symbol(), _frame->current);
+        }
+        SsaInstr *load = emit(SSA_LOAD, var->type());
+        load->sym = var->symbol();
+        return load;
+    } else if(FunctionCall *fcall = dynamic_cast<FunctionCall*>(tree)) {
+        return call(fcall);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        return emit(SSA_NEG, tree->type(), expr_as(neg->child(), tree->type()));
+    }
+
+    BinaryOp *op = dynamic_cast<BinaryOp*>(tree);
+    if(not op) {
+        throw std::runtime_error("Cannot lower " + tree->token().lexeme);
+    }
+
+    // comparisons are made in the wider of the operand types
+    if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        ResultType type = op->left()->type() == REAL or op->right()->type() == REAL ? REAL : INTEGER;
+        SsaOpcode opcode = dynamic_cast<Equal*>(tree) ? SSA_EQ : SSA_NE;
+        SsaInstr *l = expr_as(op->left(), type);
+        SsaInstr *r = expr_as(op->right(), type);
+        return emit(opcode, INTEGER, l, r);
+    }
+
+    SsaOpcode opcode;
+    if(dynamic_cast<Add*>(tree)) {
+        opcode = SSA_ADD;
+    } else if(dynamic_cast<Sub*>(tree)) {
+        opcode = SSA_SUB;
+    } else if(dynamic_cast<Mul*>(tree)) {
+        opcode = SSA_MUL;
+    } else if(dynamic_cast<Div*>(tree)) {
+        opcode = SSA_DIV;
+    } else if(dynamic_cast<Pow*>(tree)) {
+        opcode = SSA_POW;
+    } else {
+        throw std::runtime_error("Cannot lower " + tree->token().lexeme);
+    }
+
+    // the operands are lowered in the order they are evaluated
+    SsaInstr *l = expr_as(op->left(), tree->type());
+    SsaInstr *r = expr_as(op->right(), tree->type());
+    return emit(opcode, tree->type(), l, r);
+}
+
+
+SsaInstr *SsaBuilder::expr_as(ParseTree *tree, ResultType type)
+{
+    return convert(expr(tree), type);
+}
+
+
+// convert a value as assignment does
+SsaInstr *SsaBuilder::convert(SsaInstr *val, ResultType type)
+{
+    if(val->type == type) {
+        return val;
+    }
+    return emit(type == REAL ? SSA_I2R : SSA_R2I, type, val);
+}
+
+
+// arguments are converted to the parameter types
+SsaInstr *SsaBuilder::call(FunctionCall *call)
+{
+    // the function is the one the name refers to in the nearest scope
+    std::string name = call->left()->token().lexeme;
+    FunctionDef *def = nullptr;
+    for(Frame *frame = _frame; frame and not def; frame = frame->outer) {
+        auto itr = frame->functions.find(name);
+        def = itr == frame->functions.end() ? nullptr : itr->second;
+    }
+    if(not def) {
+        throw std::runtime_error(name + " not defined.");
+    }
+
+    ArgList *args = (ArgList*) call->right();
+    ArgList *params = def->parameters();
+    std::vector<SsaInstr*> values;
+    for(int i=0; i<args->size(); i++) {
+        values.push_back(expr_as(args->child(i), ((VarDecl*) params->child(i))->child()->type()));
+    }
+
+    SsaInstr *result = emit(SSA_CALL, def->return_type());
+    result->args = values;
+    result->sym = ((Var*) call->left())->symbol();
+    result->tail = call->tail();
+    return result;
+}
+
+
+SsaInstr *SsaBuilder::constant(Result val)
+{
+    SsaInstr *result = emit(SSA_CONST, val.type());
+    result->value = val;
+    return result;
+}
+
+
+// add an instruction to the current block
+SsaInstr *SsaBuilder::emit(SsaOpcode op, ResultType type)
+{
+    SsaInstr *result = _frame->fun->instr(op, type);
+    result->block = _frame->current;
+    _frame->current->instrs.push_back(result);
+    return result;
+}
+
+
+SsaInstr *SsaBuilder::emit(SsaOpcode op, ResultType type, SsaInstr *a)
+{
+    SsaInstr *result = emit(op, type);
+    result->args.push_back(a);
+    return result;
+}
+
+
+SsaInstr *SsaBuilder::emit(SsaOpcode op, ResultType type, SsaInstr *a, SsaInstr *b)
+{
+    SsaInstr *result = emit(op, type, a);
+    result->args.push_back(b);
+    return result;
+}
+
+
+// end the current block
+void SsaBuilder::jump(SsaBlock *target)
+{
+    emit(SSA_JUMP, VOID)->targets.push_back(target);
+    target->preds.push_back(_frame->current);
+}
+
+
+void SsaBuilder::branch(SsaInstr *test, SsaBlock *yes, SsaBlock *no)
+{
+    SsaInstr *instr = emit(SSA_BRANCH, VOID, test);
+    instr->targets.push_back(yes);
+    instr->targets.push_back(no);
+    yes->preds.push_back(_frame->current);
+    no->preds.push_back(_frame->current);
+}
+
+
+// the values of promoted variables
+void SsaBuilder::write(const Symbol *var, SsaBlock *block, SsaInstr *val)
+{
+    _frame->defs[var][block] = val;
+}
+
+
+SsaInstr *SsaBuilder::read(const Symbol *var, SsaBlock *block)
+{
+    std::map<SsaBlock*, SsaInstr*> &defs = _frame->defs[var];
+    auto itr = defs.find(block);
+    if(itr != defs.end()) {
+        return itr->second;
+    }
+    return read_recursive(var, block);
+}
+
+
+// A block which may gain predecessors gets a phi to complete later. A
+// block with one predecessor has its value, and a join gets a phi which
+// is written before its operands are found, to stop loops.
+SsaInstr *SsaBuilder::read_recursive(const Symbol *var, SsaBlock *block)
+{
+    SsaInstr *val;
+    if(not _frame->sealed.count(block)) {
+        val = _frame->fun->instr(SSA_PHI, _frame->vars[var]);
+        val->block = block;
+        block->instrs.insert(block->instrs.begin() + block->phis(), val);
+        _frame->incomplete[block][var] = val;
+    } else if(block->preds.empty()) {
+        val = undefined(_frame->vars[var]);
+    } else if(block->preds.size() == 1) {
+        val = read(var, block->preds[0]);
+    } else {
+        val = _frame->fun->instr(SSA_PHI, _frame->vars[var]);
+        val->block = block;
+        block->instrs.insert(block->instrs.begin() + block->phis(), val);
+        write(var, block, val);
+        val = add_phi_operands(var, val);
+    }
+    write(var, block, val);
+    return val;
+}
+
+
+SsaInstr *SsaBuilder::add_phi_operands(const Symbol *var, SsaInstr *phi)
+{
+    std::vector<SsaBlock*> &preds = phi->block->preds;
+    for(auto itr = preds.begin(); itr != preds.end(); itr++) {
+        phi->args.push_back(read(var, *itr));
+    }
+    return remove_trivial_phi(phi);
+}
+
+
+// A phi which only joins one value, and perhaps itself, is that value.
+// Removing it may make the phis which use it trivial in turn.
+SsaInstr *SsaBuilder::remove_trivial_phi(SsaInstr *phi)
+{
+    SsaInstr *same = nullptr;
+    for(auto itr = phi->args.begin(); itr != phi->args.end(); itr++) {
+        if(*itr == same or *itr == phi) continue;
+        if(same) return phi;
+        same = *itr;
+    }
+    if(not same) {
+        same = undefined(phi->type);
+    }
+
+    std::vector<SsaInstr*> users;
+    SsaFunction *fun = _frame->fun;
+    for(auto block = fun->blocks.begin(); block != fun->blocks.end(); block++) {
+        for(int i=0; i<(*block)->phis(); i++) {
+            SsaInstr *user = (*block)->instrs[i];
+            if(user != phi and std::count(user->args.begin(), user->args.end(), phi)) {
+                users.push_back(user);
+            }
+        }
+    }
+
+    fun->replace_uses(phi, same);
+    for(auto var = _frame->defs.begin(); var != _frame->defs.end(); var++) {
+        for(auto def = var->second.begin(); def != var->second.end(); def++) {
+            if(def->second == phi) def->second = same;
+        }
+    }
+    fun->remove(phi);
+
+    for(auto itr = users.begin(); itr != users.end(); itr++) {
+        if((*itr)->block) remove_trivial_phi(*itr);
+    }
+    return same;
+}
+
+
+// no more predecessors will be added, so the block's phis are completed
+void SsaBuilder::seal(SsaBlock *block)
+{
+    std::map<const Symbol*, SsaInstr*> phis = _frame->incomplete[block];
+    _frame->incomplete.erase(block);
+    for(auto itr = phis.begin(); itr != phis.end(); itr++) {
+        add_phi_operands(itr->first, itr->second);
+    }
+    _frame->sealed.insert(block);
+}
+
+
+// Variables start at zero, so a read before any assignment is a zero at
+// the start of the function.
+SsaInstr *SsaBuilder::undefined(ResultType type)
+{
+    SsaBlock *entry = _frame->fun->blocks[0];
+    SsaInstr *result = _frame->fun->instr(SSA_CONST, type);
+    result->value.type(type);
+    result->block = entry;
+    entry->instrs.insert(entry->instrs.begin(), result);
+    return result;
+}
+
+
+// true if the variable is a value rather than an environment slot
+bool SsaBuilder::promoted(const Symbol *var)
+{
+    return _frame->vars.count(var);
+}
+
+
+//////////////////////////////////////////
+// SsaInterpreter Implementation
+//////////////////////////////////////////
+
+void SsaInterpreter::run(SsaProgram *program, RefEnv &global)
+{
+    std::vector<Result> args;
+    bool tail = false;
+    execute(program->functions[0], global, args, tail);
+}
+
+
+// call a function declared in scope, starting it again for each tail call
+Result SsaInterpreter::call(SsaFunction *fun, RefEnv *scope, std::vector<Result> &args)
+{
+    for(;;) {
+        RefEnv local(scope, fun->frame_size);
+        bool tail = false;
+        Result result = execute(fun, local, args, tail);
+        if(not tail) return result;
+    }
+}
+
+
+// Run a function body in its environment. Values live in a table indexed
+// by instruction id, and the phis of a block read the edge just taken.
+Result SsaInterpreter::execute(SsaFunction *fun, RefEnv &env, std::vector<Result> &args, bool &tail)
+{
+    std::vector<Result> vals(fun->values());
+    std::vector<Result> incoming;
+    SsaBlock *prev = nullptr;
+    SsaBlock *block = fun->blocks[0];
+
+    for(;;) {
+        // the phis take their values all at once
+        int phis = block->phis();
+        if(phis) {
+            int edge = std::find(block->preds.begin(), block->preds.end(), prev) - block->preds.begin();
+            incoming.resize(phis);
+            for(int i=0; i<phis; i++) {
+                incoming[i] = vals[block->instrs[i]->args[edge]->id];
+            }
+            for(int i=0; i<phis; i++) {
+                vals[block->instrs[i]->id] = incoming[i];
+            }
+        }
+
+        SsaBlock *next = nullptr;
+        for(int i=phis; not next; i++) {
+            SsaInstr *instr = block->instrs[i];
+            Result &dst = vals[instr->id];
+            switch(instr->op) {
+                case SSA_PARAM:
+                    dst = args[instr->index];
+                    break;
+
+                case SSA_LOAD:
+                    dst = env[instr->sym];
+                    break;
+
+                case SSA_STORE:
+                    env[instr->sym] = vals[instr->args[0]->id];
+                    break;
+
+                case SSA_DECLARE:
+                    env.declare(instr->sym, instr->type);
+                    break;
+
+                case SSA_DEFINE:
+                    env.declare(instr->sym, FUNCTION_TYPE);
+                    env[instr->sym].ptr(instr->fun);
+                    break;
+
+                case SSA_CALL: {
+                    // functions run in the scope they were declared in
+                    RefEnv *scope = env.owner(instr->sym);
+                    if(not scope) {
+                        throw std::runtime_error(instr->sym->name() + " not defined.");
+                    }
+                    SsaFunction *callee = (SsaFunction*) (*scope)[instr->sym].ptr();
+                    std::vector<Result> values;
+                    for(auto arg = instr->args.begin(); arg != instr->args.end(); arg++) {
+                        values.push_back(vals[(*arg)->id]);
+                    }
+
+                    // a tail call leaves its arguments for the running call
+                    if(instr->tail) {
+                        args.swap(values);
+                        tail = true;
+                        return Result();
+                    }
+                    dst = call(callee, scope, values);
+                    break;
+                }
+
+                case SSA_PRINT:
+                    std::cout << vals[instr->args[0]->id] << std::endl;
+                    break;
+
+                case SSA_JUMP:
+                    next = instr->targets[0];
+                    break;
+
+                case SSA_BRANCH: {
+                    Result &test = vals[instr->args[0]->id];
+                    next = instr->targets[NUM_RESULT(test) != 0 ? 0 : 1];
+                    break;
+                }
+
+                case SSA_RETURN:
+                    return instr->args.empty() ? Result() : vals[instr->args[0]->id];
+
+                default: {
+                    // the pure instructions
+                    Result none;
+                    const Result &a = instr->args.size() > 0 ? vals[instr->args[0]->id] : none;
+                    const Result &b = instr->args.size() > 1 ? vals[instr->args[1]->id] : none;
+                    dst = ssa_compute(instr, a, b);
+                }
+            }
+        }
+
+        prev = block;
+        block = next;
+    }
+}
@@ -0,0 +1,387 @@
+// This file contains an intermediate representation of calc programs in
+// static single assignment form. Each function is a graph of basic
+// blocks of typed instructions. A variable becomes the value last
+// assigned to it, and loops and branches join its values with phi
+// instructions. Variables which nested functions can see stay in the
+// function's environment, where they are loaded and stored by name.
+// The passes optimize the graph and the interpreter runs it, so an
+// optimized program can be checked against the tree walker.
+#ifndef SSA_H
+#define SSA_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "op.h"
+
+
+//////////////////////////////////////////
+// Instruction Set
+//////////////////////////////////////////
+
+// Operands are other instructions. Arithmetic operands have the type of
+// the instruction, the conversions are explicit.
+enum SsaOpcode
+{
+    SSA_CONST=0,    //                  value
+    SSA_PARAM,      //                  the index'th argument
+    SSA_PHI,        // one per predecessor, in the order of preds
+    SSA_ADD,        // a b
+    SSA_SUB,
+    SSA_MUL,
+    SSA_DIV,
+    SSA_POW,
+    SSA_NEG,        // a
+    SSA_I2R,        // a                a widened to a real
+    SSA_R2I,        // a                a truncated to an integer
+    SSA_EQ,         // a b              1 if a == b, else 0
+    SSA_NE,         // a b              1 if a != b, else 0
+    SSA_LOAD,       //                  the variable sym
+    SSA_STORE,      // a                the variable sym = a
+    SSA_DECLARE,    //                  declare sym with the instruction's type
+    SSA_DEFINE,     //                  bind sym to function fun
+    SSA_CALL,       // args...          call sym
+    SSA_PRINT,      // a
+    SSA_JUMP,       //                  go to targets[0]
+    SSA_BRANCH,     // a                targets[0] if a is not zero, else targets[1]
+    SSA_RETURN,     // [a]
+    SSA_COUNT
+};
+
+// convert opcodes to strings
+extern const char *SSASTR[];
+
+struct SsaBlock;
+struct SsaInstr;
+struct SsaFunction;
+
+
+struct SsaInstr
+{
+    int id;
+    SsaOpcode op;
+    ResultType type;                // VOID if there is no value
+    std::vector<SsaInstr*> args;
+    SsaBlock *block;                // nullptr once removed
+
+    Result value;                   // CONST
+    int index;                      // PARAM
+    const Symbol *sym;              // LOAD, STORE, DECLARE, DEFINE and CALL
+    SsaFunction *fun;               // DEFINE
+    bool tail;                      // CALL, which starts its function again
+    std::vector<SsaBlock*> targets; // JUMP and BRANCH
+
+    // true for arithmetic which depends only on its operands
+    bool is_pure() const;
+
+    // true if the instruction must run even if its value is not used
+    bool has_effect() const;
+
+    // true for the instructions which end a block
+    bool is_terminator() const;
+};
+
+
+struct SsaBlock
+{
+    int id;
+    std::vector<SsaInstr*> instrs;  // phis first, ending with a terminator
+    std::vector<SsaBlock*> preds;
+
+    // the last instruction, which says where control goes
+    SsaInstr *terminator() const;
+
+    // the number of phis at the start of the block
+    int phis() const;
+
+    // forget a predecessor, and its operand of each phi
+    void remove_pred(SsaBlock *pred);
+};
+
+
+// A function owns its blocks and instructions. The top level program is
+// a function whose environment is the global scope.
+struct SsaFunction
+{
+    SsaFunction(const std::string &name);
+    ~SsaFunction();
+
+    std::string name;
+    FunctionDef *def;               // nullptr for the top level
+    ResultType return_type;
+    std::vector<ResultType> params;
+    int frame_size;                 // variables kept in the environment
+    std::vector<SsaBlock*> blocks;  // the entry first
+
+    // make a new instruction or block
+    SsaInstr *instr(SsaOpcode op, ResultType type);
+    SsaBlock *block();
+
+    // the number of instruction ids used
+    int values() const;
+
+    // make every use of one instruction a use of another
+    void replace_uses(SsaInstr *from, SsaInstr *to);
+
+    // take an instruction out of its block
+    void remove(SsaInstr *instr);
+
+    // throw a runtime error if the graph is malformed
+    void verify() const;
+
+    // print a readable listing of the function
+    void print(std::ostream &os) const;
+
+private:
+    std::vector<SsaInstr*> _instrs;
+    int _next_block;
+
+    SsaFunction(const SsaFunction &) = delete;
+    SsaFunction &operator=(const SsaFunction &) = delete;
+};
+
+
+// A lowered program. functions[0] is the top level.
+struct SsaProgram
+{
+    ~SsaProgram();
+
+    std::vector<SsaFunction*> functions;
+
+    // the number of instructions in the program
+    int size() const;
+
+    // print a readable listing of the program
+    void print(std::ostream &os) const;
+};
+
+
+// compute a pure instruction from the values of its operands
+Result ssa_compute(const SsaInstr *instr, const Result &a, const Result &b);
+
+
+//////////////////////////////////////////
+// Lowering
+//////////////////////////////////////////
+
+// Translate a type checked program into SSA form. Phis are placed as
+// variables are read, looking back through the predecessors of each
+// block. A loop header is not sealed until its body has been lowered,
+// so the phis it needs are left incomplete until then.
+class SsaBuilder
+{
+public:
+    virtual SsaProgram *build(ParseTree *program);
+
+protected:
+    // lower a function body, returning the new function
+    virtual SsaFunction *function(const std::string &name, FunctionDef *def, Program *body);
+
+    // statements, returning the value of the last if it is an expression
+    virtual SsaInstr *block(Program *block);
+    virtual SsaInstr *stmt(ParseTree *tree);
+    virtual void loop(While *loop);
+    virtual void branch(Branch *branch);
+
+    // expressions
+    virtual SsaInstr *expr(ParseTree *tree);
+    virtual SsaInstr *expr_as(ParseTree *tree, ResultType type);
+    virtual SsaInstr *convert(SsaInstr *val, ResultType type);
+    virtual SsaInstr *call(FunctionCall *call);
+    virtual SsaInstr *constant(Result val);
+
+    // add an instruction to the current block
+    virtual SsaInstr *emit(SsaOpcode op, ResultType type);
+    virtual SsaInstr *emit(SsaOpcode op, ResultType type, SsaInstr *a);
+    virtual SsaInstr *emit(SsaOpcode op, ResultType type, SsaInstr *a, SsaInstr *b);
+
+    // end the current block
+    virtual void jump(SsaBlock *target);
+    virtual void branch(SsaInstr *test, SsaBlock *yes, SsaBlock *no);
+
+    // the values of promoted variables
+    virtual void write(const Symbol *var, SsaBlock *block, SsaInstr *val);
+    virtual SsaInstr *read(const Symbol *var, SsaBlock *block);
+    virtual SsaInstr *read_recursive(const Symbol *var, SsaBlock *block);
+    virtual SsaInstr *add_phi_operands(const Symbol *var, SsaInstr *phi);
+    virtual SsaInstr *remove_trivial_phi(SsaInstr *phi);
+    virtual void seal(SsaBlock *block);
+
+    // the value of a variable read before it is assigned
+    virtual SsaInstr *undefined(ResultType type);
+
+    // true if the variable is a value rather than an environment slot
+    virtual bool promoted(const Symbol *var);
+
+private:
+    // the state of the function being lowered
+    struct Frame
+    {
+        Frame *outer;                                   // the enclosing scope
+        SsaFunction *fun;
+        SsaBlock *current;
+        std::map<const Symbol*, ResultType> vars;       // promoted variables
+        std::map<const Symbol*, std::map<SsaBlock*, SsaInstr*> > defs;
+        std::map<SsaBlock*, std::map<const Symbol*, SsaInstr*> > incomplete;
+        std::set<SsaBlock*> sealed;
+        std::map<std::string, FunctionDef*> functions;  // defined in the scope
+    };
+    Frame *_frame;
+
+    SsaProgram *_program;
+};
+
+
+//////////////////////////////////////////
+// Execution
+//////////////////////////////////////////
+
+// Run a lowered program. Functions are bound and found in the
+// environment as the tree walker does, and tail calls run in constant
+// space.
+class SsaInterpreter
+{
+public:
+    virtual void run(SsaProgram *program, RefEnv &global);
+
+protected:
+    // call a function declared in scope
+    virtual Result call(SsaFunction *fun, RefEnv *scope, std::vector<Result> &args);
+
+    // run a function body in its environment. A tail call replaces args
+    // and sets tail instead of returning a value.
+    virtual Result execute(SsaFunction *fun, RefEnv &env, std::vector<Result> &args, bool &tail);
+};
+
+
+//////////////////////////////////////////
+// Passes
+//////////////////////////////////////////
+
+// A pass which rewrites one function at a time
+class SsaPass
+{
+public:
+    virtual ~SsaPass();
+
+    // the name reported by the pass manager
+    virtual const char *name() const=0;
+
+    // rewrite a function, returning the number of changes made
+    virtual int run(SsaFunction *fun)=0;
+};
+
+
+// In SSA form the only copies left are phis whose operands are all one
+// value, other than the phi itself. Each is replaced by that value.
+class CopyPropagation : public SsaPass
+{
+public:
+    virtual const char *name() const;
+    virtual int run(SsaFunction *fun);
+};
+
+
+// Sparse conditional constant propagation. Values are assumed constant
+// until shown otherwise, and only blocks reachable through the branches
+// taken so far are considered. Constant values are folded, branches on
+// constants become jumps and unreachable blocks are removed. Operations
+// which would raise an error are left to raise it when they run.
+class ConstantPropagation : public SsaPass
+{
+public:
+    virtual const char *name() const;
+    virtual int run(SsaFunction *fun);
+
+protected:
+    // what is known of a value: nothing yet, one constant, or that it varies
+    enum State
+    {
+        UNKNOWN,
+        CONSTANT,
+        VARYING
+    };
+
+    // find the constants and the reachable blocks
+    virtual void analyze(SsaFunction *fun);
+    virtual void visit(SsaInstr *instr);
+    virtual void reach(SsaBlock *from, SsaBlock *to);
+    virtual void lower(SsaInstr *instr, State state, const Result &value);
+
+    // the value of an arithmetic instruction on constant operands, false
+    // if it raises an error
+    virtual bool fold(SsaInstr *instr, Result &result);
+
+    // rewrite the function with what was found
+    virtual int rewrite(SsaFunction *fun);
+
+private:
+    std::vector<State> _state;
+    std::vector<Result> _value;
+    std::vector<std::vector<SsaInstr*> > _users;
+    std::set<std::pair<SsaBlock*, SsaBlock*> > _edges;
+    std::set<SsaBlock*> _reachable;
+    std::vector<SsaBlock*> _blocks;     // blocks with a newly taken edge
+    std::vector<SsaInstr*> _instrs;     // instructions with changed operands
+};
+
+
+// Remove instructions whose values are never used by anything which has
+// an effect, including cycles of phis which only use each other.
+class DeadCodeElimination : public SsaPass
+{
+public:
+    virtual const char *name() const;
+    virtual int run(SsaFunction *fun);
+};
+
+
+// Global value numbering. Walking the dominator tree, a pure instruction
+// which repeats one that dominates it is replaced by the first.
+class ValueNumbering : public SsaPass
+{
+public:
+    virtual const char *name() const;
+    virtual int run(SsaFunction *fun);
+
+protected:
+    // a string which is equal for instructions computing the same value
+    virtual std::string key(SsaInstr *instr);
+
+    // number the instructions in a block and those it dominates
+    virtual void visit(SsaFunction *fun, SsaBlock *block,
+                       std::map<SsaBlock*, std::vector<SsaBlock*> > &children,
+                       std::map<std::string, SsaInstr*> &available);
+
+    int _count;
+};
+
+
+// Run a sequence of passes over every function of a program, verifying
+// the graph after each and timing them.
+class SsaPassManager
+{
+public:
+    SsaPassManager();
+    virtual ~SsaPassManager();
+
+    // add a pass to the end of the sequence, the manager deletes it
+    virtual void add(SsaPass *pass);
+
+    // run the sequence, rounds times over
+    virtual void run(SsaProgram *program, int rounds=1);
+
+    // print the changes and time of each pass
+    virtual void report(std::ostream &os) const;
+
+private:
+    struct Entry
+    {
+        SsaPass *pass;
+        int changes;
+        double seconds;
+    };
+    std::vector<Entry> _passes;
+};
+#endif
@@ -0,0 +1,518 @@
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include "ssa.h"
+
+//////////////////////////////////////////
+// SsaPass Implementation
+//////////////////////////////////////////
+
+SsaPass::~SsaPass()
+{
+}
+
+
+//////////////////////////////////////////
+// CopyPropagation Implementation
+//////////////////////////////////////////
+
+const char *CopyPropagation::name() const
+{
+    return "copy propagation";
+}
+
+
+int CopyPropagation::run(SsaFunction *fun)
+{
+    int count = 0;
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(auto bitr = fun->blocks.begin(); bitr != fun->blocks.end(); bitr++) {
+            SsaBlock *block = *bitr;
+            for(int i=0; i<block->phis(); i++) {
+                SsaInstr *phi = block->instrs[i];
+                SsaInstr *same = nullptr;
+                bool copy = true;
+                for(auto arg = phi->args.begin(); arg != phi->args.end() and copy; arg++) {
+                    if(*arg == phi or *arg == same) continue;
+                    copy = not same;
+                    same = *arg;
+                }
+                if(not copy or not same) continue;
+
+                fun->replace_uses(phi, same);
+                fun->remove(phi);
+                count++;
+                changed = true;
+                i--;
+            }
+        }
+    }
+    return count;
+}
+
+
+//////////////////////////////////////////
+// ConstantPropagation Implementation
+//////////////////////////////////////////
+
+const char *ConstantPropagation::name() const
+{
+    return "constant propagation";
+}
+
+
+int ConstantPropagation::run(SsaFunction *fun)
+{
+    analyze(fun);
+    return rewrite(fun);
+}
+
+
+// Propagate from the entry until nothing changes. A block is visited in
+// full when it is first reached, and its phis again for each new edge.
+void ConstantPropagation::analyze(SsaFunction *fun)
+{
+    int n = fun->values();
+    _state.assign(n, UNKNOWN);
+    _value.assign(n, Result());
+    _users.assign(n, std::vector<SsaInstr*>());
+    _edges.clear();
+    _reachable.clear();
+    _blocks.clear();
+    _instrs.clear();
+
+    for(auto block = fun->blocks.begin(); block != fun->blocks.end(); block++) {
+        for(auto instr = (*block)->instrs.begin(); instr != (*block)->instrs.end(); instr++) {
+            for(auto arg = (*instr)->args.begin(); arg != (*instr)->args.end(); arg++) {
+                _users[(*arg)->id].push_back(*instr);
+            }
+        }
+    }
+
+    _blocks.push_back(fun->blocks[0]);
+    while(not _blocks.empty() or not _instrs.empty()) {
+        if(not _blocks.empty()) {
+            SsaBlock *block = _blocks.back();
+            _blocks.pop_back();
+            int n = _reachable.insert(block).second ? block->instrs.size() : block->phis();
+            for(int i=0; i<n; i++) {
+                visit(block->instrs[i]);
+            }
+        } else {
+            SsaInstr *instr = _instrs.back();
+            _instrs.pop_back();
+            if(instr->block and _reachable.count(instr->block)) {
+                visit(instr);
+            }
+        }
+    }
+}
+
+
+void ConstantPropagation::visit(SsaInstr *instr)
+{
+    SsaBlock *block = instr->block;
+    switch(instr->op) {
+        case SSA_PHI: {
+            // the meet of the operands from the edges taken so far
+            State state = UNKNOWN;
+            Result value;
+            for(int i=0; i<(int) instr->args.size() and state != VARYING; i++) {
+                SsaInstr *arg = instr->args[i];
+                if(not _edges.count(std::make_pair(block->preds[i], block)) or _state[arg->id] == UNKNOWN) {
+                    continue;
+                } else if(_state[arg->id] == VARYING) {
+                    state = VARYING;
+                } else if(state == UNKNOWN) {
+                    state = CONSTANT;
+                    value = _value[arg->id];
+                } else if(value.bits() != _value[arg->id].bits()) {
+                    state = VARYING;
+                }
+            }
+            if(state != UNKNOWN) {
+                lower(instr, state, value);
+            }
+            break;
+        }
+
+        case SSA_JUMP:
+            reach(block, instr->targets[0]);
+            break;
+
+        case SSA_BRANCH: {
+            SsaInstr *test = instr->args[0];
+            if(_state[test->id] == CONSTANT) {
+                reach(block, instr->targets[NUM_RESULT(_value[test->id]) != 0 ? 0 : 1]);
+            } else if(_state[test->id] == VARYING) {
+                reach(block, instr->targets[0]);
+                reach(block, instr->targets[1]);
+            }
+            break;
+        }
+
+        default:
+            if(instr->is_pure()) {
+                // a value is unknown until its operands are known
+                for(auto arg = instr->args.begin(); arg != instr->args.end(); arg++) {
+                    if(_state[(*arg)->id] == UNKNOWN) return;
+                    if(_state[(*arg)->id] == VARYING) {
+                        lower(instr, VARYING, Result());
+                        return;
+                    }
+                }
+                Result value;
+                if(fold(instr, value)) {
+                    lower(instr, CONSTANT, value);
+                } else {
+                    lower(instr, VARYING, value);
+                }
+            } else if(instr->type != VOID) {
+                lower(instr, VARYING, Result());
+            }
+    }
+}
+
+
+// take an edge of the graph
+void ConstantPropagation::reach(SsaBlock *from, SsaBlock *to)
+{
+    if(_edges.insert(std::make_pair(from, to)).second) {
+        _blocks.push_back(to);
+    }
+}
+
+
+// Values only move down from unknown to constant to varying, so the
+// propagation ends.
+void ConstantPropagation::lower(SsaInstr *instr, State state, const Result &value)
+{
+    if(state <= _state[instr->id]) {
+        return;
+    }
+    _state[instr->id] = state;
+    _value[instr->id] = value;
+    _instrs.insert(_instrs.end(), _users[instr->id].begin(), _users[instr->id].end());
+}
+
+
+// the value of an arithmetic instruction on constant operands, false if
+// it raises an error
+bool ConstantPropagation::fold(SsaInstr *instr, Result &result)
+{
+    Result none;
+    const Result &a = instr->args.size() > 0 ? _value[instr->args[0]->id] : none;
+    const Result &b = instr->args.size() > 1 ? _value[instr->args[1]->id] : none;
+    try {
+        result = ssa_compute(instr, a, b);
+    } catch(std::runtime_error &e) {
+        return false;
+    }
+    return true;
+}
+
+
+// rewrite the function with what was found
+int ConstantPropagation::rewrite(SsaFunction *fun)
+{
+    int count = 0;
+    std::vector<SsaBlock*> blocks;
+    for(auto bitr = fun->blocks.begin(); bitr != fun->blocks.end(); bitr++) {
+        SsaBlock *block = *bitr;
+        if(not _reachable.count(block)) {
+            continue;
+        }
+        blocks.push_back(block);
+
+        // constants become literals, with phis moving past the others
+        std::vector<SsaInstr*> instrs = block->instrs;
+        for(auto itr = instrs.begin(); itr != instrs.end(); itr++) {
+            SsaInstr *instr = *itr;
+            if(_state[instr->id] != CONSTANT or instr->op == SSA_CONST) {
+                continue;
+            }
+            if(instr->op == SSA_PHI) {
+                fun->remove(instr);
+                instr->block = block;
+                block->instrs.insert(block->instrs.begin() + block->phis(), instr);
+            }
+            instr->op = SSA_CONST;
+            instr->args.clear();
+            instr->value = _value[instr->id];
+            count++;
+        }
+
+        // a branch on a constant always goes the same way
+        SsaInstr *last = block->terminator();
+        if(last->op == SSA_BRANCH and _state[last->args[0]->id] == CONSTANT) {
+            int taken = NUM_RESULT(_value[last->args[0]->id]) != 0 ? 0 : 1;
+            if(last->targets[0] != last->targets[1]) {
+                last->targets[1 - taken]->remove_pred(block);
+            }
+            last->op = SSA_JUMP;
+            last->args.clear();
+            last->targets = std::vector<SsaBlock*>(1, last->targets[taken]);
+            count++;
+        }
+    }
+
+    // the blocks never reached are removed
+    for(auto bitr = fun->blocks.begin(); bitr != fun->blocks.end(); bitr++) {
+        SsaBlock *block = *bitr;
+        if(_reachable.count(block)) {
+            continue;
+        }
+        SsaInstr *last = block->terminator();
+        for(auto target = last->targets.begin(); target != last->targets.end(); target++) {
+            if(_reachable.count(*target)) {
+                (*target)->remove_pred(block);
+            }
+        }
+        for(auto instr = block->instrs.begin(); instr != block->instrs.end(); instr++) {
+            (*instr)->block = nullptr;
+        }
+        delete block;
+        count++;
+    }
+    fun->blocks = blocks;
+
+    return count;
+}
+
+
+//////////////////////////////////////////
+// DeadCodeElimination Implementation
+//////////////////////////////////////////
+
+const char *DeadCodeElimination::name() const
+{
+    return "dead code elimination";
+}
+
+
+// mark what is used by the instructions with effects, and sweep the rest
+int DeadCodeElimination::run(SsaFunction *fun)
+{
+    std::vector<bool> live(fun->values(), false);
+    std::vector<SsaInstr*> work;
+    for(auto block = fun->blocks.begin(); block != fun->blocks.end(); block++) {
+        for(auto instr = (*block)->instrs.begin(); instr != (*block)->instrs.end(); instr++) {
+            if((*instr)->has_effect()) {
+                live[(*instr)->id] = true;
+                work.push_back(*instr);
+            }
+        }
+    }
+
+    while(not work.empty()) {
+        SsaInstr *instr = work.back();
+        work.pop_back();
+        for(auto arg = instr->args.begin(); arg != instr->args.end(); arg++) {
+            if(not live[(*arg)->id]) {
+                live[(*arg)->id] = true;
+                work.push_back(*arg);
+            }
+        }
+    }
+
+    int count = 0;
+    for(auto block = fun->blocks.begin(); block != fun->blocks.end(); block++) {
+        std::vector<SsaInstr*> &instrs = (*block)->instrs;
+        for(int i=0; i<(int) instrs.size(); i++) {
+            if(not live[instrs[i]->id]) {
+                fun->remove(instrs[i]);
+                count++;
+                i--;
+            }
+        }
+    }
+    return count;
+}
+
+
+//////////////////////////////////////////
+// ValueNumbering Implementation
+//////////////////////////////////////////
+
+const char *ValueNumbering::name() const
+{
+    return "value numbering";
+}
+
+
+// Find the dominator tree, iterating over the blocks in reverse
+// postorder until the immediate dominators settle.
+int ValueNumbering::run(SsaFunction *fun)
+{
+    SsaBlock *entry = fun->blocks[0];
+
+    // reverse postorder from the entry
+    std::vector<SsaBlock*> order;
+    std::set<SsaBlock*> seen;
+    std::vector<std::pair<SsaBlock*, int> > stack(1, std::make_pair(entry, 0));
+    seen.insert(entry);
+    while(not stack.empty()) {
+        SsaBlock *block = stack.back().first;
+        std::vector<SsaBlock*> &targets = block->terminator()->targets;
+        int i = stack.back().second++;
+        if(i == (int) targets.size()) {
+            order.push_back(block);
+            stack.pop_back();
+        } else if(seen.insert(targets[i]).second) {
+            stack.push_back(std::make_pair(targets[i], 0));
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    std::map<SsaBlock*, int> position;
+    for(int i=0; i<(int) order.size(); i++) {
+        position[order[i]] = i;
+    }
+
+    std::map<SsaBlock*, SsaBlock*> idom;
+    idom[entry] = entry;
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(auto bitr = order.begin() + 1; bitr != order.end(); bitr++) {
+            SsaBlock *dom = nullptr;
+            for(auto pred = (*bitr)->preds.begin(); pred != (*bitr)->preds.end(); pred++) {
+                if(not idom.count(*pred)) {
+                    continue;
+                }
+                SsaBlock *other = *pred;
+                while(dom and dom != other) {
+                    while(position[dom] > position[other]) dom = idom[dom];
+                    while(position[other] > position[dom]) other = idom[other];
+                }
+                dom = other;
+            }
+            if(idom[*bitr] != dom) {
+                idom[*bitr] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    std::map<SsaBlock*, std::vector<SsaBlock*> > children;
+    for(auto bitr = order.begin() + 1; bitr != order.end(); bitr++) {
+        children[idom[*bitr]].push_back(*bitr);
+    }
+
+    _count = 0;
+    std::map<std::string, SsaInstr*> available;
+    visit(fun, entry, children, available);
+    return _count;
+}
+
+
+// a string which is equal for instructions computing the same value
+std::string ValueNumbering::key(SsaInstr *instr)
+{
+    std::ostringstream os;
+    os << instr->op << ":" << instr->type;
+    if(instr->op == SSA_CONST) {
+        os << ":" << instr->value.bits();
+    }
+
+    std::vector<int> args;
+    for(auto arg = instr->args.begin(); arg != instr->args.end(); arg++) {
+        args.push_back((*arg)->id);
+    }
+    if(instr->op == SSA_ADD or instr->op == SSA_MUL or instr->op == SSA_EQ or instr->op == SSA_NE) {
+        std::sort(args.begin(), args.end());
+    }
+    for(auto arg = args.begin(); arg != args.end(); arg++) {
+        os << ":" << *arg;
+    }
+    return os.str();
+}
+
+
+// The values available in a block are those of the blocks which dominate
+// it, so they are forgotten when the walk leaves the block.
+void ValueNumbering::visit(SsaFunction *fun, SsaBlock *block,
+                           std::map<SsaBlock*, std::vector<SsaBlock*> > &children,
+                           std::map<std::string, SsaInstr*> &available)
+{
+    std::vector<std::string> added;
+    std::vector<SsaInstr*> instrs = block->instrs;
+    for(auto itr = instrs.begin(); itr != instrs.end(); itr++) {
+        SsaInstr *instr = *itr;
+        if(not instr->is_pure()) {
+            continue;
+        }
+
+        std::string k = key(instr);
+        auto found = available.find(k);
+        if(found != available.end()) {
+            fun->replace_uses(instr, found->second);
+            fun->remove(instr);
+            _count++;
+        } else {
+            available[k] = instr;
+            added.push_back(k);
+        }
+    }
+
+    std::vector<SsaBlock*> &below = children[block];
+    for(auto child = below.begin(); child != below.end(); child++) {
+        visit(fun, *child, children, available);
+    }
+
+    for(auto k = added.begin(); k != added.end(); k++) {
+        available.erase(*k);
+    }
+}
+
+
+//////////////////////////////////////////
+// SsaPassManager Implementation
+//////////////////////////////////////////
+
+SsaPassManager::SsaPassManager()
+{
+}
+
+
+SsaPassManager::~SsaPassManager()
+{
+    for(auto itr = _passes.begin(); itr != _passes.end(); itr++) {
+        delete itr->pass;
+    }
+}
+
+
+// add a pass to the end of the sequence, the manager deletes it
+void SsaPassManager::add(SsaPass *pass)
+{
+    _passes.push_back(Entry{pass, 0, 0});
+}
+
+
+// run the sequence, rounds times over
+void SsaPassManager::run(SsaProgram *program, int rounds)
+{
+    for(int round=0; round<rounds; round++) {
+        for(auto entry = _passes.begin(); entry != _passes.end(); entry++) {
+            auto start = std::chrono::steady_clock::now();
+            for(auto fun = program->functions.begin(); fun != program->functions.end(); fun++) {
+                entry->changes += entry->pass->run(*fun);
+                (*fun)->verify();
+            }
+            auto stop = std::chrono::steady_clock::now();
+            entry->seconds += std::chrono::duration<double>(stop - start).count();
+        }
+    }
+}
+
+
+// print the changes and time of each pass
+void SsaPassManager::report(std::ostream &os) const
+{
+    for(auto entry = _passes.begin(); entry != _passes.end(); entry++) {
+        os << "    " << entry->pass->name() << ": " << entry->changes << " changes, "
+           << entry->seconds * 1000 << " ms" << std::endl;
+    }
+}
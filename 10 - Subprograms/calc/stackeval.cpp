@@ -0,0 +1,350 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "stackeval.h"
+
+//////////////////////////////////////////
+// StackEvaluator Implementation
+//////////////////////////////////////////
+
+// the depth is the number of calls which may be running at once
+StackEvaluator::StackEvaluator(long long max_depth)
+{
+    _max_depth = max_depth;
+    _deepest = 0;
+}
+
+
+StackEvaluator::~StackEvaluator()
+{
+    unwind();
+}
+
+
+// evaluate a tree, returning its value
+Result StackEvaluator::run(ParseTree *tree, RefEnv &env)
+{
+    size_t base = _values.size();
+    push(tree, &env);
+
+    try {
+        while(not _tasks.empty()) {
+            step();
+        }
+    } catch(...) {
+        // leave the evaluator ready for the next tree
+        unwind();
+        _tasks.clear();
+        _values.resize(base);
+        throw;
+    }
+
+    return pop();
+}
+
+
+// the deepest the calls went
+long long StackEvaluator::deepest() const
+{
+    return _deepest;
+}
+
+
+// classify a node, once
+StackEvaluator::Kind StackEvaluator::kind(ParseTree *tree)
+{
+    auto itr = _kinds.find(tree);
+    if(itr != _kinds.end()) return itr->second;
+
+    // only nodes with a call somewhere below need the explicit stack
+    Kind result = EVAL;
+    bool calls = false;
+    if(dynamic_cast<FunctionCall*>(tree)) {
+        result = CALL;
+    } else if(dynamic_cast<FunctionDef*>(tree)) {
+        // defining a function runs none of it
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        for(auto child = block->begin(); child != block->end(); child++) {
+            calls = kind(*child) != EVAL or calls;
+        }
+        result = PROGRAM;
+    } else if(BinaryOp *op = dynamic_cast<BinaryOp*>(tree)) {
+        calls = kind(op->left()) != EVAL;
+        calls = kind(op->right()) != EVAL or calls;
+        if(dynamic_cast<While*>(tree)) {
+            result = LOOP;
+        } else if(dynamic_cast<Branch*>(tree)) {
+            result = BRANCH;
+        } else if(dynamic_cast<Assign*>(tree)) {
+            result = ASSIGN;
+        } else {
+            result = BINARY;
+        }
+    } else if(UnaryOp *op = dynamic_cast<UnaryOp*>(tree)) {
+        calls = kind(op->child()) != EVAL;
+        result = dynamic_cast<Print*>(tree) ? PRINT : NEG;
+    }
+
+    if(result != CALL and not calls) {
+        result = EVAL;
+    }
+    _kinds[tree] = result;
+    return result;
+}
+
+
+// do the next step of the task on top of the stack
+void StackEvaluator::step()
+{
+    // pushing moves the tasks, so work with a copy
+    Task task = _tasks.back();
+    _tasks.back().step++;
+
+    switch(kind(task.tree)) {
+        case EVAL:
+            _tasks.pop_back();
+            _values.push_back(task.tree->eval(*task.env));
+            break;
+
+        case PROGRAM: {
+            // programs keep the value of their last statement
+            Program *block = (Program*) task.tree;
+            if(task.step > 0) {
+                if(task.step == block->size()) {
+                    _tasks.pop_back();
+                    break;
+                }
+                pop();
+            } else if(block->size() == 0) {
+                _tasks.pop_back();
+                _values.push_back(Result());
+                break;
+            }
+            push(*(block->begin() + task.step), task.env);
+            break;
+        }
+
+        case BINARY: {
+            BinaryOp *op = (BinaryOp*) task.tree;
+            if(task.step == 0) {
+                push(op->left(), task.env);
+            } else if(task.step == 1) {
+                push(op->right(), task.env);
+            } else {
+                _tasks.pop_back();
+                Result r = pop();
+                Result l = pop();
+                _values.push_back(op->combine(l, r));
+            }
+            break;
+        }
+
+        case NEG:
+            if(task.step == 0) {
+                push(((Neg*) task.tree)->child(), task.env);
+            } else {
+                _tasks.pop_back();
+                Result &val = _values.back();
+                if(val.type() == INTEGER) {
+                    val.i(NegFn::apply(val.i()));
+                } else {
+                    val.r(-val.r());
+                }
+            }
+            break;
+
+        case PRINT:
+            if(task.step == 0) {
+                push(((Print*) task.tree)->child(), task.env);
+            } else {
+                _tasks.pop_back();
+                std::cout << pop() << std::endl;
+                _values.push_back(Result());
+            }
+            break;
+
+        case ASSIGN: {
+            Assign *assign = (Assign*) task.tree;
+            if(task.step == 0) {
+                push(assign->right(), task.env);
+            } else {
+                _tasks.pop_back();
+                Result val = pop();
+                Result &var = (*task.env)[((Var*) assign->left())->symbol()];
+                NUM_ASSIGN(var, NUM_RESULT(val));
+                _values.push_back(Result());
+            }
+            break;
+        }
+
+        case LOOP:
+        case BRANCH: {
+            // odd steps have the condition's value, even steps the body's
+            BinaryOp *op = (BinaryOp*) task.tree;
+            if(task.step % 2 == 0) {
+                if(task.step > 0) {
+                    pop();
+                }
+                if(task.step > 0 and kind(task.tree) == BRANCH) {
+                    _tasks.pop_back();
+                    _values.push_back(Result());
+                } else {
+                    push(op->left(), task.env);
+                }
+                break;
+            }
+
+            Result test = pop();
+            if(NUM_RESULT(test) != 0) {
+                push(op->right(), task.env);
+            } else {
+                _tasks.pop_back();
+                _values.push_back(Result());
+            }
+            break;
+        }
+
+        case CALL:
+            call((FunctionCall*) task.tree, task.env, task.step);
+            break;
+    }
+}
+
+
+// The steps of a call evaluate each argument, then enter the function,
+// then leave it once its body has a value.
+void StackEvaluator::call(FunctionCall *call, RefEnv *env, int step)
+{
+    ArgList *args = (ArgList*) call->right();
+    int nargs = args->size();
+    if(step < nargs) {
+        push(args->child(step), env);
+    } else if(step == nargs) {
+        enter(call, env);
+    } else {
+        leave();
+    }
+}
+
+
+void StackEvaluator::enter(FunctionCall *call, RefEnv *env)
+{
+    // find the function and the scope it was declared in
+    const Symbol *name = ((Var*) call->left())->symbol();
+    RefEnv *scope = env->owner(name);
+    FunctionDef *fun = (FunctionDef*) (*scope)[name].ptr();
+    int nargs = ((ArgList*) call->right())->size();
+
+    // A tail call replaces the frame of the call it is in. Everything
+    // that call was doing is abandoned, and its body starts again.
+    if(call->tail() and not _calls.empty()) {
+        Call &frame = _calls.back();
+        std::vector<Result> values(_values.end() - nargs, _values.end());
+        _tasks.resize(frame.task + 1);
+        _values.resize(frame.values);
+        _values.insert(_values.end(), values.begin(), values.end());
+        delete frame.env;
+        Program *body = fun->body();
+        frame.env = bind(fun, body, scope, nargs);
+        push(body, frame.env);
+        return;
+    }
+
+    // a pure function may remember the result already
+    Call frame;
+    frame.memo = false;
+    if(Memo *memo = fun->memo()) {
+        for(int i=0; i<nargs; i++) {
+            frame.key[i] = NUM_RESULT(_values[_values.size() - nargs + i]);
+        }
+        Result *known = memo->find(frame.key);
+        if(known) {
+            _values.resize(_values.size() - nargs);
+            _tasks.pop_back();
+            _values.push_back(*known);
+            return;
+        }
+        frame.memo = true;
+    }
+
+    if((long long) _calls.size() >= _max_depth) {
+        throw std::runtime_error("Stack overflow: more than " + std::to_string(_max_depth)
+                                 + " nested calls.");
+    }
+
+    frame.fun = fun;
+    frame.task = _tasks.size() - 1;
+    Program *body = fun->body();
+    frame.env = bind(fun, body, scope, nargs);
+    frame.values = _values.size();
+    _calls.push_back(frame);
+    if((long long) _calls.size() > _deepest) {
+        _deepest = _calls.size();
+    }
+    push(body, frame.env);
+}
+
+
+void StackEvaluator::leave()
+{
+    Call frame = _calls.back();
+    _calls.pop_back();
+    _tasks.pop_back();
+    Result body_result = pop();
+    delete frame.env;
+
+    // convert the body's value to the declared return type
+    Result result;
+    result.type(frame.fun->return_type());
+    if(result.type() != VOID) {
+        NUM_ASSIGN(result, NUM_RESULT(body_result));
+    }
+
+    if(frame.memo) {
+        frame.fun->memo()->store(frame.key, result);
+    }
+    _values.push_back(result);
+}
+
+
+// start a function body with arguments from the top of the value stack
+RefEnv *StackEvaluator::bind(FunctionDef *fun, Program *body, RefEnv *scope, int nargs)
+{
+    // the frame is sized for the body which will run in it
+    RefEnv *local = new RefEnv(scope, fun->frame_size(body));
+    ArgList *params = fun->parameters();
+    Result *values = _values.data() + _values.size() - nargs;
+    for(int i=0; i<nargs; i++) {
+        VarDecl *vdec = (VarDecl*) params->child(i);
+        vdec->eval(*local);
+
+        // arguments are converted to the parameter type, just like assignment
+        NUM_ASSIGN((*local)[((Var*) vdec->child())->symbol()], NUM_RESULT(values[i]));
+    }
+    _values.resize(_values.size() - nargs);
+    return local;
+}
+
+
+// delete the frames of the calls still running, innermost first
+void StackEvaluator::unwind()
+{
+    while(not _calls.empty()) {
+        delete _calls.back().env;
+        _calls.pop_back();
+    }
+}
+
+
+void StackEvaluator::push(ParseTree *tree, RefEnv *env)
+{
+    _tasks.push_back(Task{tree, env, 0});
+}
+
+
+Result StackEvaluator::pop()
+{
+    Result result = _values.back();
+    _values.pop_back();
+    return result;
+}
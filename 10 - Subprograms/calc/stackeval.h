@@ -0,0 +1,90 @@
+// This file contains an evaluator which keeps calc calls off the C++
+// stack. Its continuations and call frames live on growable stacks in
+// the heap, so recursion is limited only by a configurable depth, and a
+// program which goes deeper stops with a runtime error instead of
+// crashing. Subtrees which make no calls have a depth fixed by the
+// source, so they are handed to the tree walker as they are.
+#ifndef STACKEVAL_H
+#define STACKEVAL_H
+#include <vector>
+#include <unordered_map>
+#include "op.h"
+#include "memo.h"
+
+
+class StackEvaluator
+{
+public:
+    // the depth is the number of calls which may be running at once
+    StackEvaluator(long long max_depth=1000000);
+    virtual ~StackEvaluator();
+
+    // evaluate a tree, returning its value
+    virtual Result run(ParseTree *tree, RefEnv &env);
+
+    // the deepest the calls went
+    virtual long long deepest() const;
+
+protected:
+    // how a node is evaluated
+    enum Kind
+    {
+        EVAL,       // no calls below, so the tree walker can have it
+        PROGRAM,
+        BINARY,
+        NEG,
+        PRINT,
+        ASSIGN,
+        LOOP,
+        BRANCH,
+        CALL
+    };
+
+    // a node part way through evaluation, step counts its finished parts
+    struct Task
+    {
+        ParseTree *tree;
+        RefEnv *env;
+        int step;
+    };
+
+    // a running call
+    struct Call
+    {
+        FunctionDef *fun;
+        RefEnv *env;
+        size_t task;            // the call's task
+        size_t values;          // the value stack when the body started
+        bool memo;              // store the result under key
+        int key[Memo::MAX_ARGS];
+    };
+
+    // classify a node, once
+    virtual Kind kind(ParseTree *tree);
+
+    // do the next step of the task on top of the stack
+    virtual void step();
+
+    // the steps of a call
+    virtual void call(FunctionCall *call, RefEnv *env, int step);
+    virtual void enter(FunctionCall *call, RefEnv *env);
+    virtual void leave();
+
+    // start a function body with arguments from the top of the value stack
+    virtual RefEnv *bind(FunctionDef *fun, Program *body, RefEnv *scope, int nargs);
+
+    // delete the frames of the calls still running
+    virtual void unwind();
+
+    virtual void push(ParseTree *tree, RefEnv *env);
+    virtual Result pop();
+
+private:
+    std::vector<Task> _tasks;
+    std::vector<Result> _values;
+    std::vector<Call> _calls;
+    std::unordered_map<ParseTree*, Kind> _kinds;
+    long long _max_depth;
+    long long _deepest;
+};
+#endif
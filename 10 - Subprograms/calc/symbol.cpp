@@ -0,0 +1,39 @@
+#include <unordered_map>
+#include <mutex>
+#include "symbol.h"
+
+//////////////////////////////////////////
+// Symbol Implementation
+//////////////////////////////////////////
+
+// Symbols live as long as the program. The optimizing tier builds trees
+// on its own thread, so the table is locked.
+static std::unordered_map<std::string, Symbol*> symbols;
+static std::mutex symbols_lock;
+
+
+Symbol::Symbol(const std::string &name)
+{
+    _name = name;
+    _hash = std::hash<std::string>()(name);
+}
+
+
+// the one symbol for a name, created the first time it is seen
+const Symbol *Symbol::intern(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(symbols_lock);
+    Symbol *&sym = symbols[name];
+    if(not sym) {
+        sym = new Symbol(name);
+    }
+    return sym;
+}
+
+
+// the number of distinct names interned
+int Symbol::count()
+{
+    std::lock_guard<std::mutex> guard(symbols_lock);
+    return symbols.size();
+}
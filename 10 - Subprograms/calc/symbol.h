@@ -0,0 +1,28 @@
+// This file contains the interned symbols which name calc variables and
+// functions. Every distinct name has exactly one symbol, so names are
+// compared by address and hashed only once, when they are interned.
+#ifndef SYMBOL_H
+#define SYMBOL_H
+#include <string>
+
+
+class Symbol
+{
+public:
+    // the one symbol for a name, created the first time it is seen
+    static const Symbol *intern(const std::string &name);
+
+    // the name and its precomputed hash
+    const std::string &name() const { return _name; }
+    size_t hash() const { return _hash; }
+
+    // the number of distinct names interned
+    static int count();
+
+private:
+    Symbol(const std::string &name);
+
+    std::string _name;
+    size_t _hash;
+};
+#endif
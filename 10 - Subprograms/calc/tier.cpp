@@ -0,0 +1,172 @@
+#include <iostream>
+#include <stdexcept>
+#include "tier.h"
+#include "optimize.h"
+
+//////////////////////////////////////////
+// TierManager Implementation
+//////////////////////////////////////////
+
+// thresholds are calls to a function and iterations of one of its loops
+TierManager::TierManager(long long call_threshold, long long loop_threshold)
+{
+    Profiler::call_threshold = call_threshold;
+    Profiler::loop_threshold = loop_threshold;
+    _stop = false;
+    _promoted = 0;
+    _resolved = 0;
+}
+
+
+TierManager::~TierManager()
+{
+    if(Profiler::active == this) {
+        Profiler::active = nullptr;
+    }
+
+    // abandon any queued work
+    if(_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stop = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    for(auto itr = _retired.begin(); itr != _retired.end(); itr++) {
+        delete *itr;
+    }
+}
+
+
+// start profiling a checked program
+void TierManager::watch(ParseTree *program)
+{
+    find_loops(program, nullptr);
+    Profiler::active = this;
+    _thread = std::thread(&TierManager::worker, this);
+}
+
+
+// queue hot code for the optimizing tier
+void TierManager::hot(FunctionDef *fun)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(not _queued.insert(fun).second) return;
+        _queue.push_back(fun);
+    }
+    _wake.notify_one();
+}
+
+
+// a loop running at the top level has nothing to switch to
+void TierManager::hot(While *loop)
+{
+    auto itr = _loop_owner.find(loop);
+    if(itr != _loop_owner.end()) {
+        hot(itr->second);
+    }
+}
+
+
+// the number of functions running optimized code
+int TierManager::promoted() const
+{
+    return _promoted;
+}
+
+
+// the number of variable accesses resolved to frame slots
+int TierManager::resolved() const
+{
+    return _resolved;
+}
+
+
+// record which function each loop belongs to
+void TierManager::find_loops(ParseTree *tree, FunctionDef *owner)
+{
+    if(While *loop = dynamic_cast<While*>(tree)) {
+        if(owner) {
+            _loop_owner[loop] = owner;
+        }
+        find_loops(loop->right(), owner);
+    } else if(Branch *branch = dynamic_cast<Branch*>(tree)) {
+        find_loops(branch->right(), owner);
+    } else if(FunctionDef *fun = dynamic_cast<FunctionDef*>(tree)) {
+        find_loops(fun->body(), fun);
+    } else if(Program *block = dynamic_cast<Program*>(tree)) {
+        for(auto itr = block->begin(); itr != block->end(); itr++) {
+            find_loops(*itr, owner);
+        }
+    }
+}
+
+
+// the compiler thread
+void TierManager::worker()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    for(;;) {
+        _wake.wait(lock, [this] { return _stop or not _queue.empty(); });
+        if(_stop) return;
+
+        FunctionDef *fun = _queue.front();
+        _queue.pop_front();
+
+        // the main thread keeps running the baseline body meanwhile
+        lock.unlock();
+        Program *body = optimize(fun);
+        lock.lock();
+
+        if(body) {
+            _retired.push_back(fun->body());
+            fun->body(body);
+            _promoted++;
+        }
+    }
+}
+
+
+// build an optimized copy of a function's body
+Program *TierManager::optimize(FunctionDef *fun)
+{
+    Program *body;
+    try {
+        body = (Program*) clone_tree(fun->body());
+    } catch(std::runtime_error &e) {
+        return nullptr;
+    }
+
+    // the same passes the whole program gets without tiering
+    ConstantFolder folder;
+    folder.run(body);
+    LoopInvariantMotion licm;
+    licm.run(body);
+    CommonSubexpressions cse;
+    cse.run(body);
+    Specializer specializer;
+    specializer.run(body);
+
+    // then the variables of the body, and of functions nested in it, are
+    // found by their position in the frame
+    SlotResolver resolver;
+    resolver.resolve(fun, body);
+    _resolved += resolver.count();
+
+    Superinstructions fuser;
+    fuser.run(body);
+
+    // functions nested in the copy are already optimized
+    std::vector<ParseTree*> stmts(body->begin(), body->end());
+    std::lock_guard<std::mutex> guard(_lock);
+    for(auto itr = stmts.begin(); itr != stmts.end(); itr++) {
+        if(FunctionDef *nested = dynamic_cast<FunctionDef*>(*itr)) {
+            _queued.insert(nested);
+        }
+    }
+
+    return body;
+}
@@ -0,0 +1,63 @@
+// This file contains the tiered execution manager. Programs start out in
+// the baseline tree walker, with only type checking done up front. When
+// a function gets hot, a background thread builds an optimized copy of
+// its body, which calls switch to as soon as it is ready.
+#ifndef TIER_H
+#define TIER_H
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "op.h"
+
+
+class TierManager : public Profiler
+{
+public:
+    // thresholds are calls to a function and iterations of one of its loops
+    TierManager(long long call_threshold=100, long long loop_threshold=10000);
+    virtual ~TierManager();
+
+    // start profiling a checked program
+    virtual void watch(ParseTree *program);
+
+    // queue hot code for the optimizing tier
+    virtual void hot(FunctionDef *fun);
+    virtual void hot(While *loop);
+
+    // the number of functions running optimized code
+    virtual int promoted() const;
+
+    // the number of variable accesses resolved to frame slots
+    virtual int resolved() const;
+
+protected:
+    // record which function each loop belongs to
+    virtual void find_loops(ParseTree *tree, FunctionDef *owner);
+
+    // the compiler thread
+    virtual void worker();
+
+    // build an optimized copy of a function's body
+    virtual Program *optimize(FunctionDef *fun);
+
+private:
+    std::map<While*, FunctionDef*> _loop_owner;
+    std::set<FunctionDef*> _queued;
+    std::deque<FunctionDef*> _queue;
+
+    // replaced bodies, which calls already under way may still be using
+    std::vector<Program*> _retired;
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    bool _stop;
+    std::thread _thread;
+    std::atomic<int> _promoted;
+    std::atomic<int> _resolved;
+};
+#endif
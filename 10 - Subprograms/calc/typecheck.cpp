@@ -0,0 +1,324 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "typecheck.h"
+
+//////////////////////////////////////////
+// TypeError Implementation
+//////////////////////////////////////////
+
+TypeError::TypeError(LexerToken &_tok, const std::string &msg)
+{
+    // capture the token
+    this->_tok = _tok;
+
+    // generate the message
+    std::ostringstream os;
+    os << "Type Error: " << msg
+       << " Line: " << _tok.line
+       << " Column: " << _tok.col;
+
+    _msg = os.str();
+}
+
+
+const char* TypeError::what() const noexcept
+{
+    return _msg.c_str();
+}
+
+
+LexerToken TypeError::token() const
+{
+    return _tok;
+}
+
+
+//////////////////////////////////////////
+// TypeEnv Implementation
+//////////////////////////////////////////
+
+// constructor
+TypeEnv::TypeEnv() : TypeEnv(nullptr)
+{
+    // nothing to do
+}
+
+
+TypeEnv::TypeEnv(TypeEnv *_parent)
+{
+    parent(_parent);
+}
+
+
+// access/modify the parent
+TypeEnv *TypeEnv::parent()
+{
+    return _parent;
+}
+
+
+void TypeEnv::parent(TypeEnv *_parent)
+{
+    this->_parent = _parent;
+}
+
+
+// declare a name, returns false if the name already exists
+bool TypeEnv::declare(const std::string &name, ResultType type, FunctionDef *fun)
+{
+    // names must be unique across all enclosing scopes, just like RefEnv
+    if(lookup(name)) {
+        return false;
+    }
+
+    TypeSymbol sym;
+    sym.type = type;
+    sym.fun = fun;
+    _symtab[name] = sym;
+    return true;
+}
+
+
+// look up a name, returns nullptr if the name does not exist
+TypeSymbol *TypeEnv::lookup(const std::string &name)
+{
+    auto itr = _symtab.find(name);
+    if(itr != _symtab.end()) {
+        return &itr->second;
+    } else if(parent() == nullptr) {
+        return nullptr;
+    } else {
+        return parent()->lookup(name);
+    }
+}
+
+
+//////////////////////////////////////////
+// TypeChecker Implementation
+//////////////////////////////////////////
+
+// constructor
+TypeChecker::TypeChecker()
+{
+    // nothing to do
+}
+
+
+// check a tree in the global scope, returning its type
+ResultType TypeChecker::check(ParseTree *tree)
+{
+    return check(tree, _global);
+}
+
+
+// check a tree in the given scope
+ResultType TypeChecker::check(ParseTree *tree, TypeEnv &env)
+{
+    ResultType result = VOID;
+
+    if(Program *program = dynamic_cast<Program*>(tree)) {
+        result = check_program(program, env);
+    } else if(dynamic_cast<Add*>(tree) or dynamic_cast<Sub*>(tree) or
+              dynamic_cast<Mul*>(tree) or dynamic_cast<Div*>(tree) or
+              dynamic_cast<Pow*>(tree)) {
+        result = check_arith((BinaryOp*) tree, env);
+    } else if(dynamic_cast<Equal*>(tree) or dynamic_cast<NotEqual*>(tree)) {
+        result = check_compare((BinaryOp*) tree, env);
+    } else if(Neg *neg = dynamic_cast<Neg*>(tree)) {
+        result = numeric(neg->child(), env);
+    } else if(dynamic_cast<Number*>(tree)) {
+        result = tree->token() == INTLIT ? INTEGER : REAL;
+    } else if(dynamic_cast<Var*>(tree)) {
+        result = check_var(tree, env);
+    } else if(Print *print = dynamic_cast<Print*>(tree)) {
+        numeric(print->child(), env);
+    } else if(VarDecl *decl = dynamic_cast<VarDecl*>(tree)) {
+        result = check_decl(decl, env);
+    } else if(Assign *assign = dynamic_cast<Assign*>(tree)) {
+        result = check_assign(assign, env);
+    } else if(dynamic_cast<While*>(tree) or dynamic_cast<Branch*>(tree)) {
+        BinaryOp *op = (BinaryOp*) tree;
+        check(op->left(), env);
+        check(op->right(), env);
+    } else if(FunctionCall *call = dynamic_cast<FunctionCall*>(tree)) {
+        result = check_call(call, env);
+    }
+
+    // FunctionDef bodies are checked by their enclosing program, and
+    // ArgLists are checked by their calls.
+    tree->type(result);
+    return result;
+}
+
+
+// check a block of statements
+ResultType TypeChecker::check_program(Program *program, TypeEnv &env)
+{
+    std::vector<FunctionDef*> functions;
+    ResultType result = VOID;
+
+    // Declare the block's functions up front so that they may call
+    // each other regardless of the order they are defined in.
+    for(auto itr = program->begin(); itr != program->end(); itr++) {
+        FunctionDef *fun = dynamic_cast<FunctionDef*>(*itr);
+        if(not fun) continue;
+
+        if(not env.declare(fun->name(), FUNCTION_TYPE, fun)) {
+            LexerToken tok = fun->token();
+            throw TypeError(tok, "Redeclaration of " + fun->name());
+        }
+        functions.push_back(fun);
+    }
+
+    // check each statement, the program has the type of its last one
+    for(auto itr = program->begin(); itr != program->end(); itr++) {
+        result = check(*itr, env);
+    }
+
+    // function bodies can see everything declared in the block
+    for(auto itr = functions.begin(); itr != functions.end(); itr++) {
+        check_function_body(*itr, env);
+    }
+
+    return result;
+}
+
+
+// arithmetic operators widen integers to reals
+ResultType TypeChecker::check_arith(BinaryOp *op, TypeEnv &env)
+{
+    ResultType l = numeric(op->left(), env);
+    ResultType r = numeric(op->right(), env);
+
+    if(l == r) return l;
+    return REAL;
+}
+
+
+// comparisons are integer valued
+ResultType TypeChecker::check_compare(BinaryOp *op, TypeEnv &env)
+{
+    numeric(op->left(), env);
+    numeric(op->right(), env);
+    return INTEGER;
+}
+
+
+// variables have their declared type
+ResultType TypeChecker::check_var(ParseTree *var, TypeEnv &env)
+{
+    LexerToken tok = var->token();
+    TypeSymbol *sym = env.lookup(tok.lexeme);
+
+    if(not sym) {
+        throw TypeError(tok, tok.lexeme + " not defined.");
+    }
+
+    return sym->type;
+}
+
+
+// declarations introduce a new name into the scope
+ResultType TypeChecker::check_decl(VarDecl *decl, TypeEnv &env)
+{
+    ResultType var_type = decl->token() == INTEGER_DECL ? INTEGER : REAL;
+    LexerToken tok = decl->child()->token();
+
+    if(not env.declare(tok.lexeme, var_type)) {
+        throw TypeError(tok, "Redeclaration of " + tok.lexeme);
+    }
+    decl->child()->type(var_type);
+
+    return VOID;
+}
+
+
+// only numeric variables may be assigned
+ResultType TypeChecker::check_assign(Assign *assign, TypeEnv &env)
+{
+    LexerToken tok = assign->left()->token();
+
+    if(not dynamic_cast<Var*>(assign->left())) {
+        throw TypeError(tok, "Cannot assign to " + tok.lexeme);
+    }
+
+    ResultType var_type = check(assign->left(), env);
+    if(var_type != INTEGER and var_type != REAL) {
+        throw TypeError(tok, "Cannot assign to function " + tok.lexeme);
+    }
+
+    numeric(assign->right(), env);
+    return VOID;
+}
+
+
+// calls must match the function's parameter list
+ResultType TypeChecker::check_call(FunctionCall *call, TypeEnv &env)
+{
+    LexerToken tok = call->left()->token();
+    check_var(call->left(), env);
+    TypeSymbol *sym = env.lookup(tok.lexeme);
+
+    if(sym->type != FUNCTION_TYPE) {
+        throw TypeError(tok, tok.lexeme + " is not a function.");
+    }
+    call->left()->type(FUNCTION_TYPE);
+
+    // count the parameters and the arguments
+    ArgList *params = sym->fun->parameters();
+    ArgList *args = (ArgList*) call->right();
+    int nparams = params->end() - params->begin();
+    int nargs = args->end() - args->begin();
+
+    if(nparams != nargs) {
+        std::ostringstream os;
+        os << tok.lexeme << " expects " << nparams
+           << " arguments but was given " << nargs << ".";
+        throw TypeError(tok, os.str());
+    }
+
+    // all arguments are converted to their parameter's type
+    for(auto itr = args->begin(); itr != args->end(); itr++) {
+        numeric(*itr, env);
+    }
+
+    return sym->fun->return_type();
+}
+
+
+// function bodies are checked in their own scope
+void TypeChecker::check_function_body(FunctionDef *fun, TypeEnv &env)
+{
+    TypeEnv local(&env);
+
+    // declare the parameters
+    ArgList *params = fun->parameters();
+    for(auto itr = params->begin(); itr != params->end(); itr++) {
+        check(*itr, local);
+    }
+
+    // the last statement provides the return value
+    ResultType body_type = check(fun->body(), local);
+    ResultType return_type = fun->return_type();
+    if(return_type != VOID and body_type != INTEGER and body_type != REAL) {
+        LexerToken tok = fun->token();
+        throw TypeError(tok, fun->name() + " must end with an expression of type "
+                             + RTSTR[return_type] + ".");
+    }
+}
+
+
+// require a numeric type, throwing a type error otherwise
+ResultType TypeChecker::numeric(ParseTree *tree, TypeEnv &env)
+{
+    ResultType result = check(tree, env);
+
+    if(result != INTEGER and result != REAL) {
+        LexerToken tok = tree->token();
+        throw TypeError(tok, std::string("Expected a number but found ")
+                             + RTSTR[result] + ".");
+    }
+
+    return result;
+}
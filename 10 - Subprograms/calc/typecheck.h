@@ -0,0 +1,92 @@
+// This file contains the static type checker for calc parse trees.
+// The checker infers the type of every expression before the program
+// runs, annotates each node with that type, and reports type errors.
+#ifndef TYPECHECK_H
+#define TYPECHECK_H
+#include <iostream>
+#include <string>
+#include <map>
+#include "lexer.h"
+#include "op.h"
+
+
+class TypeError : std::exception
+{
+public:
+    TypeError(LexerToken &tok, const std::string &msg);
+    virtual const char* what() const noexcept;
+    virtual LexerToken token() const;
+
+private:
+    LexerToken _tok;
+    std::string _msg;
+};
+
+
+//////////////////////////////////////////
+// Static Type Storage
+//////////////////////////////////////////
+
+// The static information known about a declared name
+struct TypeSymbol
+{
+    ResultType type;
+    FunctionDef *fun;   // definition of function names, nullptr otherwise
+};
+
+
+class TypeEnv {
+public:
+    // constructor
+    TypeEnv();
+    TypeEnv(TypeEnv *_parent);
+
+    // access/modify the parent
+    virtual TypeEnv *parent();
+    virtual void parent(TypeEnv *_parent);
+
+    // declare a name, returns false if the name already exists
+    virtual bool declare(const std::string &name, ResultType type, FunctionDef *fun=nullptr);
+
+    // look up a name, returns nullptr if the name does not exist
+    virtual TypeSymbol *lookup(const std::string &name);
+
+private:
+    std::map<std::string, TypeSymbol> _symtab;
+    TypeEnv *_parent;
+};
+
+
+//////////////////////////////////////////
+// The Type Checker
+//////////////////////////////////////////
+class TypeChecker
+{
+public:
+    // constructor
+    TypeChecker();
+
+    // check a tree in the global scope, returning its type
+    virtual ResultType check(ParseTree *tree);
+
+protected:
+    // check a tree in the given scope
+    virtual ResultType check(ParseTree *tree, TypeEnv &env);
+
+    // node specific checks
+    virtual ResultType check_program(Program *program, TypeEnv &env);
+    virtual ResultType check_arith(BinaryOp *op, TypeEnv &env);
+    virtual ResultType check_compare(BinaryOp *op, TypeEnv &env);
+    virtual ResultType check_var(ParseTree *var, TypeEnv &env);
+    virtual ResultType check_decl(VarDecl *decl, TypeEnv &env);
+    virtual ResultType check_assign(Assign *assign, TypeEnv &env);
+    virtual ResultType check_call(FunctionCall *call, TypeEnv &env);
+    virtual void check_function_body(FunctionDef *fun, TypeEnv &env);
+
+    // require a numeric type, throwing a type error otherwise
+    virtual ResultType numeric(ParseTree *tree, TypeEnv &env);
+
+private:
+    TypeEnv _global;
+};
+#endif
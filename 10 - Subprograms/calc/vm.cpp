@@ -0,0 +1,267 @@
+#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include "vm.h"
+
+//////////////////////////////////////////
+// VM Implementation
+//////////////////////////////////////////
+
+// constructor, the stack size is a number of values
+VM::VM(int stack_size) : _stack(stack_size)
+{
+    _count = 0;
+}
+
+
+// run a compiled program
+void VM::run(const Bytecode &bc)
+{
+    const int *code = bc.code.data();
+    const double *reals = bc.reals.data();
+    ResultField *base = _stack.data();
+    ResultField *end = base + _stack.size();
+    const FunctionCode &main = bc.functions[0];
+    long long count = 0;
+
+    // the top level program's frame holds the globals
+    if(main.nslots + main.max_stack > (int) _stack.size()) {
+        throw std::runtime_error("Stack overflow.");
+    }
+    for(int i=0; i<main.nslots; i++) {
+        base[i].r = 0;
+    }
+    _frames.clear();
+    _frames.push_back(Frame{nullptr, base, -1});
+
+    // machine registers
+    int frame = 0;
+    ResultField *fp = base;
+    ResultField *sp = base + main.nslots;
+    const int *pc = code + main.entry;
+
+    for(;;) {
+        count++;
+        switch(*pc++) {
+            case OP_HALT:
+                _count = count;
+                return;
+
+            case OP_PUSH_I:
+                sp->i = *pc++;
+                sp++;
+                break;
+
+            case OP_PUSH_R:
+                sp->r = reals[*pc++];
+                sp++;
+                break;
+
+            case OP_POP:
+                sp--;
+                break;
+
+            case OP_LOAD:
+                *sp++ = fp[*pc++];
+                break;
+
+            case OP_STORE:
+                fp[*pc++] = *--sp;
+                break;
+
+            case OP_LOAD_G:
+                *sp++ = base[*pc++];
+                break;
+
+            case OP_STORE_G:
+                base[*pc++] = *--sp;
+                break;
+
+            case OP_LOAD_UP: {
+                int f = frame;
+                for(int hops = pc[0]; hops; hops--) f = _frames[f].link;
+                *sp++ = _frames[f].fp[pc[1]];
+                pc += 2;
+                break;
+            }
+
+            case OP_STORE_UP: {
+                int f = frame;
+                for(int hops = pc[0]; hops; hops--) f = _frames[f].link;
+                _frames[f].fp[pc[1]] = *--sp;
+                pc += 2;
+                break;
+            }
+
+            // arithmetic
+            case OP_ADD_I:
+                sp--;
+                sp[-1].i = AddFn::apply(sp[-1].i, sp[0].i);
+                break;
+
+            case OP_ADD_R:
+                sp--;
+                sp[-1].r += sp[0].r;
+                break;
+
+            case OP_SUB_I:
+                sp--;
+                sp[-1].i = SubFn::apply(sp[-1].i, sp[0].i);
+                break;
+
+            case OP_SUB_R:
+                sp--;
+                sp[-1].r -= sp[0].r;
+                break;
+
+            case OP_MUL_I:
+                sp--;
+                sp[-1].i = MulFn::apply(sp[-1].i, sp[0].i);
+                break;
+
+            case OP_MUL_R:
+                sp--;
+                sp[-1].r *= sp[0].r;
+                break;
+
+            case OP_DIV_I:
+                sp--;
+                sp[-1].i = DivFn::apply(sp[-1].i, sp[0].i);
+                break;
+
+            case OP_DIV_R:
+                sp--;
+                sp[-1].r /= sp[0].r;
+                break;
+
+            case OP_POW_I:
+                sp--;
+                sp[-1].i = checked_pow(sp[-1].i, sp[0].i);
+                break;
+
+            case OP_POW_R:
+                sp--;
+                sp[-1].r = pow(sp[-1].r, sp[0].r);
+                break;
+
+            case OP_NEG_I:
+                sp[-1].i = NegFn::apply(sp[-1].i);
+                break;
+
+            case OP_NEG_R:
+                sp[-1].r = -sp[-1].r;
+                break;
+
+            case OP_I2R:
+                sp[-1].r = sp[-1].i;
+                break;
+
+            case OP_R2I:
+                sp[-1].i = sp[-1].r;
+                break;
+
+            // comparisons
+            case OP_EQ_I:
+                sp--;
+                sp[-1].i = sp[-1].i == sp[0].i;
+                break;
+
+            case OP_EQ_R:
+                sp--;
+                sp[-1].i = sp[-1].r == sp[0].r;
+                break;
+
+            case OP_NE_I:
+                sp--;
+                sp[-1].i = sp[-1].i != sp[0].i;
+                break;
+
+            case OP_NE_R:
+                sp--;
+                sp[-1].i = sp[-1].r != sp[0].r;
+                break;
+
+            // control flow
+            case OP_JMP:
+                pc = code + *pc;
+                break;
+
+            case OP_JZ:
+                sp--;
+                if(sp->i == 0) {
+                    pc = code + *pc;
+                } else {
+                    pc++;
+                }
+                break;
+
+            case OP_CALL: {
+                const FunctionCode &fun = bc.functions[pc[0]];
+
+                // find the frame of the function's declaring scope
+                int link = frame;
+                for(int hops = pc[1]; hops; hops--) link = _frames[link].link;
+
+                // the arguments become the first slots of the new frame
+                ResultField *nfp = sp - fun.nparams;
+                if(nfp + fun.nslots + fun.max_stack > end) {
+                    throw std::runtime_error("Stack overflow.");
+                }
+                for(sp = nfp + fun.nparams; sp < nfp + fun.nslots; sp++) {
+                    sp->r = 0;
+                }
+
+                _frames.push_back(Frame{pc + 2, nfp, link});
+                frame = _frames.size() - 1;
+                fp = nfp;
+                pc = code + fun.entry;
+                break;
+            }
+
+            case OP_TAILCALL: {
+                const FunctionCode &fun = bc.functions[pc[0]];
+
+                // the arguments replace the parameters and the locals start over
+                ResultField *args = sp - fun.nparams;
+                for(int i = 0; i < fun.nparams; i++) {
+                    fp[i] = args[i];
+                }
+                for(sp = fp + fun.nparams; sp < fp + fun.nslots; sp++) {
+                    sp->r = 0;
+                }
+
+                pc = code + fun.entry;
+                break;
+            }
+
+            case OP_RET: {
+                ResultField result = sp[-1];
+                sp = fp;
+                pc = _frames[frame].ret;
+                _frames.pop_back();
+                frame--;
+                fp = _frames[frame].fp;
+                *sp++ = result;
+                break;
+            }
+
+            // output
+            case OP_PRINT_I:
+                sp--;
+                std::cout << sp->i << std::endl;
+                break;
+
+            case OP_PRINT_R:
+                sp--;
+                std::cout << sp->r << std::endl;
+                break;
+        }
+    }
+}
+
+
+// the number of instructions executed by the last run
+long long VM::count() const
+{
+    return _count;
+}
@@ -0,0 +1,35 @@
+// This file contains the virtual machine which runs calc bytecode.
+#ifndef VM_H
+#define VM_H
+#include <vector>
+#include "op.h"
+#include "bytecode.h"
+
+
+class VM
+{
+public:
+    // constructor, the stack size is a number of values
+    VM(int stack_size=1024*1024);
+
+    // run a compiled program
+    virtual void run(const Bytecode &bc);
+
+    // the number of instructions executed by the last run
+    virtual long long count() const;
+
+protected:
+    // The record of a function activation
+    struct Frame
+    {
+        const int *ret;     // where to continue in the caller
+        ResultField *fp;    // the first slot of the frame
+        int link;           // the frame of the declaring function
+    };
+
+private:
+    std::vector<ResultField> _stack;
+    std::vector<Frame> _frames;
+    long long _count;
+};
+#endif